@@ -0,0 +1,375 @@
+#include "bcache.h"
+#include "lib.h"
+#include "buddy.h"
+
+bcache_stats_t bcache_stats;                                                                        // exported hit/miss/evict counters
+block_dev_t ramdisk_dev;                                                                            // the multiboot module holding filesys_img
+
+static block_dev_t*  cache_dev = NULL;                                                              // device under the cache
+static bcache_buf_t  bufs[BCACHE_SIZE];                                                             // buffer headers
+static uint8_t       (*buf_data)[BCACHE_BLOCK_SIZE] = NULL;                                         // buffer pool, from the buddy allocator
+static int16_t       hash_head[BCACHE_HASH_SIZE];                                                   // first buffer of each bucket
+static uint32_t      clock_hand = 0;                                                                // next buffer the CLOCK looks at
+static uint8_t*      ramdisk_base = NULL;                                                           // start address of the ramdisk
+
+/**
+ * ramdisk_read
+ *  DESCRIPTION : copy consecutive blocks out of the ramdisk
+ *  INPUTS : uint32_t block - the first block
+ *           uint32_t count - the number of blocks
+ *           uint8_t* buf - the destination
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success, -1 - out of range
+ *  SIDE EFFECTS : none
+ */
+static int32_t ramdisk_read (uint32_t block, uint32_t count, uint8_t* buf)
+{
+    if (block + count > ramdisk_dev.num_blocks) return -1;
+    memcpy(buf, ramdisk_base + block * BCACHE_BLOCK_SIZE, count * BCACHE_BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * ramdisk_write
+ *  DESCRIPTION : copy consecutive blocks into the ramdisk
+ *  INPUTS : uint32_t block - the first block
+ *           uint32_t count - the number of blocks
+ *           const uint8_t* buf - the source
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success, -1 - out of range
+ *  SIDE EFFECTS : modify the ramdisk
+ */
+static int32_t ramdisk_write (uint32_t block, uint32_t count, const uint8_t* buf)
+{
+    if (block + count > ramdisk_dev.num_blocks) return -1;
+    memcpy(ramdisk_base + block * BCACHE_BLOCK_SIZE, buf, count * BCACHE_BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * ramdisk_map
+ *  DESCRIPTION : address of a ramdisk block
+ *  INPUTS : uint32_t block - the block
+ *  OUTPUTS : none
+ *  RETURN VALUE : the address of the block
+ *  SIDE EFFECTS : none
+ */
+static uint8_t* ramdisk_map (uint32_t block)
+{
+    return ramdisk_base + block * BCACHE_BLOCK_SIZE;
+}
+
+/**
+ * ramdisk_init
+ *  DESCRIPTION : set up the memory-backed device over the filesystem image
+ *  INPUTS : uint32_t addr - start address of the image
+ *           uint32_t num_blocks - size of the image in blocks
+ *  OUTPUTS : none
+ *  RETURN VALUE : the ramdisk device
+ *  SIDE EFFECTS : none
+ */
+block_dev_t* ramdisk_init (uint32_t addr, uint32_t num_blocks)
+{
+    ramdisk_base = (uint8_t*)addr;
+    ramdisk_dev.num_blocks = num_blocks;
+    ramdisk_dev.read = &ramdisk_read;
+    ramdisk_dev.write = &ramdisk_write;
+    ramdisk_dev.map = &ramdisk_map;
+    return &ramdisk_dev;
+}
+
+/**
+ * bcache_init
+ *  DESCRIPTION : empty the cache and put it on top of a block device.
+ *                The buffer pool comes from the buddy allocator, so
+ *                buddy_init has to run first.
+ *  INPUTS : block_dev_t* dev - the backing device
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : allocate the pool the first time, reset all buffers and counters
+ */
+void bcache_init (block_dev_t* dev)
+{
+    uint32_t i;
+    cache_dev = dev;
+    if (buf_data == NULL) buf_data = (uint8_t (*)[BCACHE_BLOCK_SIZE])buddy_alloc(buddy_order(BCACHE_SIZE * BCACHE_BLOCK_SIZE));
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        bufs[i].valid = 0;
+        bufs[i].dirty = 0;
+        bufs[i].referenced = 0;
+        bufs[i].hash_next = BCACHE_NONE;
+    }
+    for (i = 0; i < BCACHE_HASH_SIZE; i++) hash_head[i] = BCACHE_NONE;
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+    clock_hand = 0;
+}
+
+/**
+ * bcache_lookup
+ *  DESCRIPTION : find the buffer holding a block
+ *  INPUTS : uint32_t block - the device block
+ *  OUTPUTS : none
+ *  RETURN VALUE : the buffer index, BCACHE_NONE if the block is not cached
+ *  SIDE EFFECTS : none
+ */
+static int32_t bcache_lookup (uint32_t block)
+{
+    int32_t i;
+    for (i = hash_head[block & (BCACHE_HASH_SIZE - 1)]; i != BCACHE_NONE; i = bufs[i].hash_next) {
+        if (bufs[i].block == block) return i;
+    }
+    return BCACHE_NONE;
+}
+
+/**
+ * bcache_unhash
+ *  DESCRIPTION : unlink a buffer from its hash bucket
+ *  INPUTS : int32_t index - the buffer index
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the hash chains
+ */
+static void bcache_unhash (int32_t index)
+{
+    int16_t* link = &hash_head[bufs[index].block & (BCACHE_HASH_SIZE - 1)];
+    while (*link != BCACHE_NONE) {
+        if (*link == index) {
+            *link = bufs[index].hash_next;
+            return;
+        }
+        link = &bufs[*link].hash_next;
+    }
+}
+
+/**
+ * bcache_writeback
+ *  DESCRIPTION : write a dirty buffer back to the device
+ *  INPUTS : int32_t index - the buffer index
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : the buffer becomes clean
+ */
+static void bcache_writeback (int32_t index)
+{
+    if (!bufs[index].valid || !bufs[index].dirty) return;
+    cache_dev->write(bufs[index].block, 1, buf_data[index]);
+    bufs[index].dirty = 0;
+    bcache_stats.writebacks++;
+}
+
+/**
+ * bcache_alloc
+ *  DESCRIPTION : pick a buffer for a block with the CLOCK policy. Buffers
+ *                referenced since the hand last passed get a second chance.
+ *  INPUTS : uint32_t block - the device block the buffer will hold
+ *  OUTPUTS : none
+ *  RETURN VALUE : the buffer index
+ *  SIDE EFFECTS : may write back and evict another block
+ */
+static int32_t bcache_alloc (uint32_t block)
+{
+    int32_t victim;
+    while (1) {
+        victim = clock_hand;
+        clock_hand = (clock_hand + 1) % BCACHE_SIZE;
+        if (!bufs[victim].valid) break;
+        if (!bufs[victim].referenced) {
+            bcache_writeback(victim);
+            bcache_unhash(victim);
+            bcache_stats.evictions++;
+            break;
+        }
+        bufs[victim].referenced = 0;
+    }
+    bufs[victim].block = block;
+    bufs[victim].valid = 1;
+    bufs[victim].dirty = 0;
+    bufs[victim].referenced = 1;
+    bufs[victim].hash_next = hash_head[block & (BCACHE_HASH_SIZE - 1)];
+    hash_head[block & (BCACHE_HASH_SIZE - 1)] = victim;
+    return victim;
+}
+
+/**
+ * bcache_read
+ *  DESCRIPTION : read length bytes starting at offset in block through the
+ *                cache. The range may span consecutive blocks. On a memory
+ *                mapped device, block-sized reads of uncached blocks are
+ *                streamed straight from the device in one copy instead of
+ *                filling (and polluting) the pool.
+ *  INPUTS : uint32_t block - the first device block
+ *           uint32_t offset - offset in the first block
+ *           uint8_t* buf - the destination
+ *           uint32_t length - the number of bytes to read
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes read, -1 on device error
+ *  SIDE EFFECTS : may evict buffers, update the counters
+ */
+int32_t bcache_read (uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+    uint32_t flags;
+    uint32_t bytes_read = 0;
+    int32_t idx;
+    cli_and_save(flags);                                                                            // keyboard autocomplete reads files too
+
+    block += offset / BCACHE_BLOCK_SIZE;
+    offset %= BCACHE_BLOCK_SIZE;
+    while (bytes_read < length) {
+        uint32_t left = length - bytes_read;
+        uint32_t copy_len = BCACHE_BLOCK_SIZE - offset;
+        if (copy_len > left) copy_len = left;
+
+        idx = bcache_lookup(block);
+        if (idx != BCACHE_NONE) {
+            bcache_stats.hits++;
+            bufs[idx].referenced = 1;
+            memcpy(buf, buf_data[idx] + offset, copy_len);
+        } else if (cache_dev->map != NULL && left >= BCACHE_BLOCK_SIZE) {
+            /* stream the run of uncached blocks in a single copy */
+            uint32_t run = 1;
+            while ((run + 1) * BCACHE_BLOCK_SIZE <= left + offset && bcache_lookup(block + run) == BCACHE_NONE) run++;
+            copy_len = run * BCACHE_BLOCK_SIZE - offset;
+            if (copy_len > left) copy_len = left;
+            memcpy(buf, cache_dev->map(block) + offset, copy_len);
+            bcache_stats.misses += run;
+            bcache_stats.bypasses += run;
+            block += run - 1;
+        } else {
+            bcache_stats.misses++;
+            idx = bcache_alloc(block);
+            if (cache_dev->read(block, 1, buf_data[idx]) == -1) {
+                bcache_unhash(idx);
+                bufs[idx].valid = 0;
+                restore_flags(flags);
+                return -1;
+            }
+            memcpy(buf, buf_data[idx] + offset, copy_len);
+        }
+        buf += copy_len;
+        bytes_read += copy_len;
+        block++;
+        offset = 0;
+    }
+
+    restore_flags(flags);
+    return bytes_read;
+}
+
+/**
+ * bcache_write
+ *  DESCRIPTION : write length bytes starting at offset in block into the
+ *                cache. The range may span consecutive blocks. Blocks only
+ *                partially overwritten are read from the device first.
+ *  INPUTS : uint32_t block - the first device block
+ *           uint32_t offset - offset in the first block
+ *           const uint8_t* buf - the source
+ *           uint32_t length - the number of bytes to write
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes written, -1 on device error
+ *  SIDE EFFECTS : the buffers become dirty, may evict buffers
+ */
+int32_t bcache_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    uint32_t flags;
+    uint32_t bytes_written = 0;
+    int32_t idx;
+    cli_and_save(flags);
+
+    block += offset / BCACHE_BLOCK_SIZE;
+    offset %= BCACHE_BLOCK_SIZE;
+    while (bytes_written < length) {
+        uint32_t copy_len = BCACHE_BLOCK_SIZE - offset;
+        if (copy_len > length - bytes_written) copy_len = length - bytes_written;
+
+        idx = bcache_lookup(block);
+        if (idx != BCACHE_NONE) {
+            bcache_stats.hits++;
+        } else {
+            bcache_stats.misses++;
+            idx = bcache_alloc(block);
+            if (copy_len < BCACHE_BLOCK_SIZE && cache_dev->read(block, 1, buf_data[idx]) == -1) {
+                bcache_unhash(idx);
+                bufs[idx].valid = 0;
+                restore_flags(flags);
+                return -1;
+            }
+        }
+        memcpy(buf_data[idx] + offset, buf, copy_len);
+        bufs[idx].dirty = 1;
+        bufs[idx].referenced = 1;
+
+        buf += copy_len;
+        bytes_written += copy_len;
+        block++;
+        offset = 0;
+    }
+
+    restore_flags(flags);
+    return bytes_written;
+}
+
+/**
+ * bcache_sync
+ *  DESCRIPTION : write every dirty buffer back to the device
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : all buffers become clean
+ */
+void bcache_sync (void)
+{
+    uint32_t flags;
+    int32_t i;
+    cli_and_save(flags);
+    for (i = 0; i < BCACHE_SIZE; i++) bcache_writeback(i);
+    restore_flags(flags);
+}
+
+/**
+ * bcache_invalidate
+ *  DESCRIPTION : drop a block from the cache without writing it back,
+ *                used when the block is freed
+ *  INPUTS : uint32_t block - the device block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : the buffer becomes free
+ */
+void bcache_invalidate (uint32_t block)
+{
+    uint32_t flags;
+    int32_t idx;
+    cli_and_save(flags);
+    idx = bcache_lookup(block);
+    if (idx != BCACHE_NONE) {
+        bcache_unhash(idx);
+        bufs[idx].valid = 0;
+        bufs[idx].dirty = 0;
+    }
+    restore_flags(flags);
+}
+
+/**
+ * bcache_map
+ *  DESCRIPTION : give the address of a block on a memory-mapped device so
+ *                that it can be mapped into user space without a copy.
+ *                A dirty buffer of the block is written back first so the
+ *                device holds the latest data.
+ *  INPUTS : uint32_t block - the device block
+ *  OUTPUTS : none
+ *  RETURN VALUE : the address of the block, NULL if the device is not memory mapped
+ *  SIDE EFFECTS : may write back a buffer
+ */
+uint8_t* bcache_map (uint32_t block)
+{
+    uint32_t flags;
+    int32_t idx;
+    uint8_t* addr = NULL;
+    cli_and_save(flags);
+    if (cache_dev->map != NULL && block < cache_dev->num_blocks) {
+        idx = bcache_lookup(block);
+        if (idx != BCACHE_NONE) bcache_writeback(idx);
+        addr = cache_dev->map(block);
+    }
+    restore_flags(flags);
+    return addr;
+}
@@ -0,0 +1,59 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+
+/* Macro numbers */
+#define BCACHE_BLOCK_SIZE    4096                       // same as the filesystem block size
+#define BCACHE_SIZE          32                         // buffers in the pool
+#define BCACHE_HASH_SIZE     64                         // buckets of the block -> buffer index, must be a power of 2
+#define BCACHE_NONE          (-1)                       // end of a hash chain / block not cached
+
+/* a device the cache reads blocks from and writes blocks back to */
+typedef struct block_dev
+{
+    uint32_t num_blocks;                                                    // size of the device in blocks
+    int32_t  (*read) (uint32_t block, uint32_t count, uint8_t* buf);        // read count consecutive blocks
+    int32_t  (*write) (uint32_t block, uint32_t count, const uint8_t* buf); // write count consecutive blocks
+    uint8_t* (*map) (uint32_t block);                                       // address of a block, NULL if the device is not memory mapped
+} block_dev_t;
+
+/* one cached block */
+typedef struct bcache_buf
+{
+    uint32_t block;                                     // device block held in the buffer
+    uint8_t  valid;                                     // 1 if the buffer holds a block
+    uint8_t  dirty;                                     // 1 if the buffer is newer than the device
+    uint8_t  referenced;                                // CLOCK reference bit
+    int16_t  hash_next;                                 // next buffer in the same bucket
+} bcache_buf_t;
+
+/* access counters of the cache */
+typedef struct bcache_stats
+{
+    uint32_t hits;                                      // blocks served from a buffer
+    uint32_t misses;                                    // blocks that had to come from the device
+    uint32_t bypasses;                                  // missed blocks streamed from a mapped device without a buffer
+    uint32_t evictions;                                 // valid buffers reused for another block
+    uint32_t writebacks;                                // dirty buffers written back to the device
+} bcache_stats_t;
+
+extern bcache_stats_t bcache_stats;
+extern block_dev_t ramdisk_dev;
+
+/* initialize the memory-backed device holding the filesystem image */
+block_dev_t* ramdisk_init (uint32_t addr, uint32_t num_blocks);
+/* initialize the cache on top of a block device */
+void bcache_init (block_dev_t* dev);
+/* read length bytes starting at offset in block, may span consecutive blocks */
+int32_t bcache_read (uint32_t block, uint32_t offset, uint8_t* buf, uint32_t length);
+/* write length bytes starting at offset in block, may span consecutive blocks */
+int32_t bcache_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length);
+/* write every dirty buffer back to the device */
+void bcache_sync (void);
+/* drop a block from the cache without writing it back */
+void bcache_invalidate (uint32_t block);
+/* address of a block on a memory-mapped device, written back first if dirty */
+uint8_t* bcache_map (uint32_t block);
+
+#endif
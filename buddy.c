@@ -0,0 +1,203 @@
+#include "buddy.h"
+#include "lib.h"
+
+buddy_stats_t buddy_stats;                                                                          // exported free/used page counters
+
+/* a free block, the links live in the block itself */
+typedef struct buddy_block
+{
+    struct buddy_block* next;
+    struct buddy_block* prev;
+} buddy_block_t;
+
+static buddy_block_t* free_list[BUDDY_MAX_ORDER + 1];                                              // free blocks of each order
+static uint8_t        frame_info[BUDDY_NUM_FRAMES];                                                 // order of the block a frame starts, BUDDY_FREE if free
+static module_t*      boot_mods = NULL;                                                             // multiboot modules, kept out of the free lists
+static uint32_t       boot_mods_count = 0;
+
+/**
+ * free_list_add
+ *  DESCRIPTION : put a block at the head of the free list of its order
+ *  INPUTS : uint32_t frame - the first frame of the block
+ *           uint32_t order - the order of the block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : write the links into the block, mark it free in frame_info
+ */
+static void free_list_add (uint32_t frame, uint32_t order)
+{
+    buddy_block_t* block = (buddy_block_t*)(BUDDY_START + frame * BUDDY_PAGE_SIZE);
+    block->prev = NULL;
+    block->next = free_list[order];
+    if (block->next != NULL) block->next->prev = block;
+    free_list[order] = block;
+    frame_info[frame] = BUDDY_FREE | order;
+}
+
+/**
+ * free_list_remove
+ *  DESCRIPTION : take a free block out of the free list of its order
+ *  INPUTS : uint32_t frame - the first frame of the block
+ *           uint32_t order - the order of the block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : unlink the block, clear its frame_info
+ */
+static void free_list_remove (uint32_t frame, uint32_t order)
+{
+    buddy_block_t* block = (buddy_block_t*)(BUDDY_START + frame * BUDDY_PAGE_SIZE);
+    if (block->prev != NULL) block->prev->next = block->next;
+    else free_list[order] = block->next;
+    if (block->next != NULL) block->next->prev = block->prev;
+    frame_info[frame] = BUDDY_NONE;
+}
+
+/**
+ * buddy_add_range
+ *  DESCRIPTION : hand a range of usable memory to the allocator as the
+ *                largest aligned blocks that fit, leaving out the modules
+ *  INPUTS : uint32_t start - the first byte
+ *           uint32_t end - one past the last byte
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : add blocks to the free lists, count their pages
+ */
+static void buddy_add_range (uint32_t start, uint32_t end)
+{
+    uint32_t i, order, frame, pages;
+    if (start < BUDDY_START) start = BUDDY_START;
+    if (end > BUDDY_END) end = BUDDY_END;
+    start = (start + BUDDY_PAGE_SIZE - 1) & ~(BUDDY_PAGE_SIZE - 1);
+    end &= ~(BUDDY_PAGE_SIZE - 1);
+    if (start >= end) return;
+    for (i = 0; i < boot_mods_count; i++) {
+        if (boot_mods[i].mod_start < end && boot_mods[i].mod_end > start) {                        // split around the module
+            buddy_add_range(start, boot_mods[i].mod_start);
+            buddy_add_range(boot_mods[i].mod_end, end);
+            return;
+        }
+    }
+    frame = (start - BUDDY_START) / BUDDY_PAGE_SIZE;
+    pages = (end - start) / BUDDY_PAGE_SIZE;
+    while (pages > 0) {
+        order = BUDDY_MAX_ORDER;
+        while ((frame & ((1 << order) - 1)) || (1U << order) > pages) order--;                     // aligned and inside the range
+        free_list_add(frame, order);
+        frame += 1 << order;
+        pages -= 1 << order;
+        buddy_stats.total_pages += 1 << order;
+        buddy_stats.free_pages += 1 << order;
+    }
+}
+
+/**
+ * buddy_init
+ *  DESCRIPTION : seed the allocator with the usable memory between 8M and
+ *                128M from the multiboot memory map, or from mem_upper when
+ *                the bootloader gave no map. Runs before paging is enabled,
+ *                paging_init then maps the same range 1:1 for the kernel.
+ *  INPUTS : multiboot_info_t* mbi - the multiboot information
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : fill the free lists, reset buddy_stats
+ */
+void buddy_init (multiboot_info_t* mbi)
+{
+    uint32_t i, end;
+    memory_map_t* mmap;
+    for (i = 0; i <= BUDDY_MAX_ORDER; i++) free_list[i] = NULL;
+    memset(frame_info, BUDDY_NONE, sizeof(frame_info));
+    memset(&buddy_stats, 0, sizeof(buddy_stats));
+    if (mbi->flags & (1 << 3)) {
+        boot_mods = (module_t*)mbi->mods_addr;
+        boot_mods_count = mbi->mods_count;
+    }
+    if (mbi->flags & (1 << 6)) {
+        for (mmap = (memory_map_t*)mbi->mmap_addr;
+                (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+                mmap = (memory_map_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+            if (mmap->type != MMAP_TYPE_RAM || mmap->base_addr_high != 0) continue;                // above 4G
+            end = mmap->base_addr_low + mmap->length_low;
+            if (mmap->length_high != 0 || end < mmap->base_addr_low) end = 0xFFFFFFFF;
+            buddy_add_range(mmap->base_addr_low, end);
+        }
+    } else if (mbi->flags & (1 << 0)) {
+        buddy_add_range(0x100000, 0x100000 + mbi->mem_upper * 1024);                               // mem_upper counts KB above 1M
+    }
+}
+
+/**
+ * buddy_alloc
+ *  DESCRIPTION : take the smallest free block of at least the given order
+ *                and split it down, the unused halves go back to the lists
+ *  INPUTS : uint32_t order - the block is 4K << order bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the physical address of the block, aligned to its size
+ *                 0 if no block is large enough
+ *  SIDE EFFECTS : update the free lists and buddy_stats
+ */
+uint32_t buddy_alloc (uint32_t order)
+{
+    uint32_t k, frame;
+    if (order > BUDDY_MAX_ORDER) return 0;
+    for (k = order; k <= BUDDY_MAX_ORDER && free_list[k] == NULL; k++);
+    if (k > BUDDY_MAX_ORDER) {
+        buddy_stats.failures++;
+        return 0;
+    }
+    frame = ((uint32_t)free_list[k] - BUDDY_START) / BUDDY_PAGE_SIZE;
+    free_list_remove(frame, k);
+    while (k > order) {
+        k--;
+        free_list_add(frame + (1 << k), k);                                                        // the upper half stays free
+    }
+    frame_info[frame] = order;
+    buddy_stats.free_pages -= 1 << order;
+    buddy_stats.used_pages += 1 << order;
+    return BUDDY_START + frame * BUDDY_PAGE_SIZE;
+}
+
+/**
+ * buddy_free
+ *  DESCRIPTION : give back a block and merge it with its buddy for as long
+ *                as the buddy is free and of the same order
+ *  INPUTS : uint32_t addr - an address returned by buddy_alloc
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success, -1 - addr is not an allocated block
+ *  SIDE EFFECTS : update the free lists and buddy_stats
+ */
+int32_t buddy_free (uint32_t addr)
+{
+    uint32_t frame, order, buddy;
+    if (addr < BUDDY_START || addr >= BUDDY_END || (addr & (BUDDY_PAGE_SIZE - 1))) return -1;
+    frame = (addr - BUDDY_START) / BUDDY_PAGE_SIZE;
+    order = frame_info[frame];
+    if (order > BUDDY_MAX_ORDER) return -1;                                                         // free already, or inside a block
+    frame_info[frame] = BUDDY_NONE;
+    buddy_stats.free_pages += 1 << order;
+    buddy_stats.used_pages -= 1 << order;
+    while (order < BUDDY_MAX_ORDER) {
+        buddy = frame ^ (1 << order);
+        if (buddy >= BUDDY_NUM_FRAMES || frame_info[buddy] != (BUDDY_FREE | order)) break;
+        free_list_remove(buddy, order);
+        frame &= ~(1 << order);                                                                     // the merged block starts at the lower half
+        order++;
+    }
+    free_list_add(frame, order);
+    return 0;
+}
+
+/**
+ * buddy_order
+ *  DESCRIPTION : smallest order whose block holds the given size
+ *  INPUTS : uint32_t size - bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the order, BUDDY_MAX_ORDER + 1 if size is over 4M
+ *  SIDE EFFECTS : none
+ */
+uint32_t buddy_order (uint32_t size)
+{
+    uint32_t order = 0;
+    while (order <= BUDDY_MAX_ORDER && (BUDDY_PAGE_SIZE << order) < size) order++;
+    return order;
+}
@@ -0,0 +1,37 @@
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include "types.h"
+#include "multiboot.h"
+
+/* Macro numbers */
+#define BUDDY_PAGE_SIZE      4096                       // smallest block, order 0
+#define BUDDY_MAX_ORDER      10                         // largest block, 4K << 10 = 4M
+#define BUDDY_START          0x800000                   // 8M, memory below holds the kernel
+#define BUDDY_END            0x08000000                 // 128M, the kernel maps memory below the user region 1:1
+#define BUDDY_NUM_FRAMES     ((BUDDY_END - BUDDY_START) / BUDDY_PAGE_SIZE)
+#define BUDDY_FREE           0x80                       // frame_info flag: the frame starts a free block
+#define BUDDY_NONE           0xFF                       // frame_info: not the first frame of a block, or not usable memory
+#define MMAP_TYPE_RAM        1                          // multiboot memory map type of usable memory
+
+/* page counters of the allocator */
+typedef struct buddy_stats
+{
+    uint32_t total_pages;                               // pages the memory map handed to the allocator
+    uint32_t free_pages;                                // pages in free blocks
+    uint32_t used_pages;                                // pages in allocated blocks
+    uint32_t failures;                                  // allocations that found no block large enough
+} buddy_stats_t;
+
+extern buddy_stats_t buddy_stats;
+
+/* seed the free lists from the multiboot memory map, before paging is enabled */
+void buddy_init (multiboot_info_t* mbi);
+/* physical address of a free block of 4K << order bytes, 0 if there is none */
+uint32_t buddy_alloc (uint32_t order);
+/* give back a block returned by buddy_alloc */
+int32_t buddy_free (uint32_t addr);
+/* smallest order whose block holds size bytes */
+uint32_t buddy_order (uint32_t size);
+
+#endif
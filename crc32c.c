@@ -0,0 +1,102 @@
+#include "crc32c.h"
+#include "lib.h"
+
+uint32_t crc32c_sse42 = 0;                                                                  // exported, which method crc32c uses
+
+static uint32_t crc_table[CRC32C_SLICES][256];                                               // table k: a byte followed by k zero bytes
+
+/**
+ * crc32c_init
+ *  DESCRIPTION : build the slicing-by-8 tables and check cpuid for the
+ *                SSE4.2 crc32 instruction
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : fill crc_table, set crc32c_sse42
+ */
+void crc32c_init (void)
+{
+    uint32_t i, j, crc, eax, ebx, ecx, edx;
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        crc_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < CRC32C_SLICES; j++) crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^ crc_table[0][crc_table[j - 1][i] & 0xFF];
+    }
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    crc32c_sse42 = (ecx & CPUID_ECX_SSE42) != 0;
+}
+
+/**
+ * crc32c_hw
+ *  DESCRIPTION : CRC32C with the SSE4.2 crc32 instruction, 4 bytes at a
+ *                time. It only uses general registers, so no FPU or SSE
+ *                state has to be saved around it.
+ *  INPUTS : uint32_t crc - the crc so far, 0 to start
+ *           const uint8_t* buf - the bytes
+ *           uint32_t len - the number of bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the crc including buf
+ *  SIDE EFFECTS : none
+ */
+uint32_t crc32c_hw (uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    uint32_t words = len / 4;
+    crc = ~crc;
+    if (words > 0) {
+        asm volatile (
+            "1: crc32l (%1), %0\n"
+            "   add    $4, %1\n"
+            "   dec    %2\n"
+            "   jnz    1b\n"
+            : "+r"(crc), "+r"(buf), "+r"(words)
+            :
+            : "memory", "cc"
+        );
+    }
+    for (len %= 4; len > 0; len--, buf++) asm volatile ("crc32b (%1), %0" : "+r"(crc) : "r"(buf) : "memory");
+    return ~crc;
+}
+
+/**
+ * crc32c_sw
+ *  DESCRIPTION : CRC32C with the slicing-by-8 tables, 8 bytes a step with
+ *                eight independent lookups instead of a chain of eight
+ *  INPUTS : uint32_t crc - the crc so far, 0 to start
+ *           const uint8_t* buf - the bytes
+ *           uint32_t len - the number of bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the crc including buf
+ *  SIDE EFFECTS : none
+ */
+uint32_t crc32c_sw (uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    uint32_t one, two;
+    crc = ~crc;
+    for (; len >= 8; len -= 8, buf += 8) {
+        one = *(const uint32_t*)buf ^ crc;
+        two = *(const uint32_t*)(buf + 4);
+        crc = crc_table[7][one & 0xFF] ^ crc_table[6][(one >> 8) & 0xFF] ^ crc_table[5][(one >> 16) & 0xFF] ^ crc_table[4][one >> 24]
+            ^ crc_table[3][two & 0xFF] ^ crc_table[2][(two >> 8) & 0xFF] ^ crc_table[1][(two >> 16) & 0xFF] ^ crc_table[0][two >> 24];
+    }
+    for (; len > 0; len--, buf++) crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf) & 0xFF];
+    return ~crc;
+}
+
+/**
+ * crc32c
+ *  DESCRIPTION : CRC32C (Castagnoli) of a buffer, with the crc32
+ *                instruction if the CPU has SSE4.2, with tables otherwise
+ *  INPUTS : uint32_t crc - the crc so far, 0 to start
+ *           const uint8_t* buf - the bytes
+ *           uint32_t len - the number of bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the crc including buf
+ *  SIDE EFFECTS : none
+ */
+uint32_t crc32c (uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    return crc32c_sse42 ? crc32c_hw(crc, buf, len) : crc32c_sw(crc, buf, len);
+}
@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "types.h"
+
+/* Macro numbers */
+#define CRC32C_POLY          0x82F63B78                 // Castagnoli polynomial, bit reversed
+#define CRC32C_SLICES        8                          // bytes the table method consumes per step
+#define CPUID_ECX_SSE42      (1 << 20)                  // cpuid leaf 1: the crc32 instruction exists
+
+/* 1 if crc32c uses the SSE4.2 crc32 instruction, set by crc32c_init */
+extern uint32_t crc32c_sse42;
+
+/* build the tables and pick the SSE4.2 instruction when the CPU has it */
+void crc32c_init (void);
+/* continue the CRC32C crc over len bytes of buf, start with 0 */
+uint32_t crc32c (uint32_t crc, const uint8_t* buf, uint32_t len);
+/* the same with the crc32 instruction, only when crc32c_sse42 is set */
+uint32_t crc32c_hw (uint32_t crc, const uint8_t* buf, uint32_t len);
+/* the same with the slicing-by-8 tables */
+uint32_t crc32c_sw (uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif
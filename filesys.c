@@ -3,8 +3,77 @@
 #include "system_call.h"
 #include "x86_desc.h"
 #include "terminal.h"
-int inode_array[64];
-uint8_t data_blocks_bitmap[BLOCK_SIZE] = {0}; 
+#include "bcache.h"
+#include "lz.h"
+#include "crc32c.h"
+uint32_t inode_bitmap[INODE_BITMAP_WORDS];                                                          // 1 bit per inode, set means busy
+static uint32_t num_free_inodes = 0;                                                                // free inodes left in the bitmap
+uint32_t data_blocks_bitmap[BITMAP_WORDS];                                                          // 1 bit per data block, set means busy
+static uint32_t alloc_hint = 0;                                                                     // bitmap word where the next search starts (next fit)
+static uint32_t num_free_blocks = 0;                                                                // free data blocks left in the bitmap
+uint8_t block_refcount[MAX_DATA_BLOCKS];                                                            // extra inodes and mappings sharing each data block, 0 if it has one owner
+int16_t dentry_hash_head[DENTRY_HASH_SIZE];                                                         // first dentry index of each bucket
+int16_t dentry_hash_next[MAX_DIR_ENTRIES];                                                          // next dentry index in the same bucket
+static extent_map_t extent_cache[EXTENT_CACHE_SIZE];                                                // lazily built extent maps
+static uint16_t name_sorted[MAX_DIR_ENTRIES];                                                       // dentry indices sorted by name, for prefix search
+static uint32_t num_name_sorted = 0;                                                                // entries in name_sorted
+static uint32_t mkfs_flags = 0;                                                                     // precomputed data of a tools/mkfs image, only valid during filesys_init
+uint32_t inode_exec_bitmap[INODE_BITMAP_WORDS];                                                     // 1 bit per inode, set if the file starts with the ELF magic
+static uint8_t zero_block[BLOCK_SIZE] __attribute__((aligned (BLOCK_SIZE)));                        // what mmap maps for a hole
+cluster_stats_t cluster_stats;                                                                      // exported hit/miss/unpack counters
+static cluster_buf_t cluster_cache[CLUSTER_CACHE_SIZE];                                             // headers of the decompressed clusters
+static uint8_t cluster_data[CLUSTER_CACHE_SIZE][CLUSTER_SIZE];                                      // the decompressed clusters
+static uint8_t packed_buf[CLUSTER_SIZE];                                                            // compressed stream of the cluster being decompressed
+static uint32_t cluster_clock = 0;                                                                  // LRU stamp of the last cluster used
+dedup_stats_t dedup_stats;                                                                          // exported deduplication counters
+static int16_t dedup_head[DEDUP_HASH_SIZE];                                                         // first data block of each bucket
+static int16_t dedup_next[MAX_DATA_BLOCKS];                                                         // next data block in the same bucket
+static uint32_t dedup_hash[MAX_DATA_BLOCKS];                                                        // fingerprint of each indexed data block
+static uint32_t dedup_indexed[BITMAP_WORDS];                                                        // 1 bit per data block, set if it is in the table
+crc_stats_t crc_stats;                                                                              // exported checksum and scrub counters
+uint32_t crc_verify_reads = 1;                                                                      // 1 to check the blocks read_data copies against their checksum
+static uint32_t block_crc[MAX_DATA_BLOCKS];                                                         // CRC32C of each data block with a checksum
+static uint32_t crc_valid[BITMAP_WORDS];                                                            // 1 bit per data block, set if block_crc matches its last write
+static uint32_t crc_verified[BITMAP_WORDS];                                                         // 1 bit per data block, set once checked, until the scrub checks it again
+static uint32_t crc_bad[BITMAP_WORDS];                                                              // 1 bit per data block, set if it failed its checksum
+static uint8_t crc_buf[BLOCK_SIZE];                                                                 // block being checksummed, used with interrupts off
+static uint32_t scrub_next = 0;                                                                     // next data block the scrub checks
+static uint32_t block_count[MAX_INODES];                                                            // inode_data_blocks of each inode, once counted
+static uint32_t block_count_valid[INODE_BITMAP_WORDS];                                              // 1 bit per inode, set if block_count matches its block list
+dcache_stats_t dcache_stats;                                                                        // exported dentry cache counters
+static dcache_entry_t dcache[DCACHE_SIZE];                                                          // (directory inode, name) -> dentry, direct mapped
+
+static int32_t write_dentry (uint32_t index, const dentry_t* dentry);
+static int32_t dentry_location (uint32_t index, uint32_t* block, uint32_t* offset);
+static void write_boot_header (void);
+static void update_exec_bit (uint32_t inode);
+static uint32_t inode_block_get (uint32_t inode, uint32_t file_block, uint32_t* span);
+static int32_t inode_block_set (uint32_t inode, uint32_t file_block, uint32_t block);
+static void inode_blocks_free (uint32_t inode, uint32_t keep);
+static void inode_blocks_mark (uint32_t inode);
+static int32_t cluster_packed (uint32_t inode, uint32_t cluster);
+static int32_t cluster_unpack (uint32_t inode, uint32_t cluster);
+static void dedup_forget (uint32_t block);
+static void dedup_block (uint32_t inode, uint32_t file_block);
+static int32_t inline_unpack (uint32_t inode);
+static void inline_pack (uint32_t inode);
+static int32_t data_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length);
+static void crc_update (uint32_t block, const uint8_t* data);
+static int32_t block_verify (uint32_t block, const uint8_t* data);
+static int32_t run_verify (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length);
+static int32_t dir_lookup (uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry);
+static void subdir_walk (uint32_t dir, uint32_t depth);
+
+/* device block of data block D: the boot block and the inodes come first */
+#define DATA_DEV_BLOCK(D)   (1 + boot_block_ptr->num_inodes + (D))
+/* number of blocks holding L bytes, without overflowing near MAX_FILE_SIZE */
+#define FILE_BLOCKS(L)      ((L) / BLOCK_SIZE + ((L) % BLOCK_SIZE != 0))
+/* D is a data block number, not a hole, a block of a compressed cluster or an inline tail */
+#define BLOCK_STORED(D)     ((D) < BLOCK_INLINE)
+/* where the inline bytes of file block FB start in an inode */
+#define INLINE_DATA(I, FB)  ((uint8_t*)&inode_ptr[I].data_blocks[(FB) + 1])
+/* the dentry has an inode of its own: a regular file, or a directory other than the root */
+#define DENTRY_HAS_INODE(D) ((D).file_type == 2 || ((D).file_type == 1 && (D).inode != DIR_INODE))
 /**
  * filesys_init
  *  DESCRIPTION : initialize pointers relevant to the filesystem
@@ -12,270 +81,2453 @@ uint8_t data_blocks_bitmap[BLOCK_SIZE] = {0};
  *  OUTPUTS : none
  *  RETURN VALUE : none
  *  SIDE EFFECTS : none
- * 
+ * 
+ */
+void filesys_init (uint32_t filesys_addr)
+{
+    int i,j;
+    boot_block_ptr = (boot_block_t*)filesys_addr;                                                   // cast filesys_addr to boot_block_t
+    inode_ptr = (inode_t*) (boot_block_ptr + 1);                                                    // Pointing to the first inode block, 1 means the next block of boot block
+    dentry_ptr = (dentry_t*) boot_block_ptr->dir_entries;                                           // Pointing to the first dentry
+    data_block_ptr = (uint8_t*) (inode_ptr + boot_block_ptr->num_inodes);                           // Pointing to the first data block
+    bcache_init(ramdisk_init(filesys_addr, DATA_DEV_BLOCK(boot_block_ptr->num_data_blocks)));      // directory and data reads go through the block cache
+    mkfs_flags = (boot_block_ptr->mkfs_magic == MKFS_MAGIC) ? boot_block_ptr->mkfs_flags : 0;
+    /* the dentries past the boot block live in the blocks of DIR_INODE */
+    uint32_t dir_blocks = inode_ptr[DIR_INODE].length / BLOCK_SIZE;
+    if (dir_blocks > MAX_DIR_BLOCKS) {
+        printf("oops! too many directory blocks!");
+        dir_blocks = MAX_DIR_BLOCKS;
+        inode_ptr[DIR_INODE].length = dir_blocks * BLOCK_SIZE;
+    }
+    if (boot_block_ptr->num_dir_entries > MAX_FILES_NUMBER + dir_blocks * DENTRIES_PER_BLOCK) {
+        printf("oops! the directory is larger than its blocks!");
+        boot_block_ptr->num_dir_entries = MAX_FILES_NUMBER + dir_blocks * DENTRIES_PER_BLOCK;
+    }
+    /* initialize the inode bitmap: inode 0 stands for the directory, the others are busy if a file uses them */
+    uint32_t num_inodes = boot_block_ptr->num_inodes;
+    if (num_inodes > MAX_INODES) {
+        printf("oops! inode bitmap is not big enough!");
+        num_inodes = MAX_INODES;
+    }
+    for (i = 0; i < INODE_BITMAP_WORDS; i++) inode_bitmap[i] = 0;
+    for (i = num_inodes; i < MAX_INODES; i++) inode_bitmap[i / 32] |= 1U << (i % 32);               // inodes past the image are never handed out
+    inode_bitmap[0] |= 1U;
+    num_free_inodes = num_inodes - 1;
+    for (i = 0; i < INODE_BITMAP_WORDS; i++) inode_exec_bitmap[i] = block_count_valid[i] = 0;
+    dcache_flush();
+    memset(&dcache_stats, 0, sizeof(dcache_stats));
+    dentry_t temp_dentry;
+    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++)
+    {
+        read_dentry_by_index(i, &temp_dentry);
+        uint32_t inode = temp_dentry.inode;
+        if (!DENTRY_HAS_INODE(temp_dentry) || inode >= num_inodes) continue;
+        if (inode_bitmap[inode / 32] & (1U << (inode % 32))) continue;
+        inode_bitmap[inode / 32] |= 1U << (inode % 32);                                             // Set it to be busy status
+        num_free_inodes--;
+        if (temp_dentry.file_type == 1) subdir_walk(inode, 1);                                      // the files under a subdirectory are busy too
+    }
+    /* init the all_file_names array */
+    memset(all_file_names, '\0', sizeof(all_file_names));
+    /* assgin the file name into array. */
+    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++){
+        read_dentry_by_index(i,&temp_dentry);
+        strncpy((char*)(all_file_names[i]),(char*)(temp_dentry.file_name), MAX_FILENAME_LEN);
+    }
+    /* entries past the end of a file are holes, older images left them as they were */
+    for (i = 0; i < num_inodes; i++){
+        if (!(inode_bitmap[i / 32] & (1U << (i % 32)))) continue;
+        inode_t* cur_inode = inode_ptr + i;
+        uint32_t nblocks = FILE_BLOCKS(cur_inode->length);
+        if (nblocks > 0 && nblocks <= NUM_DIRECT_BLOCKS && cur_inode->data_blocks[nblocks - 1] == BLOCK_INLINE) continue;    // the entries hold the tail
+        for (j = nblocks; j < NUM_DIRECT_BLOCKS; j++) cur_inode->data_blocks[j] = BLOCK_HOLE;
+        if (nblocks <= NUM_DIRECT_BLOCKS) cur_inode->single_indirect = BLOCK_HOLE;
+        if (nblocks <= NUM_DIRECT_BLOCKS + PTRS_PER_BLOCK) cur_inode->double_indirect = BLOCK_HOLE;
+    }
+    /* build the name -> dentry hash index and the sorted name index */
+    dentry_index_build();
+    name_index_build();
+    /*initialize the data blocks bitmap */
+    uint32_t num_blocks = boot_block_ptr->num_data_blocks;
+    if (num_blocks > MAX_DATA_BLOCKS) {
+        printf("oops! bitmap is not big enough!");
+        num_blocks = MAX_DATA_BLOCKS;
+    }
+    for (i = 0; i < BITMAP_WORDS; i++) data_blocks_bitmap[i] = 0;
+    memset(block_refcount, 0, sizeof(block_refcount));
+    for (i = num_blocks; i < MAX_DATA_BLOCKS; i++){
+        data_blocks_bitmap[i / 32] |= 1U << (i % 32);                                               // blocks past the image are never handed out
+    }
+    num_free_blocks = num_blocks;
+    if ((mkfs_flags & MKFS_BITMAP) && num_blocks <= MKFS_BITMAP_WORDS * 32) {
+        /* mkfs stored the bitmap, no need to walk the inodes */
+        for (i = 0; i < num_blocks; i++) {
+            if (!(boot_block_ptr->free_bitmap[i / 32] & (1U << (i % 32)))) continue;
+            data_blocks_bitmap[i / 32] |= 1U << (i % 32);
+            num_free_blocks--;
+        }
+    }
+    else for (i = 0; i < num_inodes; i++ ){
+        if (inode_bitmap[i / 32] & (1U << (i % 32))) inode_blocks_mark(i);                          // data and indirect blocks of the files in use, counting shared blocks
+    }
+    alloc_hint = 0;
+    crc32c_init();
+    memset(&crc_stats, 0, sizeof(crc_stats));
+    for (i = 0; i < BITMAP_WORDS; i++) crc_valid[i] = crc_verified[i] = crc_bad[i] = 0;
+    /* collapse identical data blocks, the directory blocks are written in place and stay out */
+    for (i = 0; i < DEDUP_HASH_SIZE; i++) dedup_head[i] = DEDUP_NONE;
+    for (i = 0; i < BITMAP_WORDS; i++) dedup_indexed[i] = 0;
+    for (i = 1; i < num_inodes; i++){
+        if (!(inode_bitmap[i / 32] & (1U << (i % 32)))) continue;
+        uint32_t nblocks = FILE_BLOCKS(inode_ptr[i].length);
+        uint32_t span;
+        for (j = 0; j < nblocks; j += span) {
+            if (inode_block_get(i, j, &span) != BLOCK_HOLE) dedup_block(i, j);              // skip a missing indirect block at once
+        }
+    }
+    /* checksum the data blocks in use, a later change of one without a write is corruption */
+    for (i = 0; i < num_blocks; i++) {
+        if (data_blocks_bitmap[i / 32] & (1U << (i % 32))) crc_update(i, NULL);
+    }
+    scrub_next = 0;
+    /* cache which files are executables, subdir_walk did the ones in subdirectories */
+    for (i = 0; i < boot_block_ptr->num_dir_entries; i++){
+        read_dentry_by_index(i, &temp_dentry);
+        if (temp_dentry.file_type == 2) update_exec_bit(temp_dentry.inode);
+    }
+    /* the image changes from now on, the precomputed data would go stale */
+    if (mkfs_flags) {
+        mkfs_flags = 0;
+        boot_block_ptr->mkfs_flags = 0;
+        write_boot_header();
+    }
+}
+
+/**
+ * read_dentry_by_name
+ *  DESCRIPTION : read the corresponding file dentry to the given
+ *                dentry based on the given filename, a path of names
+ *                separated by '/' starting from the root directory
+ *  INPUTS : const uint8_t* fname - given filename
+ *           dentry_t* dentry - given dentry
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully load the dentry
+ *                 -1 - cannot find the corresponding file
+ *  SIDE EFFECTS : fill the dentry cache
+ * 
+ */
+int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
+{
+    if (fname == NULL) return -1;                                                                   // If the filename is NULL, return -1
+    return path_lookup(fname, strlen((int8_t*)fname), dentry);                                      // one cached lookup per name of the path
+}
+
+/**
+ * dentry_name_len
+ *  DESCRIPTION : length of a dentry file name, which is not NUL terminated
+ *                when it takes all MAX_FILENAME_LEN bytes
+ *  INPUTS : const uint8_t* name - the file name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the length of the name, at most MAX_FILENAME_LEN
+ *  SIDE EFFECTS : none
+ */
+static uint32_t dentry_name_len (const uint8_t* name)
+{
+    uint32_t len = 0;
+    while (len < MAX_FILENAME_LEN && name[len] != '\0') len++;
+    return len;
+}
+
+/**
+ * dentry_name_fnv
+ *  DESCRIPTION : FNV-1a hash of a file name, the name_hash of a dentry
+ *  INPUTS : const uint8_t* name - the file name
+ *           uint32_t len - the length of the name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the 32 bit hash
+ *  SIDE EFFECTS : none
+ */
+static uint32_t dentry_name_fnv (const uint8_t* name, uint32_t len)
+{
+    uint32_t hash = 2166136261U;                                                                    // FNV offset basis
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= name[i];
+        hash *= 16777619U;                                                                          // FNV prime
+    }
+    return hash;
+}
+
+/**
+ * dentry_name_hash
+ *  DESCRIPTION : FNV-1a hash of a file name, folded to a hash bucket
+ *  INPUTS : const uint8_t* name - the file name
+ *           uint32_t len - the length of the name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the bucket index in [0, DENTRY_HASH_SIZE)
+ *  SIDE EFFECTS : none
+ */
+static uint32_t dentry_name_hash (const uint8_t* name, uint32_t len)
+{
+    return dentry_name_fnv(name, len) & (DENTRY_HASH_SIZE - 1);
+}
+
+/**
+ * dentry_index_build
+ *  DESCRIPTION : (re)build the name -> dentry hash index over all the
+ *                dentries of the directory, using their names in all_file_names,
+ *                or the hashes stored by mkfs while filesys_init runs
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : overwrite dentry_hash_head and dentry_hash_next
+ */
+void dentry_index_build (void)
+{
+    uint32_t i, bucket;
+    dentry_t dentry;
+    for (i = 0; i < DENTRY_HASH_SIZE; i++) dentry_hash_head[i] = DENTRY_NONE;
+    for (i = 0; i < boot_block_ptr->num_dir_entries; i++) {
+        if (!(mkfs_flags & MKFS_HASHES)) {
+            dentry_index_insert(i);
+            continue;
+        }
+        read_dentry_by_index(i, &dentry);
+        bucket = dentry.name_hash & (DENTRY_HASH_SIZE - 1);                                         // hashed by mkfs
+        dentry_hash_next[i] = dentry_hash_head[bucket];
+        dentry_hash_head[bucket] = i;
+    }
+}
+
+/**
+ * dentry_index_insert
+ *  DESCRIPTION : link the dentry at the given index into its hash bucket
+ *  INPUTS : uint32_t index - the index of the dentry in the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the hash index
+ */
+void dentry_index_insert (uint32_t index)
+{
+    const uint8_t* name = (uint8_t*)all_file_names[index];
+    uint32_t bucket = dentry_name_hash(name, dentry_name_len(name));
+    dentry_hash_next[index] = dentry_hash_head[bucket];                                             // push to the front of the chain
+    dentry_hash_head[bucket] = index;
+}
+
+/**
+ * dentry_index_remove
+ *  DESCRIPTION : unlink the dentry at the given index from its hash bucket
+ *  INPUTS : uint32_t index - the index of the dentry in the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the hash index
+ */
+void dentry_index_remove (uint32_t index)
+{
+    const uint8_t* name = (uint8_t*)all_file_names[index];
+    int16_t* link = &dentry_hash_head[dentry_name_hash(name, dentry_name_len(name))];
+    while (*link != DENTRY_NONE) {
+        if (*link == index) {
+            *link = dentry_hash_next[index];
+            return;
+        }
+        link = &dentry_hash_next[*link];
+    }
+}
+
+/**
+ * dentry_index_lookup
+ *  DESCRIPTION : find the dentry with the given name through the hash index
+ *  INPUTS : const uint8_t* fname - given filename
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the dentry in the directory
+ *                 DENTRY_NONE - cannot find the corresponding file
+ *  SIDE EFFECTS : none
+ */
+int32_t dentry_index_lookup (const uint8_t* fname)
+{
+    if (fname == NULL) return DENTRY_NONE;                                                          // If the filename is NULL, return DENTRY_NONE
+
+    uint32_t name_len = strlen((int8_t*)fname);
+    if (name_len > MAX_FILENAME_LEN || name_len == 0) return DENTRY_NONE;                           // If the filename length is out of range, return DENTRY_NONE
+
+    int32_t i = dentry_hash_head[dentry_name_hash(fname, name_len)];
+    for (; i != DENTRY_NONE; i = dentry_hash_next[i]) {                                             // Only compare the names in the same bucket
+        const uint8_t* cur_name = (uint8_t*)all_file_names[i];                                      // in-memory copy of the dentry names
+        if ((name_len == dentry_name_len(cur_name)) && (!strncmp((int8_t*)fname, (int8_t*)cur_name, name_len))) {
+            return i;
+        }
+    }
+    return DENTRY_NONE;
+}
+
+/**
+ * name_index_compare
+ *  DESCRIPTION : compare the first len bytes of a dentry name with a name
+ *  INPUTS : uint32_t index - the index of the dentry
+ *           const uint8_t* name - the name or prefix to compare with
+ *           uint32_t len - the number of bytes to compare
+ *  OUTPUTS : none
+ *  RETURN VALUE : <0, 0 or >0 like strncmp
+ *  SIDE EFFECTS : none
+ */
+static int32_t name_index_compare (uint32_t index, const uint8_t* name, uint32_t len)
+{
+    return strncmp((int8_t*)all_file_names[index], (int8_t*)name, len);
+}
+
+/**
+ * name_index_bound
+ *  DESCRIPTION : binary search the sorted name index
+ *  INPUTS : const uint8_t* name - the name or prefix to search
+ *           uint32_t len - the number of bytes to compare
+ *           int32_t upper - 0 for the first name >= name, 1 for the first name > name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the position in name_sorted
+ *  SIDE EFFECTS : none
+ */
+static uint32_t name_index_bound (const uint8_t* name, uint32_t len, int32_t upper)
+{
+    uint32_t lo = 0, hi = num_name_sorted;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int32_t cmp = name_index_compare(name_sorted[mid], name, len);
+        if (cmp < 0 || (upper && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * name_index_build
+ *  DESCRIPTION : (re)build the index of the dentries sorted by name, which
+ *                is the dentry order itself in an image sorted by mkfs
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : overwrite name_sorted
+ */
+void name_index_build (void)
+{
+    uint32_t i;
+    num_name_sorted = 0;
+    if (mkfs_flags & MKFS_SORTED) {
+        for (i = 0; i < boot_block_ptr->num_dir_entries; i++) name_sorted[num_name_sorted++] = i;    // mkfs sorted the dentries
+        return;
+    }
+    for (i = 0; i < boot_block_ptr->num_dir_entries; i++) name_index_insert(i);
+}
+
+/**
+ * name_index_insert
+ *  DESCRIPTION : add the dentry at the given index to the sorted name index
+ *  INPUTS : uint32_t index - the index of the dentry in the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : shift the larger names up by one
+ */
+void name_index_insert (uint32_t index)
+{
+    if (num_name_sorted >= MAX_DIR_ENTRIES) return;
+    uint32_t pos = name_index_bound((uint8_t*)all_file_names[index], MAX_FILENAME_LEN, 0);
+    uint32_t i;
+    for (i = num_name_sorted; i > pos; i--) name_sorted[i] = name_sorted[i - 1];
+    name_sorted[pos] = index;
+    num_name_sorted++;
+}
+
+/**
+ * name_index_remove
+ *  DESCRIPTION : drop the dentry at the given index from the sorted name
+ *                index. If moved_from is a valid index, the dentry that used
+ *                to live there has been moved to index and is renumbered.
+ *  INPUTS : uint32_t index - the index of the removed dentry
+ *           uint32_t moved_from - the old index of the dentry moved into index, or index itself
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : shift the larger names down by one
+ */
+void name_index_remove (uint32_t index, uint32_t moved_from)
+{
+    uint32_t pos = name_index_bound((uint8_t*)all_file_names[index], MAX_FILENAME_LEN, 0);
+    uint32_t i;
+    if (pos >= num_name_sorted || name_sorted[pos] != index) return;
+    for (i = pos; i + 1 < num_name_sorted; i++) name_sorted[i] = name_sorted[i + 1];
+    num_name_sorted--;
+    if (moved_from == index) return;
+    pos = name_index_bound((uint8_t*)all_file_names[moved_from], MAX_FILENAME_LEN, 0);
+    if (pos < num_name_sorted && name_sorted[pos] == moved_from) name_sorted[pos] = index;
+}
+
+/**
+ * name_index_prefix
+ *  DESCRIPTION : count the names starting with a prefix with two binary
+ *                searches, so the cost depends on the prefix length and
+ *                not on the number of files
+ *  INPUTS : const uint8_t* prefix - the prefix
+ *           uint32_t len - the length of the prefix
+ *           uint32_t* index - where to store the dentry index of the first match
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of names starting with prefix
+ *  SIDE EFFECTS : none
+ */
+uint32_t name_index_prefix (const uint8_t* prefix, uint32_t len, uint32_t* index)
+{
+    uint32_t lo = name_index_bound(prefix, len, 0);
+    uint32_t hi = name_index_bound(prefix, len, 1);
+    if (lo < hi) *index = name_sorted[lo];
+    return hi - lo;
+}
+
+/**
+ * dcache_find
+ *  DESCRIPTION : find the cached lookup of a name in a directory
+ *  INPUTS : uint32_t parent - the inode of the directory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the slot of the lookup, NULL if it is not cached
+ *  SIDE EFFECTS : none
+ */
+static dcache_entry_t* dcache_find (uint32_t parent, const uint8_t* name, uint32_t len)
+{
+    dcache_entry_t* slot = &dcache[(dentry_name_fnv(name, len) ^ (parent * 2654435761U)) & (DCACHE_SIZE - 1)];
+    if (!slot->valid || slot->parent != parent) return NULL;
+    if (dentry_name_len(slot->dentry.file_name) != len || strncmp((int8_t*)slot->dentry.file_name, (int8_t*)name, len)) return NULL;
+    return slot;
+}
+
+/**
+ * dcache_fill
+ *  DESCRIPTION : remember the result of a lookup, taking over the slot of
+ *                whatever name hashed there before
+ *  INPUTS : uint32_t parent - the inode of the directory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *           const dentry_t* dentry - the dentry found, NULL if the name does not exist
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the dentry cache
+ */
+static void dcache_fill (uint32_t parent, const uint8_t* name, uint32_t len, const dentry_t* dentry)
+{
+    dcache_entry_t* slot = &dcache[(dentry_name_fnv(name, len) ^ (parent * 2654435761U)) & (DCACHE_SIZE - 1)];
+    if (slot->valid) dcache_stats.evictions++;
+    slot->parent = parent;
+    slot->valid = 1;
+    slot->negative = (dentry == NULL);
+    if (dentry != NULL) {
+        memcpy(&slot->dentry, dentry, sizeof(dentry_t));
+        return;
+    }
+    memset(&slot->dentry, 0, sizeof(dentry_t));
+    memcpy(slot->dentry.file_name, name, len);                                              // the key of a negative slot
+}
+
+/**
+ * dcache_drop
+ *  DESCRIPTION : forget the cached lookup of a name, after it is created or removed
+ *  INPUTS : uint32_t parent - the inode of the directory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the dentry cache
+ */
+static void dcache_drop (uint32_t parent, const uint8_t* name, uint32_t len)
+{
+    dcache_entry_t* slot = dcache_find(parent, name, len);
+    if (slot != NULL) slot->valid = 0;
+}
+
+/**
+ * dcache_purge
+ *  DESCRIPTION : forget every cached lookup in a directory, after it is
+ *                removed and its inode may come back as another directory
+ *  INPUTS : uint32_t parent - the inode of the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the dentry cache
+ */
+static void dcache_purge (uint32_t parent)
+{
+    uint32_t i;
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        if (dcache[i].parent == parent) dcache[i].valid = 0;
+    }
+}
+
+/**
+ * dcache_flush
+ *  DESCRIPTION : forget every cached lookup
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : empty the dentry cache, the counters are kept
+ */
+void dcache_flush (void)
+{
+    uint32_t i;
+    for (i = 0; i < DCACHE_SIZE; i++) dcache[i].valid = 0;
+}
+
+/**
+ * dcache_hit_rate
+ *  DESCRIPTION : share of the lookups the dentry cache served, negative
+ *                hits included
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : the hit rate in percent, 0 before the first lookup
+ *  SIDE EFFECTS : none
+ */
+uint32_t dcache_hit_rate (void)
+{
+    uint32_t hits = dcache_stats.hits + dcache_stats.negative_hits;
+    uint32_t total = hits + dcache_stats.misses;
+    while (total > 0xFFFFFFFFU / 100) {                                                      // keep hits * 100 in 32 bits
+        hits >>= 1;
+        total >>= 1;
+    }
+    return (total == 0) ? 0 : hits * 100 / total;
+}
+
+/**
+ * dir_entries
+ *  DESCRIPTION : number of dentries in a directory. The root lists its
+ *                dentries in the boot block and the blocks of DIR_INODE,
+ *                a subdirectory is a file of dense dentries.
+ *  INPUTS : uint32_t dir - the inode of the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of dentries, 0 for an invalid inode
+ *  SIDE EFFECTS : none
+ */
+uint32_t dir_entries (uint32_t dir)
+{
+    if (dir == DIR_INODE) return boot_block_ptr->num_dir_entries;
+    if (dir >= boot_block_ptr->num_inodes) return 0;
+    return inode_ptr[dir].length / sizeof(dentry_t);
+}
+
+/**
+ * dir_entry_read
+ *  DESCRIPTION : read the dentry at the given index of a directory
+ *  INPUTS : uint32_t dir - the inode of the directory
+ *           uint32_t index - the index of the dentry
+ *           dentry_t* dentry - where to copy the dentry
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully load the dentry
+ *                 -1 - the index is past the last dentry or the read failed
+ *  SIDE EFFECTS : none
+ */
+int32_t dir_entry_read (uint32_t dir, uint32_t index, dentry_t* dentry)
+{
+    if (dir == DIR_INODE) return read_dentry_by_index(index, dentry);
+    if (index >= dir_entries(dir)) return -1;
+    if (read_data(dir, index * sizeof(dentry_t), (uint8_t*)dentry, sizeof(dentry_t)) != sizeof(dentry_t)) return -1;
+    return 0;
+}
+
+/**
+ * subdir_find
+ *  DESCRIPTION : search a subdirectory for a name, DIR_SCAN_CHUNK dentries
+ *                per read. The name hash every subdirectory dentry carries
+ *                skips most name compares.
+ *  INPUTS : uint32_t dir - the inode of the subdirectory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *           dentry_t* dentry - where to copy the dentry found
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the dentry in the subdirectory
+ *                 DENTRY_NONE - no such name
+ *  SIDE EFFECTS : none
+ */
+static int32_t subdir_find (uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry)
+{
+    dentry_t chunk[DIR_SCAN_CHUNK];
+    uint32_t hash = dentry_name_fnv(name, len);
+    uint32_t num = dir_entries(dir);
+    uint32_t i, j, count;
+    for (i = 0; i < num; i += count) {
+        count = num - i;
+        if (count > DIR_SCAN_CHUNK) count = DIR_SCAN_CHUNK;
+        if (read_data(dir, i * sizeof(dentry_t), (uint8_t*)chunk, count * sizeof(dentry_t)) != count * sizeof(dentry_t)) return DENTRY_NONE;
+        for (j = 0; j < count; j++) {
+            if (chunk[j].name_hash != hash || dentry_name_len(chunk[j].file_name) != len) continue;
+            if (strncmp((int8_t*)chunk[j].file_name, (int8_t*)name, len)) continue;
+            memcpy(dentry, &chunk[j], sizeof(dentry_t));
+            return i + j;
+        }
+    }
+    return DENTRY_NONE;
+}
+
+/**
+ * dir_lookup
+ *  DESCRIPTION : find a name in one directory, through the dentry cache.
+ *                A miss searches the hash index of the root or scans the
+ *                subdirectory, and caches the answer, a missing name too.
+ *                "." in a subdirectory is the subdirectory itself.
+ *  INPUTS : uint32_t dir - the inode of the directory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *           dentry_t* dentry - where to copy the dentry found
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully load the dentry
+ *                 -1 - no such name
+ *  SIDE EFFECTS : update the dentry cache and its counters
+ */
+static int32_t dir_lookup (uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry)
+{
+    uint8_t fname[MAX_FILENAME_LEN + 1];                                                      // leave 1 place for "\0"
+    dcache_entry_t* slot;
+    int32_t index;
+    if (len == 0 || len > MAX_FILENAME_LEN) return -1;
+    if (dir != DIR_INODE && len == 1 && name[0] == '.') {
+        /* subdirectories store no "." dentry */
+        memset(dentry, 0, sizeof(dentry_t));
+        dentry->file_name[0] = '.';
+        dentry->file_type = 1;
+        dentry->inode = dir;
+        return 0;
+    }
+    slot = dcache_find(dir, name, len);
+    if (slot != NULL) {
+        if (slot->negative) {
+            dcache_stats.negative_hits++;
+            return -1;
+        }
+        dcache_stats.hits++;
+        memcpy(dentry, &slot->dentry, sizeof(dentry_t));
+        return 0;
+    }
+    dcache_stats.misses++;
+    if (dir == DIR_INODE) {
+        memcpy(fname, name, len);
+        fname[len] = '\0';
+        index = dentry_index_lookup(fname);
+        if (index != DENTRY_NONE && read_dentry_by_index(index, dentry) == -1) index = DENTRY_NONE;
+    }
+    else index = subdir_find(dir, name, len, dentry);
+    dcache_fill(dir, name, len, (index == DENTRY_NONE) ? NULL : dentry);
+    return (index == DENTRY_NONE) ? -1 : 0;
+}
+
+/**
+ * path_lookup
+ *  DESCRIPTION : walk a path from the root directory, one dir_lookup per
+ *                name. Repeated '/' are skipped, "/" alone is the root.
+ *  INPUTS : const uint8_t* path - the path, names separated by '/'
+ *           uint32_t len - the number of bytes of path to walk
+ *           dentry_t* dentry - where to copy the dentry of the last name
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully load the dentry
+ *                 -1 - a name is missing, or a name before the last is not a directory
+ *  SIDE EFFECTS : update the dentry cache
+ */
+int32_t path_lookup (const uint8_t* path, uint32_t len, dentry_t* dentry)
+{
+    uint32_t dir = DIR_INODE;
+    uint32_t start, end = 0;
+    int32_t found = 0;
+    if (path == NULL || len == 0) return -1;
+    while (1) {
+        for (start = end; start < len && path[start] == '/'; start++);                      // skip the separators
+        if (start >= len) break;
+        for (end = start; end < len && path[end] != '/'; end++);
+        if (found) {
+            if (dentry->file_type != 1) return -1;                                           // only a directory has names under it
+            dir = dentry->inode;
+        }
+        if (dir_lookup(dir, path + start, end - start, dentry) == -1) return -1;
+        found = 1;
+    }
+    if (!found) return dir_lookup(DIR_INODE, (const uint8_t*)".", 1, dentry);                // the root itself
+    return 0;
+}
+
+/**
+ * path_parent
+ *  DESCRIPTION : split a path into the directory holding its last name and
+ *                the last name
+ *  INPUTS : const uint8_t* path - the path, NUL terminated
+ *           uint32_t* dir - where to store the inode of the directory
+ *           const uint8_t** leaf - where to store the start of the last name
+ *           uint32_t* leaf_len - where to store the length of the last name
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - the directory part does not name a directory
+ *  SIDE EFFECTS : update the dentry cache
+ */
+static int32_t path_parent (const uint8_t* path, uint32_t* dir, const uint8_t** leaf, uint32_t* leaf_len)
+{
+    dentry_t dentry;
+    uint32_t start, end;
+    if (path == NULL) return -1;
+    end = strlen((int8_t*)path);
+    while (end > 0 && path[end - 1] == '/') end--;                                           // "dir/" names dir
+    for (start = end; start > 0 && path[start - 1] != '/'; start--);
+    *leaf = path + start;
+    *leaf_len = end - start;
+    *dir = DIR_INODE;
+    if (start == 0) return 0;                                                                // a name in the root
+    if (path_lookup(path, start, &dentry) == -1 || dentry.file_type != 1) return -1;
+    *dir = dentry.inode;
+    return 0;
+}
+
+/**
+ * subdir_walk
+ *  DESCRIPTION : mark busy the inodes of the files and directories under a
+ *                subdirectory and cache which files are executables, for
+ *                filesys_init. An inode met before is not walked again and
+ *                the walk stops MAX_DIR_DEPTH levels down, so a broken image
+ *                cannot make it loop.
+ *  INPUTS : uint32_t dir - the inode of the subdirectory
+ *           uint32_t depth - the number of directories above it
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the inode bitmap and the exec bitmap
+ */
+static void subdir_walk (uint32_t dir, uint32_t depth)
+{
+    dentry_t dentry;
+    uint32_t i, inode;
+    uint32_t num = dir_entries(dir);
+    if (depth >= MAX_DIR_DEPTH) return;
+    for (i = 0; i < num; i++) {
+        if (dir_entry_read(dir, i, &dentry) == -1) return;
+        inode = dentry.inode;
+        if (!DENTRY_HAS_INODE(dentry) || inode >= boot_block_ptr->num_inodes || inode >= MAX_INODES) continue;
+        if (inode_bitmap[inode / 32] & (1U << (inode % 32))) continue;
+        inode_bitmap[inode / 32] |= 1U << (inode % 32);
+        num_free_inodes--;
+        if (dentry.file_type == 1) subdir_walk(inode, depth + 1);
+        else update_exec_bit(inode);
+    }
+}
+
+/**
+ * delete_dentry
+ *  DESCRIPTION : remove the dentry at the given index from the directory.
+ *                The last dentry is moved into the hole so that the
+ *                directory stays dense and only one index entry moves.
+ *  INPUTS : uint32_t index - the index of the dentry in the directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully remove the dentry
+ *                 -1 - invalid index
+ *  SIDE EFFECTS : modify the directory, the hash index and all_file_names,
+ *                 free the data blocks and the inode of a file or a
+ *                 subdirectory, and the last directory block once it is empty
+ */
+int32_t delete_dentry (uint32_t index)
+{
+    if (index >= boot_block_ptr->num_dir_entries) return -1;
+
+    uint32_t last = boot_block_ptr->num_dir_entries - 1;
+    dentry_t dentry;
+    read_dentry_by_index(index, &dentry);
+    if (DENTRY_HAS_INODE(dentry)) {
+        truncate_data(dentry.inode, 0);                                                      // reclaim the data blocks of a file or an empty directory
+        free_inode(dentry.inode);
+    }
+    dentry_index_remove(index);
+    name_index_remove(index, last);                                                          // the last dentry moves into index
+    if (index != last) {
+        dentry_index_remove(last);
+        read_dentry_by_index(last, &dentry);
+        write_dentry(index, &dentry);                                                        // fill the hole with the last dentry
+        memcpy(all_file_names[index], all_file_names[last], MAX_FILENAME_LEN);
+        dentry_index_insert(index);
+    }
+    memset(&dentry, 0, sizeof(dentry_t));
+    write_dentry(last, &dentry);
+    memset(all_file_names[last], '\0', MAX_FILENAME_LEN);
+    boot_block_ptr->num_dir_entries--;
+    write_boot_header();
+    if (last >= MAX_FILES_NUMBER && (last - MAX_FILES_NUMBER) % DENTRIES_PER_BLOCK == 0) {
+        /* the last directory block became empty */
+        inode_t* dir_inode = inode_ptr + DIR_INODE;
+        dir_inode->length -= BLOCK_SIZE;
+        free_block(dir_inode->data_blocks[dir_inode->length / BLOCK_SIZE]);
+        dir_inode->data_blocks[dir_inode->length / BLOCK_SIZE] = BLOCK_HOLE;
+        extent_map_invalidate(DIR_INODE);
+    }
+    return 0;
+}
+
+/**
+ * root_insert
+ *  DESCRIPTION : add a dentry to the root directory. The new dentry takes
+ *                the slot right after the last one, the directory being
+ *                dense. A new directory block is allocated when the last
+ *                one is full.
+ *  INPUTS : const dentry_t* dentry - the new dentry
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the new dentry
+ *                 -1 - no directory block left
+ *  SIDE EFFECTS : modify the directory, the hash index and all_file_names
+ */
+static int32_t root_insert (const dentry_t* dentry)
+{
+    uint32_t index = boot_block_ptr->num_dir_entries;
+    if (index >= MAX_FILES_NUMBER && (index - MAX_FILES_NUMBER) % DENTRIES_PER_BLOCK == 0) {
+        /* the boot block and the directory blocks are full, chain one more block */
+        inode_t* dir_inode = inode_ptr + DIR_INODE;
+        uint32_t run;
+        int32_t D = alloc_blocks(1, &run);
+        if (D == -1) return -1;
+        dir_inode->data_blocks[dir_inode->length / BLOCK_SIZE] = D;
+        dir_inode->length += BLOCK_SIZE;
+        extent_map_invalidate(DIR_INODE);
+    }
+    write_dentry(index, dentry);
+    memcpy(all_file_names[index], dentry->file_name, MAX_FILENAME_LEN);
+    dentry_index_insert(index);                                                              // make the new file visible to lookups
+    name_index_insert(index);
+    boot_block_ptr->num_dir_entries++;
+    write_boot_header();
+    return index;
+}
+
+/**
+ * subdir_remove
+ *  DESCRIPTION : remove a dentry from a subdirectory. The last dentry is
+ *                moved into the hole so that the subdirectory stays dense.
+ *                The inode is only freed once the subdirectory is updated.
+ *  INPUTS : uint32_t dir - the inode of the subdirectory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully remove the dentry
+ *                 -1 - no such name, or no block left to copy a shared block
+ *  SIDE EFFECTS : modify the subdirectory, free the data blocks and the
+ *                 inode of the file or subdirectory removed
+ */
+static int32_t subdir_remove (uint32_t dir, const uint8_t* name, uint32_t len)
+{
+    dentry_t dentry, last_dentry;
+    int32_t index = subdir_find(dir, name, len, &dentry);
+    uint32_t last = dir_entries(dir) - 1;
+    if (index == DENTRY_NONE) return -1;
+    if (index != last) {
+        if (dir_entry_read(dir, last, &last_dentry) == -1) return -1;
+        if (write_data(dir, index * sizeof(dentry_t), (uint8_t*)&last_dentry, sizeof(dentry_t)) != sizeof(dentry_t)) return -1;    // fill the hole with the last dentry
+    }
+    truncate_data(dir, last * sizeof(dentry_t));
+    if (DENTRY_HAS_INODE(dentry)) {
+        truncate_data(dentry.inode, 0);
+        free_inode(dentry.inode);
+    }
+    return 0;
+}
+
+/**
+ * dir_create
+ *  DESCRIPTION : create an empty regular file or directory in a directory.
+ *                The inode comes from the inode bitmap, the dentry is added
+ *                to the root by root_insert or appended to a subdirectory.
+ *  INPUTS : uint32_t dir - the inode of the directory
+ *           const uint8_t* name - the name, not NUL terminated
+ *           uint32_t len - the length of the name
+ *           uint32_t type - 2 for a regular file, 1 for a directory
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the new dentry in the directory
+ *                 -1 - invalid name, the name exists, or no dentry, block or inode left
+ *  SIDE EFFECTS : modify the directory, drop the name from the dentry cache
+ */
+static int32_t dir_create (uint32_t dir, const uint8_t* name, uint32_t len, uint32_t type)
+{
+    dentry_t dentry;
+    int32_t inode, index;
+    uint32_t i;
+    if (len == 0 || len > MAX_FILENAME_LEN || (len == 1 && name[0] == '.')) return -1;
+    for (i = 0; i < len; i++) {
+        if (name[i] == '/' || name[i] == '\0') return -1;                                    // a name is one path component
+    }
+    if (dir_lookup(dir, name, len, &dentry) == 0) return -1;                                 // names are unique
+    if (dir_entries(dir) >= MAX_DIR_ENTRIES) return -1;                                      // the directory is full
+
+    inode = alloc_inode();
+    if (inode == -1) return -1;
+    memset(inode_ptr + inode, 0xFF, sizeof(inode_t));                                       // every block is a hole
+    inode_ptr[inode].length = 0;
+    extent_map_invalidate(inode);
+
+    memset(&dentry, 0, sizeof(dentry_t));
+    memcpy(dentry.file_name, name, len);
+    dentry.file_type = type;
+    dentry.inode = inode;
+    dentry.name_hash = dentry_name_fnv(name, len);                                          // subdir_find compares it first
+    if (dir == DIR_INODE) index = root_insert(&dentry);
+    else {
+        index = dir_entries(dir);
+        if (write_data(dir, index * sizeof(dentry_t), (uint8_t*)&dentry, sizeof(dentry_t)) != sizeof(dentry_t)) index = -1;
+    }
+    if (index == -1) {
+        free_inode(inode);
+        return -1;
+    }
+    dcache_drop(dir, name, len);                                                             // it remembers the name as missing
+    update_exec_bit(inode);                                                                  // empty, not executable
+    return index;
+}
+
+/**
+ * create_file
+ *  DESCRIPTION : create an empty regular file
+ *  INPUTS : const uint8_t* fname - the path of the new file, NUL terminated
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the new dentry in its directory
+ *                 -1 - invalid name, the file exists, or no dentry, block or inode left
+ *  SIDE EFFECTS : see dir_create
+ */
+int32_t create_file (const uint8_t* fname)
+{
+    uint32_t dir, len;
+    const uint8_t* leaf;
+    if (path_parent(fname, &dir, &leaf, &len) == -1) return -1;
+    return dir_create(dir, leaf, len, 2);
+}
+
+/**
+ * make_dir
+ *  DESCRIPTION : create an empty directory
+ *  INPUTS : const uint8_t* dname - the path of the new directory, NUL terminated
+ *  OUTPUTS : none
+ *  RETURN VALUE : the index of the new dentry in its directory
+ *                 -1 - invalid name, the name exists, or no dentry, block or inode left
+ *  SIDE EFFECTS : see dir_create
+ */
+int32_t make_dir (const uint8_t* dname)
+{
+    uint32_t dir, len;
+    const uint8_t* leaf;
+    if (path_parent(dname, &dir, &leaf, &len) == -1) return -1;
+    return dir_create(dir, leaf, len, 1);
+}
+
+/**
+ * unlink_file
+ *  DESCRIPTION : remove a file or an empty directory from its directory
+ *                and free its inode and data blocks
+ *  INPUTS : const uint8_t* fname - the path of the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - no such file, "." or a directory that is not empty
+ *  SIDE EFFECTS : see delete_dentry and subdir_remove, drop the name from the dentry cache
+ */
+int32_t unlink_file (const uint8_t* fname)
+{
+    uint8_t name[MAX_FILENAME_LEN + 1];                                                      // leave 1 place for "\0"
+    uint32_t dir, len;
+    const uint8_t* leaf;
+    dentry_t dentry;
+    int32_t ret;
+    if (path_parent(fname, &dir, &leaf, &len) == -1) return -1;
+    if (dir_lookup(dir, leaf, len, &dentry) == -1) return -1;                                // Cannot find the corresponding file: return -1
+    if (dentry.file_type == 1 && (!DENTRY_HAS_INODE(dentry) || dentry.inode == dir || dir_entries(dentry.inode) != 0)) return -1;
+    if (dir == DIR_INODE) {
+        memcpy(name, leaf, len);
+        name[len] = '\0';
+        ret = delete_dentry(dentry_index_lookup(name));                                      // Find the dentry through the hash index
+    }
+    else ret = subdir_remove(dir, leaf, len);
+    if (ret == -1) return -1;
+    dcache_drop(dir, leaf, len);
+    if (dentry.file_type == 1) dcache_purge(dentry.inode);                                   // its missing names
+    return 0;
+}
+
+int32_t find_similar_file(char* line_buffer, char* buf){
+    uint32_t cmd_len = strlen(line_buffer);
+    int8_t   exe_file[MAX_FILENAME_LEN + 1] = {'\0'};                                               // leave 1 place for "\0"
+    int8_t   args[BUFFER_SIZE + 1] = {'\0'};                                                        // leave 1 place for "\0"
+    uint8_t i;
+    uint32_t exe_len = 0;
+    uint32_t args_len = 0;
+    uint32_t empty_len = 0;
+    for(i = 0; i <= cmd_len; i++){
+        if(line_buffer[i] == '\0' || line_buffer[i] == ' '){
+            exe_len = MAX_FILENAME_LEN;
+            if(exe_len > i) exe_len = i;
+            strncpy(exe_file, (int8_t*)line_buffer, exe_len);                                           // Store the exe_file given by the command
+            break;
+        }
+    }
+    for(; i < cmd_len; i++){
+        if (line_buffer[i] == ' '){
+           empty_len++; 
+        }
+        if(line_buffer[i] != '\0' && line_buffer[i] != ' '){
+            strncpy(args, (int8_t*)(line_buffer + i), cmd_len - i);                                     // Store the argument given by the command
+            args_len = cmd_len-i;
+            break;
+        }
+    }
+
+    /* autocomplete the exe_file: the sorted name index gives the matches, the exec bit tells executables */
+    uint32_t index;
+    uint32_t matches;
+    dentry_t exe_dentry;
+    exe_len = strlen(exe_file);
+    if (args_len != 0 || empty_len != 0) return -1;
+    matches = name_index_prefix((uint8_t*)exe_file, exe_len, &index);
+    if (matches > 1) return 1;                                                                  // more than one file matches
+    if (matches == 0) return -1;                                                                // no file matches
+    read_dentry_by_index(index, &exe_dentry);
+    if (exe_dentry.file_type != 2 || !is_executable(exe_dentry.inode)) return -1;
+    exe_len = dentry_name_len((uint8_t*)all_file_names[index]);
+    memcpy(buf, all_file_names[index], exe_len);
+    buf[exe_len] = '\0';
+    return 0;
+}
+
+/**
+ * read_dentry_by_index
+ *  DESCRIPTION : read the corresponding file dentry to the given
+ *                dentry based on the given index
+ *  INPUTS : uint32_t index - given index
+ *           dentry_t* dentry - given dentry
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - successfully load the dentry
+ *                 -1 - cannot find the corresponding file
+ *  SIDE EFFECTS : none
+ * 
+ */
+int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry)
+{
+    if (index >= boot_block_ptr->num_dir_entries) return -1;                                        // If the input index greater than the dentries number, return -1
+
+    uint32_t block, offset;
+    if (dentry_location(index, &block, &offset) == -1) return -1;                                   // Find the target that we need to copy from
+    bcache_read(block, offset, (uint8_t*)dentry, sizeof(dentry_t));                                 // Copy the whole dentry through the block cache
+    return 0;
+}
+
+/**
+ * dentry_location
+ *  DESCRIPTION : find where a dentry is stored. The first MAX_FILES_NUMBER
+ *                dentries are in the boot block, the next ones fill the
+ *                blocks of DIR_INODE, DENTRIES_PER_BLOCK per block.
+ *  INPUTS : uint32_t index - given index
+ *           uint32_t* block - where to store the device block
+ *           uint32_t* offset - where to store the offset in the block
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - the directory has no block for this index
+ *  SIDE EFFECTS : none
+ */
+static int32_t dentry_location (uint32_t index, uint32_t* block, uint32_t* offset)
+{
+    if (index < MAX_FILES_NUMBER) {
+        *block = 0;
+        *offset = (uint8_t*)(dentry_ptr + index) - (uint8_t*)boot_block_ptr;
+        return 0;
+    }
+    index -= MAX_FILES_NUMBER;
+    inode_t* dir_inode = inode_ptr + DIR_INODE;
+    if (index / DENTRIES_PER_BLOCK >= dir_inode->length / BLOCK_SIZE) return -1;
+    *block = DATA_DEV_BLOCK(dir_inode->data_blocks[index / DENTRIES_PER_BLOCK]);
+    *offset = (index % DENTRIES_PER_BLOCK) * sizeof(dentry_t);
+    return 0;
+}
+
+/**
+ * write_dentry
+ *  DESCRIPTION : store a dentry into the given slot of the directory
+ *  INPUTS : uint32_t index - given index, may be num_dir_entries for a new dentry
+ *           const dentry_t* dentry - the dentry to store
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - the directory has no block for this index
+ *  SIDE EFFECTS : modify the directory through the block cache
+ */
+static int32_t write_dentry (uint32_t index, const dentry_t* dentry)
+{
+    uint32_t block, offset;
+    if (dentry_location(index, &block, &offset) == -1) return -1;
+    if (block >= DATA_DEV_BLOCK(0)) data_write(block - DATA_DEV_BLOCK(0), offset, (const uint8_t*)dentry, sizeof(dentry_t));    // a directory block
+    else bcache_write(block, offset, (const uint8_t*)dentry, sizeof(dentry_t));
+    return 0;
+}
+
+/**
+ * write_boot_header
+ *  DESCRIPTION : copy the boot block header, which the filesystem reads and
+ *                updates in place, into the cached copy of the boot block so
+ *                that writing the dentries back never restores an old header
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the boot block through the block cache
+ */
+static void write_boot_header (void)
+{
+    bcache_write(0, 0, (const uint8_t*)boot_block_ptr, (uint8_t*)dentry_ptr - (uint8_t*)boot_block_ptr);
+}
+
+/**
+ * inode_block_get
+ *  DESCRIPTION : find the data block backing a file block. The first
+ *                NUM_DIRECT_BLOCKS blocks are listed in the inode, the next
+ *                PTRS_PER_BLOCK in the single indirect block, the rest in
+ *                the blocks listed by the double indirect block.
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t file_block - the block index within the file
+ *           uint32_t* span - where to store how many file blocks from file_block
+ *                            share the same missing indirect block, may be NULL
+ *  OUTPUTS : none
+ *  RETURN VALUE : the data block number
+ *                 BLOCK_HOLE - the file block has no storage
+ *  SIDE EFFECTS : read the indirect blocks through the block cache
+ */
+static uint32_t inode_block_get (uint32_t inode, uint32_t file_block, uint32_t* span)
+{
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t ind, D;
+    if (span != NULL) *span = 1;
+    if (file_block < NUM_DIRECT_BLOCKS) return target_inode->data_blocks[file_block];
+    file_block -= NUM_DIRECT_BLOCKS;
+    if (file_block < PTRS_PER_BLOCK) {
+        ind = target_inode->single_indirect;
+        if (ind == BLOCK_HOLE && span != NULL) *span = PTRS_PER_BLOCK - file_block;
+    } else {
+        file_block -= PTRS_PER_BLOCK;
+        ind = target_inode->double_indirect;
+        if (ind == BLOCK_HOLE) {
+            if (span != NULL) *span = PTRS_PER_BLOCK * PTRS_PER_BLOCK - file_block;
+            return BLOCK_HOLE;
+        }
+        bcache_read(DATA_DEV_BLOCK(ind), (file_block / PTRS_PER_BLOCK) * 4, (uint8_t*)&ind, 4);
+        file_block %= PTRS_PER_BLOCK;
+        if (ind == BLOCK_HOLE && span != NULL) *span = PTRS_PER_BLOCK - file_block;
+    }
+    if (ind == BLOCK_HOLE) return BLOCK_HOLE;                                                // the whole indirect block is a hole
+    bcache_read(DATA_DEV_BLOCK(ind), file_block * 4, (uint8_t*)&D, 4);
+    return D;
+}
+
+/**
+ * indirect_alloc
+ *  DESCRIPTION : give an indirect block storage if it is a hole, with
+ *                every entry a hole
+ *  INPUTS : uint32_t* block - the indirect block number, BLOCK_HOLE if missing
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - the indirect block exists
+ *                 -1 - no free block left
+ *  SIDE EFFECTS : may allocate a data block and update *block
+ */
+static int32_t indirect_alloc (uint32_t* block)
+{
+    static uint32_t holes[PTRS_PER_BLOCK];                                                   // an indirect block with nothing in it
+    uint32_t run;
+    int32_t D;
+    if (*block != BLOCK_HOLE) return 0;
+    D = alloc_blocks(1, &run);
+    if (D == -1) return -1;
+    memset(holes, 0xFF, BLOCK_SIZE);
+    data_write(D, 0, (const uint8_t*)holes, BLOCK_SIZE);
+    *block = D;
+    return 0;
+}
+
+/**
+ * inode_block_set
+ *  DESCRIPTION : store the data block backing a file block, allocating the
+ *                indirect blocks on the way if they are holes
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t file_block - the block index within the file
+ *           uint32_t block - the data block number, or BLOCK_HOLE
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - no free block left for an indirect block
+ *  SIDE EFFECTS : modify the inode or its indirect blocks
+ */
+static int32_t inode_block_set (uint32_t inode, uint32_t file_block, uint32_t block)
+{
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t ind, slot;
+    if (file_block < NUM_DIRECT_BLOCKS) {
+        target_inode->data_blocks[file_block] = block;
+        return 0;
+    }
+    file_block -= NUM_DIRECT_BLOCKS;
+    if (file_block < PTRS_PER_BLOCK) {
+        if (indirect_alloc(&target_inode->single_indirect) == -1) return -1;
+        ind = target_inode->single_indirect;
+    } else {
+        file_block -= PTRS_PER_BLOCK;
+        if (indirect_alloc(&target_inode->double_indirect) == -1) return -1;
+        slot = (file_block / PTRS_PER_BLOCK) * 4;
+        bcache_read(DATA_DEV_BLOCK(target_inode->double_indirect), slot, (uint8_t*)&ind, 4);
+        if (ind == BLOCK_HOLE) {
+            if (indirect_alloc(&ind) == -1) return -1;
+            data_write(target_inode->double_indirect, slot, (const uint8_t*)&ind, 4);
+        }
+        file_block %= PTRS_PER_BLOCK;
+    }
+    data_write(ind, file_block * 4, (const uint8_t*)&block, 4);
+    return 0;
+}
+
+/**
+ * indirect_free
+ *  DESCRIPTION : free the blocks an indirect block lists from index keep on,
+ *                and the indirect block itself if nothing before keep is left
+ *  INPUTS : uint32_t* block - the indirect block number
+ *           uint32_t keep - the first file block to free, relative to the indirect block
+ *           uint32_t end - the number of file blocks in use, relative to the indirect block
+ *           uint32_t span - file blocks per entry: 1, or PTRS_PER_BLOCK for the double indirect block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : free data blocks, set the freed entries to BLOCK_HOLE
+ */
+static void indirect_free (uint32_t* block, uint32_t keep, uint32_t end, uint32_t span)
+{
+    uint32_t i, entry;
+    if (*block == BLOCK_HOLE) return;
+    for (i = keep / span; i < PTRS_PER_BLOCK && i * span < end; i++) {
+        bcache_read(DATA_DEV_BLOCK(*block), i * 4, (uint8_t*)&entry, 4);
+        if (entry == BLOCK_HOLE) continue;
+        if (span == 1) {
+            free_block(entry);
+            entry = BLOCK_HOLE;
+        } else {
+            indirect_free(&entry, (keep > i * span) ? keep - i * span : 0, end - i * span, 1);
+        }
+        data_write(*block, i * 4, (const uint8_t*)&entry, 4);
+    }
+    if (keep == 0) {
+        free_block(*block);
+        *block = BLOCK_HOLE;
+    }
+}
+
+/**
+ * inode_blocks_free
+ *  DESCRIPTION : free the blocks of a file from file block keep to its end,
+ *                and the indirect blocks no longer needed
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t keep - the number of file blocks to keep
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : free data blocks, the freed blocks and an inline tail become holes
+ */
+static void inode_blocks_free (uint32_t inode, uint32_t keep)
+{
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t nblocks = FILE_BLOCKS(target_inode->length);
+    uint32_t i;
+    for (i = keep; i < nblocks && i < NUM_DIRECT_BLOCKS; i++) {
+        if (target_inode->data_blocks[i] == BLOCK_INLINE) {
+            memset(&target_inode->data_blocks[i], 0xFF, (NUM_DIRECT_BLOCKS - i) * 4);         // the tail bytes become holes again
+            break;
+        }
+        if (target_inode->data_blocks[i] != BLOCK_HOLE) free_block(target_inode->data_blocks[i]);
+        target_inode->data_blocks[i] = BLOCK_HOLE;
+    }
+    if (nblocks <= NUM_DIRECT_BLOCKS) return;
+    keep = (keep > NUM_DIRECT_BLOCKS) ? keep - NUM_DIRECT_BLOCKS : 0;
+    nblocks -= NUM_DIRECT_BLOCKS;
+    indirect_free(&target_inode->single_indirect, keep, nblocks, 1);
+    if (nblocks <= PTRS_PER_BLOCK) return;
+    keep = (keep > PTRS_PER_BLOCK) ? keep - PTRS_PER_BLOCK : 0;
+    indirect_free(&target_inode->double_indirect, keep, nblocks - PTRS_PER_BLOCK, PTRS_PER_BLOCK);
+}
+
+/**
+ * mark_block
+ *  DESCRIPTION : mark a data block busy in the free-block bitmap. A block
+ *                found busy already is shared by a clone and gets one
+ *                more reference.
+ *  INPUTS : uint32_t block - the data block number, BLOCK_HOLE is ignored
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the bitmap and the reference counts
+ */
+static void mark_block (uint32_t block)
+{
+    if (block >= boot_block_ptr->num_data_blocks || block >= MAX_DATA_BLOCKS) return;
+    if (data_blocks_bitmap[block / 32] & (1U << (block % 32))) {
+        if (block_refcount[block] < BLOCK_REF_MAX) block_refcount[block]++;
+        return;
+    }
+    data_blocks_bitmap[block / 32] |= 1U << (block % 32);
+    num_free_blocks--;
+}
+
+/**
+ * indirect_mark
+ *  DESCRIPTION : mark an indirect block and the blocks it lists busy
+ *  INPUTS : uint32_t block - the indirect block number
+ *           uint32_t end - the number of file blocks in use, relative to the indirect block
+ *           uint32_t span - file blocks per entry: 1, or PTRS_PER_BLOCK for the double indirect block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the bitmap
+ */
+static void indirect_mark (uint32_t block, uint32_t end, uint32_t span)
+{
+    uint32_t i, entry;
+    if (block == BLOCK_HOLE || block >= boot_block_ptr->num_data_blocks) return;
+    mark_block(block);
+    for (i = 0; i < PTRS_PER_BLOCK && i * span < end; i++) {
+        bcache_read(DATA_DEV_BLOCK(block), i * 4, (uint8_t*)&entry, 4);
+        if (span == 1) mark_block(entry);
+        else indirect_mark(entry, end - i * span, 1);
+    }
+}
+
+/**
+ * inode_blocks_mark
+ *  DESCRIPTION : mark every block a file uses busy, the data blocks as well
+ *                as the indirect blocks
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the bitmap
+ */
+static void inode_blocks_mark (uint32_t inode)
+{
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t nblocks = FILE_BLOCKS(target_inode->length);                                   // the last block can be partially used
+    uint32_t i;
+    for (i = 0; i < nblocks && i < NUM_DIRECT_BLOCKS; i++) mark_block(target_inode->data_blocks[i]);
+    if (nblocks <= NUM_DIRECT_BLOCKS) return;
+    nblocks -= NUM_DIRECT_BLOCKS;
+    indirect_mark(target_inode->single_indirect, nblocks, 1);
+    if (nblocks <= PTRS_PER_BLOCK) return;
+    indirect_mark(target_inode->double_indirect, nblocks - PTRS_PER_BLOCK, PTRS_PER_BLOCK);
+}
+
+/**
+ * extent_map_build
+ *  DESCRIPTION : merge the data blocks of an inode into runs of
+ *                consecutive block numbers, the holes into runs of holes
+ *                and the compressed clusters into runs of BLOCK_PACKED
+ *  INPUTS : extent_map_t* map - the cache slot to fill
+ *           uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : overwrite the cache slot. Files with more than
+ *                 MAX_EXTENTS runs only have their first runs cached.
+ */
+static void extent_map_build (extent_map_t* map, uint32_t inode)
+{
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    uint32_t i, span;
+    uint32_t checked = BLOCK_HOLE, packed = 0;                                               // the last cluster looked at, and whether it is compressed
+    extent_t* cur = NULL;
+
+    map->inode = inode;
+    map->valid = 1;
+    map->num_extents = 0;
+    map->num_blocks = 0;
+    for (i = 0; i < nblocks; i += span) {
+        uint32_t D = inode_block_get(inode, i, &span);                                       // a missing indirect block is one long hole
+        if (BLOCK_STORED(D) && i / COMPRESS_CLUSTER != checked) {
+            checked = i / COMPRESS_CLUSTER;
+            packed = cluster_packed(inode, checked);
+        }
+        if (BLOCK_STORED(D) && packed) {
+            D = BLOCK_PACKED;                                                                // the whole cluster reads from its stream
+            span = (checked + 1) * COMPRESS_CLUSTER - i;
+        }
+        if (span > nblocks - i) span = nblocks - i;
+        if (cur != NULL && !BLOCK_STORED(D) && cur->data_block == D) {
+            cur->count += span;                                                              // extend the current hole or compressed run
+        } else if (cur != NULL && BLOCK_STORED(D) && BLOCK_STORED(cur->data_block) && cur->data_block + cur->count == D) {
+            cur->count++;                                                                    // extend the current run
+        } else {
+            if (map->num_extents == MAX_EXTENTS) break;                                      // the rest is read block by block
+            cur = &map->extents[map->num_extents++];
+            cur->file_block = i;
+            cur->data_block = D;
+            cur->count = span;
+        }
+        map->num_blocks += span;
+    }
+}
+
+/**
+ * extent_lookup
+ *  DESCRIPTION : find the data block backing a file block and how many
+ *                consecutive data blocks follow it
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t file_block - the block index within the file
+ *           uint32_t* data_block - where to store the data block number
+ *  OUTPUTS : none
+ *                           BLOCK_HOLE if the file block has no storage
+ *                           BLOCK_PACKED if it is in a compressed cluster
+ *                           BLOCK_INLINE if it is the inline tail
+ *  RETURN VALUE : number of consecutive blocks (or holes) starting at file_block, at least 1
+ *  SIDE EFFECTS : build the extent map of the inode on first use
+ */
+static uint32_t extent_lookup (uint32_t inode, uint32_t file_block, uint32_t* data_block)
+{
+    extent_map_t* map = &extent_cache[inode % EXTENT_CACHE_SIZE];
+    if (!map->valid || map->inode != inode) extent_map_build(map, inode);
+
+    if (file_block < map->num_blocks) {
+        uint32_t lo = 0, hi = map->num_extents;                                              // binary search for the run holding file_block
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (map->extents[mid].file_block <= file_block) lo = mid;
+            else hi = mid;
+        }
+        extent_t* ext = &map->extents[lo];
+        *data_block = BLOCK_STORED(ext->data_block) ? ext->data_block + (file_block - ext->file_block) : ext->data_block;
+        return ext->count - (file_block - ext->file_block);
+    }
+
+    uint32_t span;
+    *data_block = inode_block_get(inode, file_block, &span);                                 // beyond the cached runs
+    if (BLOCK_STORED(*data_block) && cluster_packed(inode, file_block / COMPRESS_CLUSTER)) {
+        *data_block = BLOCK_PACKED;
+        return (file_block / COMPRESS_CLUSTER + 1) * COMPRESS_CLUSTER - file_block;
+    }
+    return (*data_block == BLOCK_HOLE) ? span : 1;
+}
+
+/**
+ * extent_map_invalidate
+ *  DESCRIPTION : drop the cached extent map, the block count and the
+ *                decompressed clusters of an inode after its block list changes
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : the map is rebuilt on the next read, the count on the next stat
+ */
+void extent_map_invalidate (uint32_t inode)
+{
+    extent_map_t* map = &extent_cache[inode % EXTENT_CACHE_SIZE];
+    uint32_t i;
+    if (map->inode == inode) map->valid = 0;
+    if (inode < MAX_INODES) block_count_valid[inode / 32] &= ~(1U << (inode % 32));
+    for (i = 0; i < CLUSTER_CACHE_SIZE; i++) {
+        if (cluster_cache[i].inode == inode) cluster_cache[i].valid = 0;
+    }
+}
+
+/**
+ * cluster_packed
+ *  DESCRIPTION : check whether a cluster of a file is stored compressed.
+ *                A compressed cluster lists the blocks of its LZ stream
+ *                first and BLOCK_PACKED for the blocks it saved, so its
+ *                last block within the file is BLOCK_PACKED.
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t cluster - the cluster index, file block / COMPRESS_CLUSTER
+ *  OUTPUTS : none
+ *  RETURN VALUE : 1 if the cluster is compressed, 0 otherwise
+ *  SIDE EFFECTS : none
+ */
+static int32_t cluster_packed (uint32_t inode, uint32_t cluster)
+{
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    uint32_t end = (cluster + 1) * COMPRESS_CLUSTER;
+    if (cluster >= (nblocks + COMPRESS_CLUSTER - 1) / COMPRESS_CLUSTER) return 0;
+    if (end > nblocks) end = nblocks;
+    return inode_block_get(inode, end - 1, NULL) == BLOCK_PACKED;
+}
+
+/**
+ * cluster_load
+ *  DESCRIPTION : find a compressed cluster in the cluster cache, or
+ *                decompress it into the least recently used slot. The
+ *                first block of the stream starts with its length in bytes.
+ *                Must be called with interrupts off, the slot can be
+ *                reused as soon as another process runs.
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t cluster - the cluster index
+ *  OUTPUTS : none
+ *  RETURN VALUE : the CLUSTER_SIZE decompressed bytes, zeros past the end of the file
+ *                 NULL - the cluster is not compressed or its stream is corrupted
+ *  SIDE EFFECTS : may evict another cluster
+ */
+static uint8_t* cluster_load (uint32_t inode, uint32_t cluster)
+{
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    uint32_t first = cluster * COMPRESS_CLUSTER;
+    uint32_t i, k, nb, D, stream_len, victim = 0;
+    int32_t n;
+
+    for (i = 0; i < CLUSTER_CACHE_SIZE; i++) {
+        if (cluster_cache[i].valid && cluster_cache[i].inode == inode && cluster_cache[i].cluster == cluster) {
+            cluster_stats.hits++;
+            cluster_cache[i].last_use = ++cluster_clock;
+            return cluster_data[i];
+        }
+        if (!cluster_cache[victim].valid) continue;                                          // keep the first empty slot
+        if (!cluster_cache[i].valid || cluster_cache[i].last_use < cluster_cache[victim].last_use) victim = i;
+    }
+    cluster_stats.misses++;
+
+    /* gather the stream, the blocks before the first BLOCK_PACKED */
+    if (first >= nblocks) return NULL;
+    nb = (nblocks - first < COMPRESS_CLUSTER) ? nblocks - first : COMPRESS_CLUSTER;
+    for (k = 0; k < nb; k++) {
+        D = inode_block_get(inode, first + k, NULL);
+        if (D == BLOCK_PACKED) break;
+        if (D >= boot_block_ptr->num_data_blocks) return NULL;
+        bcache_read(DATA_DEV_BLOCK(D), 0, packed_buf + k * BLOCK_SIZE, BLOCK_SIZE);
+        if (crc_verify_reads && block_verify(D, packed_buf + k * BLOCK_SIZE) == -1) return NULL;
+    }
+    if (k == 0 || k == nb) return NULL;
+    stream_len = *(uint32_t*)packed_buf;
+    if (stream_len > k * BLOCK_SIZE - 4) return NULL;
+
+    cluster_cache[victim].valid = 0;
+    n = lz_decompress(packed_buf + 4, stream_len, cluster_data[victim], CLUSTER_SIZE);
+    if (n == -1) return NULL;
+    memset(cluster_data[victim] + n, 0, CLUSTER_SIZE - n);                                   // the part of the last cluster past the end of the file
+    cluster_cache[victim].inode = inode;
+    cluster_cache[victim].cluster = cluster;
+    cluster_cache[victim].valid = 1;
+    cluster_cache[victim].last_use = ++cluster_clock;
+    return cluster_data[victim];
+}
+
+/**
+ * cluster_read
+ *  DESCRIPTION : copy bytes of compressed clusters out of the cluster cache
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t offset - the offset in the file
+ *           uint8_t* buf - the destination
+ *           uint32_t length - the number of bytes, within compressed clusters
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success, -1 - a corrupted cluster
+ *  SIDE EFFECTS : may decompress clusters
+ */
+static int32_t cluster_read (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+    uint32_t copy_len, flags;
+    uint8_t* data;
+    while (length > 0) {
+        copy_len = CLUSTER_SIZE - offset % CLUSTER_SIZE;
+        if (copy_len > length) copy_len = length;
+        /* a page fault on buf can load another cluster, it takes an older slot than this one */
+        cli_and_save(flags);
+        data = cluster_load(inode, offset / CLUSTER_SIZE);
+        if (data != NULL) memcpy(buf, data + offset % CLUSTER_SIZE, copy_len);
+        restore_flags(flags);
+        if (data == NULL) return -1;
+        buf += copy_len;
+        offset += copy_len;
+        length -= copy_len;
+    }
+    return 0;
+}
+
+/**
+ * cluster_unpack
+ *  DESCRIPTION : store a compressed cluster back as one data block per file
+ *                block, before a write, a truncate or an mmap changes it
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t cluster - the cluster index
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - the cluster is not compressed (any more)
+ *                 -1 - no free block left, or a corrupted cluster
+ *  SIDE EFFECTS : allocate data blocks, free the blocks of the stream
+ */
+static int32_t cluster_unpack (uint32_t inode, uint32_t cluster)
+{
+    uint32_t blocks[COMPRESS_CLUSTER], old[COMPRESS_CLUSTER];
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    uint32_t first = cluster * COMPRESS_CLUSTER;
+    uint32_t k, i, nb, run, flags;
+    int32_t D;
+    uint8_t* data;
+    if (!cluster_packed(inode, cluster)) return 0;
+
+    /* take every block first, a half unpacked cluster could not be read */
+    nb = (nblocks - first < COMPRESS_CLUSTER) ? nblocks - first : COMPRESS_CLUSTER;
+    for (k = 0; k < nb; k += run) {
+        D = alloc_blocks(nb - k, &run);
+        if (D == -1) {
+            while (k > 0) free_block(blocks[--k]);
+            return -1;
+        }
+        for (i = 0; i < run; i++) blocks[k + i] = D + i;
+    }
+
+    cli_and_save(flags);                                                                     // the decompressed cluster stays in its slot
+    data = cluster_load(inode, cluster);
+    for (k = 0; data != NULL && k < nb; k++) {
+        data_write(blocks[k], 0, data + k * BLOCK_SIZE, BLOCK_SIZE);
+        old[k] = inode_block_get(inode, first + k, NULL);
+        inode_block_set(inode, first + k, blocks[k]);                                        // the entries exist, no indirect block is allocated
+    }
+    restore_flags(flags);
+    if (data == NULL) {
+        for (k = 0; k < nb; k++) free_block(blocks[k]);
+        return -1;
+    }
+    for (k = 0; k < nb; k++) free_block(old[k]);                                             // BLOCK_PACKED entries are ignored
+    extent_map_invalidate(inode);
+    cluster_stats.unpacks++;
+    return 0;
+}
+
+/* read up to "length" bytes starting from position "offset" in the file with number inode*/
+/**
+ * read_data
+ *  DESCRIPTION : read the data with "length" into buffer based on "inode"
+                  and "offset" in that file 
+ *  INPUTS : uint32_t inode - given inode: find the index node
+             uint32_t offset - the offset in the file
+             uint8_t* buf - the buffer we want to write data to
+             uint32_t length - the length of the data we want to write
+ *  OUTPUTS : none
+ *  RETURN VALUE : bytes_copied - the number of bytes copied to the buffer
+                   -1 - fail to copy data, or a block does not match its checksum
+ *  SIDE EFFECTS : the blocks copied are verified once (crc_verify_reads)
+ * 
+ */
+int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) 
+{
+    /* invalid inode number */
+    if (inode >= boot_block_ptr->num_inodes) return -1;     
+    
+    inode_t* target_inode = inode_ptr + inode;
+
+    /* invalid offset*/
+    if (offset > target_inode->length) return 0;                                             // successfully read 0 bytes
+    /* eliminate extra length */
+    if (length > target_inode->length - offset) length = target_inode->length - offset;      // if beyond end of file 
+    /* tricky length */
+    if (length == 0) return 0;                                                               // if reading 0 bytes                 
+
+    uint32_t bytes_copied = 0;                                                               // holding total bytes being copied
+    uint32_t D, run, copy_len;
+
+    while (length > 0) {
+        uint32_t block_idx = offset / BLOCK_SIZE;                                            // each data block takes 4kB
+        uint32_t block_offset = offset % BLOCK_SIZE;                                         // offset in given data block
+
+        /* copy the whole run of consecutive data blocks at once */
+        run = extent_lookup(inode, block_idx, &D);
+        if (run > MAX_FILE_SIZE / BLOCK_SIZE) run = MAX_FILE_SIZE / BLOCK_SIZE;              // a long hole, keep run * BLOCK_SIZE in 32 bits
+        copy_len = run * BLOCK_SIZE - block_offset;
+        if (copy_len > length) copy_len = length;
+        if (D == BLOCK_HOLE) memset(buf, 0, copy_len);                                       // a hole reads as zeros
+        else if (D == BLOCK_PACKED) {
+            if (cluster_read(inode, offset, buf, copy_len) == -1) return -1;
+        }
+        else if (D == BLOCK_INLINE) memcpy(buf, INLINE_DATA(inode, block_idx) + block_offset, copy_len);     // the tail is in the inode
+        else if (bcache_read(DATA_DEV_BLOCK(D), block_offset, buf, copy_len) == -1) return -1;
+        else if (crc_verify_reads && run_verify(D, block_offset, buf, copy_len) == -1) return -1;
+
+        buf += copy_len;                                                                     // update buf pointer
+        offset += copy_len;
+        length -= copy_len;                                                                  // update length
+        bytes_copied += copy_len;                                                            // accumulate copied bytes
+    }
+
+    return bytes_copied;
+}
+
+/**
+ * inode_data_blocks
+ *  DESCRIPTION : count the data blocks a file stores, the blocks of the
+ *                compressed streams included. The count is kept until
+ *                extent_map_invalidate reports a change of the block list.
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of data blocks, holes and indirect blocks excluded
+ *  SIDE EFFECTS : cache the count
+ */
+uint32_t inode_data_blocks (uint32_t inode)
+{
+    uint32_t nblocks, fb, span, count = 0;
+    if (inode >= boot_block_ptr->num_inodes || inode >= MAX_INODES) return 0;
+    if (block_count_valid[inode / 32] & (1U << (inode % 32))) return block_count[inode];
+    nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    for (fb = 0; fb < nblocks; fb += span) {
+        if (BLOCK_STORED(inode_block_get(inode, fb, &span))) count++;                         // a missing indirect block is skipped at once
+    }
+    block_count[inode] = count;
+    block_count_valid[inode / 32] |= 1U << (inode % 32);
+    return count;
+}
+
+/**
+ * file_stat
+ *  DESCRIPTION : fill the metadata of a file from its inode, without
+ *                reading its data. A directory is as long as its dentries.
+ *  INPUTS : uint32_t file_type - 0 rtc, 1 directory, 2 regular file
+ *           uint32_t inode - the inode number, DIR_INODE for the root
+ *           stat_t* buf - where to store the metadata
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - invalid inode or buf
+ *  SIDE EFFECTS : none
+ */
+int32_t file_stat (uint32_t file_type, uint32_t inode, stat_t* buf)
+{
+    if (buf == NULL || inode >= boot_block_ptr->num_inodes) return -1;
+    buf->file_type = file_type;
+    buf->inode = inode;
+    buf->length = 0;
+    buf->blocks = 0;
+    if (file_type == 0) return 0;                                                            // rtc has no data
+    if (file_type == 1) buf->length = dir_entries(inode) * sizeof(dentry_t);
+    else buf->length = inode_ptr[inode].length;
+    buf->blocks = inode_data_blocks(inode);
+    return 0;
+}
+
+/**
+ * map_file_block
+ *  DESCRIPTION : find the address of the data block backing a file block,
+ *                used by mmap to map file data without copying it. The
+ *                mapping takes a reference on the block like a clone does,
+ *                so a later write copies the block first and a truncate,
+ *                an unlink or dedup cannot free it until unmap_file_block.
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t file_block - the block index within the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : the address of the data block, a shared zero block for a hole
+ *                 NULL - invalid inode, block past the end of the file, no
+ *                        block left to unpack a compressed cluster or an
+ *                        inline tail, the block has BLOCK_REF_MAX references,
+ *                        or the device is not memory mapped
+ *  SIDE EFFECTS : a dirty cached copy of the block is written back first,
+ *                 a compressed cluster is stored back uncompressed and an
+ *                 inline tail moves to a data block
+ */
+uint8_t* map_file_block (uint32_t inode, uint32_t file_block)
+{
+    uint32_t D;
+    uint8_t* data;
+    if (inode >= boot_block_ptr->num_inodes) return NULL;
+    if (file_block >= FILE_BLOCKS(inode_ptr[inode].length)) return NULL;
+    extent_lookup(inode, file_block, &D);
+    if (D == BLOCK_PACKED) {
+        if (cluster_unpack(inode, file_block / COMPRESS_CLUSTER) == -1) return NULL;       // a page needs the plain bytes
+        extent_lookup(inode, file_block, &D);
+    }
+    if (D == BLOCK_INLINE) {
+        if (inline_unpack(inode) == -1) return NULL;                                         // a page needs a block of its own
+        extent_lookup(inode, file_block, &D);
+    }
+    if (D == BLOCK_HOLE) return zero_block;                                                  // mapped read-only, it stays zero
+    if (block_refcount[D] == BLOCK_REF_MAX) return NULL;
+    data = bcache_map(DATA_DEV_BLOCK(D));
+    if (data != NULL) block_refcount[D]++;                                                   // the mapping keeps the block alive
+    return data;
+}
+
+/**
+ * mapped_data_block
+ *  DESCRIPTION : find the data block a map_file_block address points at
+ *  INPUTS : uint8_t* addr - an address returned by map_file_block
+ *  OUTPUTS : none
+ *  RETURN VALUE : the data block number, -1 for the zero block of a hole
+ *  SIDE EFFECTS : none
+ */
+static int32_t mapped_data_block (uint8_t* addr)
+{
+    uint32_t dev_block = ((uint32_t)addr - (uint32_t)boot_block_ptr) / BLOCK_SIZE;         // the ramdisk starts at the boot block
+    if (addr == zero_block || dev_block < DATA_DEV_BLOCK(0)) return -1;
+    if (dev_block - DATA_DEV_BLOCK(0) >= MAX_DATA_BLOCKS) return -1;
+    return dev_block - DATA_DEV_BLOCK(0);
+}
+
+/**
+ * dup_file_block
+ *  DESCRIPTION : take one more reference on a mapped block, for a second
+ *                mapping of the same page such as a forked process's
+ *  INPUTS : uint8_t* addr - an address returned by map_file_block
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - the block has BLOCK_REF_MAX references
+ *  SIDE EFFECTS : none
+ */
+int32_t dup_file_block (uint8_t* addr)
+{
+    int32_t D = mapped_data_block(addr);
+    if (D == -1) return 0;                                                                   // the zero block is never freed
+    if (block_refcount[D] == BLOCK_REF_MAX) return -1;
+    block_refcount[D]++;
+    return 0;
+}
+
+/**
+ * unmap_file_block
+ *  DESCRIPTION : drop the reference a mapping holds on a data block
+ *  INPUTS : uint8_t* addr - an address returned by map_file_block
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : free the block if no file uses it any more
+ */
+void unmap_file_block (uint8_t* addr)
+{
+    int32_t D = mapped_data_block(addr);
+    if (D != -1) free_block(D);
+}
+
+/**
+ * alloc_blocks
+ *  DESCRIPTION : allocate a run of contiguous free data blocks. The
+ *                search starts at the word where the last allocation
+ *                ended (next fit), skips full words and uses bsf to find
+ *                the first free block, then grows the run up to "want".
+ *  INPUTS : uint32_t want - the number of blocks wanted
+ *           uint32_t* count - where to store the number of blocks allocated
+ *  OUTPUTS : none
+ *  RETURN VALUE : the first data block of the run
+ *                 -1 - no free block left
+ *  SIDE EFFECTS : mark the blocks busy in the bitmap
+ */
+int32_t alloc_blocks (uint32_t want, uint32_t* count)
+{
+    uint32_t n, w, D, first, run = 0;
+    *count = 0;
+    if (want == 0 || num_free_blocks == 0) return -1;
+
+    for (n = 0; n < BITMAP_WORDS; n++) {
+        w = (alloc_hint + n) % BITMAP_WORDS;
+        if (data_blocks_bitmap[w] != 0xFFFFFFFF) break;                                      // this word has a free block
+    }
+    if (n == BITMAP_WORDS) return -1;
+
+    first = w * 32 + find_first_set(~data_blocks_bitmap[w]);
+    D = first;
+    while (run < want && D < MAX_DATA_BLOCKS) {
+        if ((D % 32) == 0 && want - run >= 32 && data_blocks_bitmap[D / 32] == 0) {
+            data_blocks_bitmap[D / 32] = 0xFFFFFFFF;                                         // take a whole free word at once
+            run += 32;
+            D += 32;
+            continue;
+        }
+        if (data_blocks_bitmap[D / 32] & (1U << (D % 32))) break;                             // end of the free run
+        data_blocks_bitmap[D / 32] |= 1U << (D % 32);
+        run++;
+        D++;
+    }
+
+    num_free_blocks -= run;
+    alloc_hint = (D / 32) % BITMAP_WORDS;
+    *count = run;
+    return first;
+}
+
+/**
+ * free_block
+ *  DESCRIPTION : drop a reference to a data block, and return it to the
+ *                free-block bitmap once no inode or mapping uses it
+ *  INPUTS : uint32_t block - the data block number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : mark the block free in the bitmap
+ */
+void free_block (uint32_t block)
+{
+    if (block >= MAX_DATA_BLOCKS || !(data_blocks_bitmap[block / 32] & (1U << (block % 32)))) return;
+    if (block_refcount[block] > 0) {
+        block_refcount[block]--;                                                             // another inode or a mapping still reads it
+        return;
+    }
+    data_blocks_bitmap[block / 32] &= ~(1U << (block % 32));
+    num_free_blocks++;
+    dedup_forget(block);
+    crc_valid[block / 32] &= ~(1U << (block % 32));                                          // a free block has no checksum
+    crc_bad[block / 32] &= ~(1U << (block % 32));
+    bcache_invalidate(DATA_DEV_BLOCK(block));                                                // its content is dead, never write it back
+}
+
+/**
+ * alloc_inode
+ *  DESCRIPTION : take a free inode from the inode bitmap, using bsf
+ *                to find the first free bit of the first non-full word
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : the inode number
+ *                 -1 - no free inode left
+ *  SIDE EFFECTS : mark the inode busy in the bitmap
+ */
+int32_t alloc_inode (void)
+{
+    uint32_t w;
+    if (num_free_inodes == 0) return -1;
+    for (w = 0; w < INODE_BITMAP_WORDS; w++) {
+        if (inode_bitmap[w] != 0xFFFFFFFF) {
+            uint32_t inode = w * 32 + find_first_set(~inode_bitmap[w]);
+            inode_bitmap[w] |= 1U << (inode % 32);
+            num_free_inodes--;
+            return inode;
+        }
+    }
+    return -1;
+}
+
+/**
+ * free_inode
+ *  DESCRIPTION : return an inode to the inode bitmap
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : mark the inode free in the bitmap
+ */
+void free_inode (uint32_t inode)
+{
+    if (inode == 0 || inode >= MAX_INODES || !(inode_bitmap[inode / 32] & (1U << (inode % 32)))) return;
+    inode_bitmap[inode / 32] &= ~(1U << (inode % 32));
+    num_free_inodes++;
+}
+
+/**
+ * update_exec_bit
+ *  DESCRIPTION : recompute the cached "is executable" bit of an inode from
+ *                the ELF magic number at the start of the file
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify inode_exec_bitmap
+ */
+static void update_exec_bit (uint32_t inode)
+{
+    uint8_t magic[4];
+    if (inode >= MAX_INODES) return;
+    if (read_data(inode, 0, magic, 4) == 4 && magic[0] == 0x7f && magic[1] == 0x45 && magic[2] == 0x4c && magic[3] == 0x46) {
+        inode_exec_bitmap[inode / 32] |= 1U << (inode % 32);
+    } else {
+        inode_exec_bitmap[inode / 32] &= ~(1U << (inode % 32));
+    }
+}
+
+/**
+ * is_executable
+ *  DESCRIPTION : check whether a file starts with the ELF magic number,
+ *                without reading the file
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : 1 if the file is an executable, 0 otherwise
+ *  SIDE EFFECTS : none
+ */
+int32_t is_executable (uint32_t inode)
+{
+    if (inode >= MAX_INODES) return 0;
+    return (inode_exec_bitmap[inode / 32] >> (inode % 32)) & 1;
+}
+
+/**
+ * block_needs_copy
+ *  DESCRIPTION : check whether a write into a file block needs a new data
+ *                block: a hole has no storage, a shared block is read by
+ *                another inode or mapped by a process
+ *  INPUTS : uint32_t block - the data block number, or BLOCK_HOLE
+ *  OUTPUTS : none
+ *  RETURN VALUE : 1 if the write needs a new block, 0 if it can go in place
+ *  SIDE EFFECTS : none
+ */
+static int32_t block_needs_copy (uint32_t block)
+{
+    return block == BLOCK_HOLE || (block < MAX_DATA_BLOCKS && block_refcount[block] > 0);
+}
+
+/**
+ * copy_block
+ *  DESCRIPTION : copy a data block into another one through the block cache
+ *  INPUTS : uint32_t dst - the data block to fill
+ *           uint32_t src - the data block to copy
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify dst
+ */
+static void copy_block (uint32_t dst, uint32_t src)
+{
+    static uint8_t copy_buf[BLOCK_SIZE];                                                     // too big for the kernel stack
+    uint32_t flags;
+    cli_and_save(flags);                                                                     // copy_buf is shared by all the processes
+    bcache_read(DATA_DEV_BLOCK(src), 0, copy_buf, BLOCK_SIZE);
+    data_write(dst, 0, copy_buf, BLOCK_SIZE);
+    restore_flags(flags);
+}
+
+/**
+ * block_fingerprint
+ *  DESCRIPTION : hash the content of a data block a word at a time
+ *  INPUTS : const uint32_t* words - the BLOCK_SIZE bytes of the block
+ *  OUTPUTS : none
+ *  RETURN VALUE : the 32-bit fingerprint, equal blocks have equal fingerprints
+ *  SIDE EFFECTS : none
  */
-void filesys_init (uint32_t filesys_addr)
+static uint32_t block_fingerprint (const uint32_t* words)
 {
-    int i,j;
-    boot_block_ptr = (boot_block_t*)filesys_addr;                                                   // cast filesys_addr to boot_block_t
-    inode_ptr = (inode_t*) (boot_block_ptr + 1);                                                    // Pointing to the first inode block, 1 means the next block of boot block
-    dentry_ptr = (dentry_t*) boot_block_ptr->dir_entries;                                           // Pointing to the first dentry
-    data_block_ptr = (uint8_t*) (inode_ptr + boot_block_ptr->num_inodes);                           // Pointing to the first data block
-    memset(&inode_array[0], 0, sizeof(inode_array[0]));
-    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++)
-    {
-        inode_array[dentry_ptr[i].inode] = 1;                                                       // Set it to be busy status
-    }
-    char temp[MAX_FILENAME_LEN] = {'\0'};
-    /* init the all_file_names array */
-    for (j=0; j<MAX_FILES_NUMBER; j++){
-        memcpy(all_file_names[j], temp, MAX_FILENAME_LEN);
-    }
-    /* assgin the file name into array. */
-    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++){
-        dentry_t temp_dentry;
-        read_dentry_by_index(i,&temp_dentry);
-        strncpy((char*)(all_file_names[i]),(char*)(temp_dentry.file_name), MAX_FILENAME_LEN);
+    uint32_t hash = 2166136261U;
+    uint32_t i;
+    for (i = 0; i < BLOCK_SIZE / 4; i++) {
+        hash = (hash ^ words[i]) * 0x9E3779B1U;                                              // golden ratio multiplier spreads every word
+        hash ^= hash >> 15;
     }
-    /*initialize the data blocks bitmap */
-    for (i = 0; i < MAX_FILES_NUMBER; i++ ){
-        inode_t* cur_inode = inode_ptr + i;
-        for (j = 0; j < cur_inode->length/BLOCK_SIZE; j++){
-            uint32_t D = cur_inode->data_blocks[j];
-            if (D >= BLOCK_SIZE ){
-                printf("oops! bitmap is not big enough!");
-                return;
-            }
-            data_blocks_bitmap[D] = 1;
+    return hash;
+}
+
+/**
+ * dedup_forget
+ *  DESCRIPTION : drop a data block from the fingerprint table before its
+ *                content changes or it is freed
+ *  INPUTS : uint32_t block - the data block number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : modify the fingerprint table
+ */
+static void dedup_forget (uint32_t block)
+{
+    int16_t* link;
+    if (block >= MAX_DATA_BLOCKS || !(dedup_indexed[block / 32] & (1U << (block % 32)))) return;
+    dedup_indexed[block / 32] &= ~(1U << (block % 32));
+    for (link = &dedup_head[dedup_hash[block] & (DEDUP_HASH_SIZE - 1)]; *link != DEDUP_NONE; link = &dedup_next[*link]) {
+        if (*link == block) {
+            *link = dedup_next[block];
+            return;
         }
     }
 }
 
 /**
- * read_dentry_by_name
- *  DESCRIPTION : read the corresponding file dentry to the given
- *                dentry based on the given filename
- *  INPUTS : const uint8_t* fname - given filename
- *           dentry_t* dentry - given dentry
+ * dedup_find
+ *  DESCRIPTION : look for an indexed data block with the same content that
+ *                can take one more reference
+ *  INPUTS : const uint32_t* words - the content to look for
+ *           uint32_t hash - its fingerprint
  *  OUTPUTS : none
- *  RETURN VALUE : 0 - successfully load the dentry
- *                 -1 - cannot find the corresponding file
- *  SIDE EFFECTS : none
- * 
+ *  RETURN VALUE : the data block number
+ *                 DEDUP_NONE - no identical block
+ *  SIDE EFFECTS : read the candidates through the block cache
  */
-int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
+static int32_t dedup_find (const uint32_t* words, uint32_t hash)
 {
-    /* non-existent file */
-    uint32_t name_len = strlen((char *)fname);
-
-    if(fname == NULL) return -1;                                                                    // If the filename is NULL, return -1
+    static uint32_t candidate[BLOCK_SIZE / 4];
+    int16_t block;
+    uint32_t i;
+    for (block = dedup_head[hash & (DEDUP_HASH_SIZE - 1)]; block != DEDUP_NONE; block = dedup_next[block]) {
+        if (dedup_hash[block] != hash || block_refcount[block] == BLOCK_REF_MAX) continue;
+        bcache_read(DATA_DEV_BLOCK(block), 0, (uint8_t*)candidate, BLOCK_SIZE);
+        for (i = 0; i < BLOCK_SIZE / 4 && candidate[i] == words[i]; i++);
+        if (i == BLOCK_SIZE / 4) return block;
+        dedup_stats.collisions++;
+    }
+    return DEDUP_NONE;
+}
 
-    if (name_len > MAX_FILENAME_LEN) return -1;                                                                   // If the filename length is out of range, return -1
+/**
+ * dedup_block
+ *  DESCRIPTION : fingerprint the data block backing a file block. A block
+ *                of zeros becomes a hole, a block identical to an indexed
+ *                one becomes one more reference to it (copy on write, like
+ *                a clone), any other block joins the table.
+ *  INPUTS : uint32_t inode - the inode number, not DIR_INODE
+ *           uint32_t file_block - the block index within the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : may free the block and share another one
+ */
+static void dedup_block (uint32_t inode, uint32_t file_block)
+{
+    static uint32_t words[BLOCK_SIZE / 4];
+    uint32_t D = inode_block_get(inode, file_block, NULL);
+    uint32_t i, hash, flags;
+    int32_t same;
+    if (!BLOCK_STORED(D) || D >= MAX_DATA_BLOCKS) return;
+    if (dedup_indexed[D / 32] & (1U << (D % 32))) return;                                    // unchanged since it was hashed
 
-    int i;
-    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++){                                         // Traverse the dentries
-        dentry_t* cur_dentry = &(dentry_ptr[i]);
-        uint32_t dentry_len = strlen((int8_t*)(cur_dentry->file_name));
-        if(dentry_len > MAX_FILENAME_LEN) dentry_len = MAX_FILENAME_LEN;
-        if((name_len == dentry_len) && (!strncmp((int8_t*)fname, (int8_t*)(cur_dentry->file_name), name_len))){      // If we find the corresponding file, call read_dentry_by_index to write to the buffer
-            read_dentry_by_index(i, dentry);
-            return 0;                                                                               // Successfully find the file: return 0
+    cli_and_save(flags);                                                                     // words is shared by all the processes
+    bcache_read(DATA_DEV_BLOCK(D), 0, (uint8_t*)words, BLOCK_SIZE);
+    hash = block_fingerprint(words);
+    dedup_stats.hashed++;
+    for (i = 0; i < BLOCK_SIZE / 4 && words[i] == 0; i++);
+    if (i == BLOCK_SIZE / 4 && !cluster_packed(inode, file_block / COMPRESS_CLUSTER)) {
+        inode_block_set(inode, file_block, BLOCK_HOLE);                                      // the entry exists, nothing is allocated
+        dedup_stats.zeroed++;
+        same = D;
+    } else {
+        same = dedup_find(words, hash);
+        if (same == DEDUP_NONE) {
+            dedup_hash[D] = hash;
+            dedup_next[D] = dedup_head[hash & (DEDUP_HASH_SIZE - 1)];
+            dedup_head[hash & (DEDUP_HASH_SIZE - 1)] = D;
+            dedup_indexed[D / 32] |= 1U << (D % 32);
+        } else {
+            inode_block_set(inode, file_block, same);
+            block_refcount[same]++;
+            dedup_stats.merged++;
         }
     }
-    return -1;                                                                                      // Cannot find the corresponding file after traversing: return -1
+    restore_flags(flags);
+    if (same == DEDUP_NONE) return;
+    free_block(D);                                                                           // drop this inode's reference
+    dedup_stats.bytes_saved += BLOCK_SIZE;
+    extent_map_invalidate(inode);
 }
 
-int32_t find_similar_file(char* line_buffer, char* buf){
-    uint32_t cmd_len = strlen(line_buffer);
-    int8_t   exe_file[MAX_FILENAME_LEN + 1] = {'\0'};                                               // leave 1 place for "\0"
-    int8_t   args[BUFFER_SIZE + 1] = {'\0'};                                                        // leave 1 place for "\0"
-    uint8_t i;
-    uint32_t exe_len = 0;
-    uint32_t args_len = 0;
-    uint32_t empty_len = 0;
-    for(i = 0; i <= cmd_len; i++){
-        if(line_buffer[i] == '\0' || line_buffer[i] == ' '){
-            exe_len = MAX_FILENAME_LEN;
-            if(exe_len > i) exe_len = i;
-            strncpy(exe_file, (int8_t*)line_buffer, exe_len);                                           // Store the exe_file given by the command
-            break;
-        }
+/**
+ * crc_update
+ *  DESCRIPTION : compute the checksum of a data block after it changed
+ *  INPUTS : uint32_t block - the data block number
+ *           const uint8_t* data - the BLOCK_SIZE bytes of the block, NULL to read them
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : the block has a checksum, not verified yet
+ */
+static void crc_update (uint32_t block, const uint8_t* data)
+{
+    uint32_t flags;
+    if (block >= MAX_DATA_BLOCKS) return;
+    cli_and_save(flags);                                                                     // crc_buf is shared
+    if (data == NULL && bcache_read(DATA_DEV_BLOCK(block), 0, crc_buf, BLOCK_SIZE) != -1) data = crc_buf;
+    if (data != NULL) {
+        block_crc[block] = crc32c(0, data, BLOCK_SIZE);
+        crc_valid[block / 32] |= 1U << (block % 32);
+        crc_verified[block / 32] &= ~(1U << (block % 32));                                   // the next read checks what was stored
+        crc_bad[block / 32] &= ~(1U << (block % 32));
+        crc_stats.computed++;
     }
-    for(; i < cmd_len; i++){
-        if (line_buffer[i] == ' '){
-           empty_len++; 
-        }
-        if(line_buffer[i] != '\0' && line_buffer[i] != ' '){
-            strncpy(args, (int8_t*)(line_buffer + i), cmd_len - i);                                     // Store the argument given by the command
-            args_len = cmd_len-i;
-            break;
-        }
+    restore_flags(flags);
+}
+
+/**
+ * data_write
+ *  DESCRIPTION : write into data blocks through the block cache and
+ *                update their checksums in the same step, so the scrub
+ *                never sees new bytes with an old checksum
+ *  INPUTS : uint32_t block - the first data block
+ *           uint32_t offset - the offset in the first block
+ *           const uint8_t* buf - the bytes to write
+ *           uint32_t length - the number of bytes, may span consecutive blocks
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes written, -1 on device error
+ *  SIDE EFFECTS : modify the blocks and their checksums
+ */
+static int32_t data_write (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    uint32_t flags, i, nb = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int32_t ret;
+    cli_and_save(flags);
+    ret = bcache_write(DATA_DEV_BLOCK(block), offset, buf, length);
+    for (i = 0; ret != -1 && i < nb; i++) {
+        uint32_t start = i * BLOCK_SIZE;                                                     // of the block, relative to the first one
+        uint32_t whole = (start >= offset && start + BLOCK_SIZE <= offset + length);
+        crc_update(block + i, whole ? buf + start - offset : NULL);                          // a whole block is checksummed from buf
     }
+    restore_flags(flags);
+    return ret;
+}
 
-    /* autocomplete the exe_file */
-    dentry_t exe_dentry;
-    uint8_t exe_check[4];
-    exe_len = strlen(exe_file);
-    if (args_len == 0 && empty_len == 0){
-        for(i=0; i<(boot_block_ptr->num_dir_entries); i++){
-            if (!strncmp(exe_file, all_file_names[i], exe_len)){
-                /* find the matched file name */
-                if (multi_terms[cur_terminal].flag_cnt >= 1){
-                    multi_terms[cur_terminal].flag_cnt = 0;
-                    memset(exe_file, '\0', strlen(exe_file));
-                    memset(args, '\0', strlen(args));
-                    return 1;
-                }
-                /* check whether it is exe file. */
-                read_dentry_by_name((uint8_t*)all_file_names[i], &exe_dentry);
-                read_data(exe_dentry.inode, 0, exe_check, 4);                                                   // Read the 4 bytes that denote the executable file
-                if((exe_check[0] != 0x7f) || (exe_check[1] != 0x45) || (exe_check[2] != 0x4c) || (exe_check[3] != 0x46)){       // Compare with 4 bytes that denote executable file
-                    multi_terms[cur_terminal].flag_cnt = 0;
-                    memset(exe_file, '\0', strlen(exe_file));
-                    memset(args, '\0', strlen(args));
-                    return -1;
-                }
-                memcpy(buf, all_file_names[i], strlen(all_file_names[i]));
-                multi_terms[cur_terminal].flag_cnt++;
-            }
+/**
+ * block_verify
+ *  DESCRIPTION : check a data block against its checksum, once until the
+ *                scrub checks it again. A block without a checksum (taken
+ *                and not written yet) passes.
+ *  INPUTS : uint32_t block - the data block number
+ *           const uint8_t* data - a copy of the block just read, NULL to read it
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - the block is good
+ *                 -1 - the block is corrupted
+ *  SIDE EFFECTS : report a corrupted block the first time it is found
+ */
+static int32_t block_verify (uint32_t block, const uint8_t* data)
+{
+    uint32_t flags, bit = 1U << (block % 32);
+    int32_t ret = 0;
+    if (block >= MAX_DATA_BLOCKS) return 0;
+    cli_and_save(flags);
+    if (crc_bad[block / 32] & bit) ret = -1;
+    else if (!(crc_valid[block / 32] & bit)) ret = 0;                                       // taken and not written yet
+    else if (crc_verified[block / 32] & bit) crc_stats.cached++;
+    else {
+        crc_stats.verified++;
+        /* the copy may predate a write made since, check the block itself before failing it */
+        if (data == NULL || crc32c(0, data, BLOCK_SIZE) != block_crc[block]) {
+            if (bcache_read(DATA_DEV_BLOCK(block), 0, crc_buf, BLOCK_SIZE) == -1 || crc32c(0, crc_buf, BLOCK_SIZE) != block_crc[block]) ret = -1;
+        }
+        if (ret == 0) crc_verified[block / 32] |= bit;
+        else {
+            crc_bad[block / 32] |= bit;
+            crc_stats.bad++;
+            printf("filesys: data block %d does not match its checksum\n", block);
         }
     }
-    /* if cnt=0 or larger than 1, (no matched or more than one matched), return -1. */
-    if (multi_terms[cur_terminal].flag_cnt == 0){
-        memset(exe_file, '\0', strlen(exe_file));
-        memset(args, '\0', strlen(args));
-        return -1;
-    }
-
-    memset(exe_file, '\0', strlen(exe_file));
-    memset(args, '\0', strlen(args));
-    multi_terms[cur_terminal].flag_cnt = 0;
-    return 0;
+    restore_flags(flags);
+    return ret;
 }
 
 /**
- * read_dentry_by_index
- *  DESCRIPTION : read the corresponding file dentry to the given
- *                dentry based on the given index
- *  INPUTS : uint32_t index - given index
- *           dentry_t* dentry - given dentry
+ * run_verify
+ *  DESCRIPTION : check the blocks of a run read_data just copied. Blocks
+ *                copied whole are checksummed from the copy.
+ *  INPUTS : uint32_t block - the first data block of the run
+ *           uint32_t offset - the offset in the first block
+ *           const uint8_t* buf - the bytes copied
+ *           uint32_t length - the number of bytes copied
  *  OUTPUTS : none
- *  RETURN VALUE : 0 - successfully load the dentry
- *                 -1 - cannot find the corresponding file
+ *  RETURN VALUE : 0 - all the blocks are good
+ *                 -1 - a block is corrupted
  *  SIDE EFFECTS : none
- * 
  */
-int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry)
+static int32_t run_verify (uint32_t block, uint32_t offset, const uint8_t* buf, uint32_t length)
 {
-    if (index >= boot_block_ptr->num_dir_entries) return -1;                                        // If the input index greater than the dentries number, return -1
-
-    dentry_t* target = dentry_ptr + index;                                                          // Find the target that we need to copy from
-
-    strncpy((char *)dentry->file_name, (char *)target->file_name, MAX_FILENAME_LEN);                // Copy the filename to dentry->file_name
-    dentry->file_type = target->file_type;                                                          // Copy other fields
-    dentry->inode     = target->inode;
+    uint32_t i, nb = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (i = 0; i < nb; i++) {
+        uint32_t start = i * BLOCK_SIZE;                                                     // of the block, relative to the run
+        uint32_t whole = (start >= offset && start + BLOCK_SIZE <= offset + length);
+        if (block_verify(block + i, whole ? buf + start - offset : NULL) == -1) return -1;
+    }
     return 0;
 }
 
-/* read up to "length" bytes starting from position "offset" in the file with number inode*/
 /**
- * read_data
- *  DESCRIPTION : read the data with "length" into buffer based on "inode"
-                  and "offset" in that file 
- *  INPUTS : uint32_t inode - given inode: find the index node
-             uint32_t offset - the offset in the file
-             uint8_t* buf - the buffer we want to write data to
-             uint32_t length - the length of the data we want to write
+ * filesys_scrub
+ *  DESCRIPTION : check the next data blocks in use against their checksums,
+ *                going round the image. Called when a terminal waits for
+ *                input, one block at a time with interrupts off.
+ *  INPUTS : uint32_t count - the number of data blocks to look at
  *  OUTPUTS : none
- *  RETURN VALUE : bytes_copied - the number of bytes copied to the buffer
-                   -1 - fail to copy data
- *  SIDE EFFECTS : none
- * 
+ *  RETURN VALUE : the number of corrupted blocks found
+ *  SIDE EFFECTS : report the corrupted blocks
  */
-int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) 
+uint32_t filesys_scrub (uint32_t count)
 {
-    /* invalid inode number */
-    if (inode >= boot_block_ptr->num_inodes) return -1;     
-    
-    inode_t* target_inode = inode_ptr + inode;
-
-    /* invalid offset*/
-    if (offset > target_inode->length) return 0;                                             // successfully read 0 bytes
-    /* eliminate extra length */
-    if (length > target_inode->length - offset) length = target_inode->length - offset;      // if beyond end of file 
-    /* tricky length */
-    if (length == 0) return 0;                                                               // if reading 0 bytes                 
-
-    uint32_t start_block_idx = offset / BLOCK_SIZE;                                          // each data block takes 4kB
-    uint32_t start_block_offset = offset % BLOCK_SIZE;                                       // offset in given data block
-    uint32_t bytes_copied = 0;                                                               // holding total bytes being copied
+    uint32_t num_blocks = boot_block_ptr->num_data_blocks;
+    uint32_t flags, block, bit, found = 0;
+    if (num_blocks > MAX_DATA_BLOCKS) num_blocks = MAX_DATA_BLOCKS;
+    for (; count > 0 && num_blocks > 0; count--) {
+        cli_and_save(flags);
+        block = scrub_next % num_blocks;
+        bit = 1U << (block % 32);
+        scrub_next = block + 1;
+        if (scrub_next == num_blocks) crc_stats.passes++;
+        if ((data_blocks_bitmap[block / 32] & bit) && (crc_valid[block / 32] & bit) && !(crc_bad[block / 32] & bit)) {
+            crc_verified[block / 32] &= ~bit;                                                 // it may have rotted since it was checked
+            crc_stats.scrubbed++;
+            if (block_verify(block, NULL) == -1) found++;
+        }
+        restore_flags(flags);
+    }
+    return found;
+}
 
-    uint32_t D = target_inode->data_blocks[start_block_idx];                                 // index within data block array
-    
-    /* The start address of reading*/
-    uint8_t* read_ptr = data_block_ptr + BLOCK_SIZE*D + start_block_offset;                  // start reading data from this address
-    uint32_t left_len = BLOCK_SIZE - start_block_offset;                                     // how many bytes still need to copy in given data block
+/**
+ * inline_tail
+ *  DESCRIPTION : find the inline tail of a file
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : the file block of the tail, the last block of the file
+ *                 BLOCK_HOLE - the file has no inline tail
+ *  SIDE EFFECTS : none
+ */
+static uint32_t inline_tail (uint32_t inode)
+{
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[inode].length);
+    if (nblocks == 0 || nblocks > NUM_DIRECT_BLOCKS) return BLOCK_HOLE;
+    return (inode_ptr[inode].data_blocks[nblocks - 1] == BLOCK_INLINE) ? nblocks - 1 : BLOCK_HOLE;
+}
 
-    while (length > left_len) {
+/**
+ * inline_unpack
+ *  DESCRIPTION : move the inline tail of a file to a data block of its own,
+ *                before the file grows past it or a page maps it
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - the file has no inline tail (any more)
+ *                 -1 - no free block left
+ *  SIDE EFFECTS : allocate a data block, the entries after it become holes again
+ */
+static int32_t inline_unpack (uint32_t inode)
+{
+    static const uint8_t zeros[BLOCK_SIZE];                                                  // the block past the inline bytes
+    uint32_t fb = inline_tail(inode);
+    uint32_t run;
+    int32_t D;
+    if (fb == BLOCK_HOLE) return 0;
+    D = alloc_blocks(1, &run);
+    if (D == -1) return -1;
+    data_write(D, 0, INLINE_DATA(inode, fb), INLINE_CAPACITY(fb));                                 // zeros past the end of the file
+    data_write(D, INLINE_CAPACITY(fb), zeros, BLOCK_SIZE - INLINE_CAPACITY(fb));
+    memset(&inode_ptr[inode].data_blocks[fb], 0xFF, (NUM_DIRECT_BLOCKS - fb) * 4);
+    inode_ptr[inode].data_blocks[fb] = D;
+    extent_map_invalidate(inode);
+    return 0;
+}
 
-        length -= left_len;                                                                  // update length
-        memcpy(buf, read_ptr, left_len);                                                     // copy left bytes into buf
-        buf += left_len;                                                                     // update buf pointer
-        bytes_copied += left_len;                                                            // accumulate copied bytes
-        
-        start_block_idx++;                                                                   // update index to data block
-        D = target_inode->data_blocks[start_block_idx];                                      // update D
-        read_ptr = data_block_ptr + BLOCK_SIZE*D;                                            // update read_ptr
-        left_len = BLOCK_SIZE;
+/**
+ * inline_pack
+ *  DESCRIPTION : move the last block of a file into its inode when the
+ *                bytes of the file in that block fit after its direct entry,
+ *                so a small file or the tail of a larger one takes no block
+ *  INPUTS : uint32_t inode - the inode number
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : free the last data block, the entries after it hold its bytes
+ */
+static void inline_pack (uint32_t inode)
+{
+    uint32_t length = inode_ptr[inode].length;
+    uint32_t fb, D;
+    if (inode == DIR_INODE || length == 0) return;
+    fb = (length - 1) / BLOCK_SIZE;
+    if (fb >= NUM_DIRECT_BLOCKS - 1 || length - fb * BLOCK_SIZE > INLINE_CAPACITY(fb)) return;
+    D = inode_ptr[inode].data_blocks[fb];
+    if (!BLOCK_STORED(D) || cluster_packed(inode, fb / COMPRESS_CLUSTER)) return;           // a hole takes no block already
+    memset(INLINE_DATA(inode, fb), 0, INLINE_CAPACITY(fb));                                  // the bytes past the end read as zeros
+    bcache_read(DATA_DEV_BLOCK(D), 0, INLINE_DATA(inode, fb), length - fb * BLOCK_SIZE);
+    inode_ptr[inode].data_blocks[fb] = BLOCK_INLINE;
+    free_block(D);
+    extent_map_invalidate(inode);
+}
 
+/**
+ * inline_write
+ *  DESCRIPTION : write into the inline tail of a file, or start one, when
+ *                the write only touches the last block and the file still
+ *                fits after its direct entry
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t offset - the offset in the file, at most the length
+ *           const uint8_t* buf - the bytes to write
+ *           uint32_t length - the number of bytes, at least 1
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - written in the inode
+ *                 -1 - the write needs data blocks
+ *  SIDE EFFECTS : may grow the file
+ */
+static int32_t inline_write (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t end = offset + length;
+    uint32_t new_length = (end > target_inode->length) ? end : target_inode->length;
+    uint32_t fb = (new_length - 1) / BLOCK_SIZE;
+    if (inode == DIR_INODE || offset / BLOCK_SIZE != fb) return -1;
+    if (fb >= NUM_DIRECT_BLOCKS - 1 || new_length - fb * BLOCK_SIZE > INLINE_CAPACITY(fb)) return -1;
+    if (target_inode->data_blocks[fb] != BLOCK_INLINE) {
+        if (target_inode->data_blocks[fb] != BLOCK_HOLE || inline_tail(inode) != BLOCK_HOLE) return -1;
+        memset(INLINE_DATA(inode, fb), 0, INLINE_CAPACITY(fb));                              // a hole reads as zeros
+        target_inode->data_blocks[fb] = BLOCK_INLINE;
     }
+    memcpy(INLINE_DATA(inode, fb) + offset % BLOCK_SIZE, buf, length);
+    target_inode->length = new_length;
+    extent_map_invalidate(inode);
+    return 0;
+}
 
-    /* last block of data to read */
-    memcpy(buf, read_ptr, length);                                          
-    buf += length;
-    bytes_copied += length;                                                                  // length is less than BLOCK_SIZE
-
-    return bytes_copied;
-
+/**
+ * clone_data
+ *  DESCRIPTION : make a file a copy of another one by sharing its data
+ *                blocks instead of copying them. Each shared block gets one
+ *                more reference, and the first write into it from either
+ *                file gives that file its own copy of the block. Only the
+ *                indirect blocks of the clone are new.
+ *  INPUTS : uint32_t src_inode - the file to copy
+ *           uint32_t dst_inode - the file to overwrite
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - invalid inode, a block has too many references, or no
+ *                      block left for the indirect blocks of the clone
+ *  SIDE EFFECTS : free the old blocks of dst_inode, dst_inode is empty on failure
+ */
+int32_t clone_data (uint32_t src_inode, uint32_t dst_inode)
+{
+    if (src_inode >= boot_block_ptr->num_inodes || dst_inode >= boot_block_ptr->num_inodes) return -1;
+    if (src_inode == dst_inode) return 0;
+    if (truncate_data(dst_inode, 0) == -1) return -1;
 
+    uint32_t nblocks = FILE_BLOCKS(inode_ptr[src_inode].length);
+    uint32_t fb, D, span;
+    inode_ptr[dst_inode].length = inode_ptr[src_inode].length;                               // the blocks not set yet are holes
+    for (fb = 0; fb < nblocks; fb += span) {
+        D = inode_block_get(src_inode, fb, &span);                                          // skip a missing indirect block at once
+        if (D == BLOCK_HOLE) continue;
+        if (D == BLOCK_INLINE) {
+            memcpy(&inode_ptr[dst_inode].data_blocks[fb], &inode_ptr[src_inode].data_blocks[fb], (NUM_DIRECT_BLOCKS - fb) * 4);  // the tail is copied, it has no block to share
+            continue;
+        }
+        if ((D != BLOCK_PACKED && block_refcount[D] == BLOCK_REF_MAX) || inode_block_set(dst_inode, fb, D) == -1) {
+            truncate_data(dst_inode, 0);                                                     // drop the references taken so far
+            return -1;
+        }
+        if (D != BLOCK_PACKED) block_refcount[D]++;                                          // a compressed cluster shares its stream
+    }
+    extent_map_invalidate(dst_inode);
+    update_exec_bit(dst_inode);
+    return 0;
 }
 
 /**
- * find_empty_block
- *  DESCRIPTION : find one data block that has not been used
- *  INPUTS : none
- *  OUTPUTS : the index in data blocks array
- *  SIDE EFFECTS : none 
- * 
+ * truncate_data
+ *  DESCRIPTION : set the length of a file. Shrinking frees the data blocks
+ *                past the new end, growing appends a hole, which reads as
+ *                zeros and takes no block until it is written. A last block
+ *                that fits in the inode moves there.
+ *  INPUTS : uint32_t inode - the inode number
+ *           uint32_t length - the new length
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success
+ *                 -1 - invalid inode, or no block left to copy a shared last
+ *                      block, to unpack a compressed last cluster or to
+ *                      move an inline tail out of the inode
+ *  SIDE EFFECTS : free data blocks
  */
-int32_t find_empty_block (void)
-{   uint16_t i;
-    for (i = 0; i < BLOCK_SIZE; i++){
-        if (data_block_ptr[i] == 0) {
-            data_block_ptr[i] = 1;
-            return i;
-        } 
+int32_t truncate_data (uint32_t inode, uint32_t length)
+{
+    static const uint8_t zeros[BLOCK_SIZE];                                                  // source of the cleared bytes
+    if (inode >= boot_block_ptr->num_inodes) return -1;
+
+    inode_t* target_inode = inode_ptr + inode;
+    uint32_t old_length = target_inode->length;
+    uint32_t old_blocks = FILE_BLOCKS(old_length), new_blocks = FILE_BLOCKS(length);
+    uint32_t tail = inline_tail(inode);
+    if (tail != BLOCK_HOLE && new_blocks == old_blocks && length - tail * BLOCK_SIZE <= INLINE_CAPACITY(tail)) {
+        /* the end moves within the inline tail, the cut bytes read as zeros on a later grow */
+        if (length < old_length) memset(INLINE_DATA(inode, tail) + length % BLOCK_SIZE, 0, old_length - length);
+        target_inode->length = length;
+        extent_map_invalidate(inode);
+        if (length < 4) update_exec_bit(inode);
+        return 0;
     }
-    return -1;
+    if (tail != BLOCK_HOLE && new_blocks >= old_blocks && inline_unpack(inode) == -1) return -1;
+    /* a compressed cluster whose last block in the file moves is stored back uncompressed */
+    if (new_blocks < old_blocks && new_blocks % COMPRESS_CLUSTER != 0 && cluster_unpack(inode, new_blocks / COMPRESS_CLUSTER) == -1) return -1;
+    if (new_blocks > old_blocks && old_blocks % COMPRESS_CLUSTER != 0 && cluster_unpack(inode, old_blocks / COMPRESS_CLUSTER) == -1) return -1;
+    if (length > old_length && old_length % BLOCK_SIZE != 0) {
+        /* the last block may still hold bytes cut by an earlier shrink, write_data copies it first if it is shared */
+        uint32_t chunk = BLOCK_SIZE - old_length % BLOCK_SIZE;
+        if (chunk > length - old_length) chunk = length - old_length;
+        if (inode_block_get(inode, old_length / BLOCK_SIZE, NULL) != BLOCK_HOLE && write_data(inode, old_length, zeros, chunk) <= 0) return -1;
+    }
+    if (length < old_length) inode_blocks_free(inode, FILE_BLOCKS(length));                 // blocks still holding data are kept
+    target_inode->length = length;
+    extent_map_invalidate(inode);
+    if (length < old_length) inline_pack(inode);                                             // the new last block may fit in the inode
+    if (length < 4) update_exec_bit(inode);                                                  // the magic number was cut
+    return 0;
 }
 
-
-/* write up to "length" bytes starting from the bottom of the file with number inode*/
+/* write up to "length" bytes starting from position "offset" in the file with number inode*/
 /**
- * read_data
- *  DESCRIPTION : write up to "length" bytes starting from the bottom
- *                of the file with number inode 
+ * write_data
+ *  DESCRIPTION : write up to "length" bytes starting from position "offset"
+ *                of the file with number inode. Bytes already in the file
+ *                are overwritten in place, only the holes the write covers
+ *                get blocks. Writing past the end leaves a hole in the gap.
+ *                A block shared with a clone is copied first (copy on write),
+ *                a compressed cluster is stored back uncompressed first.
+ *                A block the write completes is deduplicated. A last block
+ *                that fits after its direct entry stays in the inode.
  *  INPUTS : uint32_t inode - given inode: find the index node
+             uint32_t offset - the offset in the file
              uint8_t* buf - the buffer loading the bytes to write
              uint32_t length - the length of the data we want to write
  *  OUTPUTS : none
- *  RETURN VALUE : bytes_copied - the number of bytes written to the file
-                   -1 - fail to copy data
- *  SIDE EFFECTS : none
+ *  RETURN VALUE : bytes_written - the number of bytes written to the file, less
+                   than length if the file system is full or the file reaches MAX_FILE_SIZE
+                   -1 - invalid inode, or offset is at MAX_FILE_SIZE
+ *  SIDE EFFECTS : may allocate data blocks and grow the file
  * 
  */
-int32_t write_data (uint32_t inode, const uint8_t* buf, uint32_t length) 
+int32_t write_data (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length) 
 {
+    static const uint8_t zeros[BLOCK_SIZE];                                                  // source of the cleared bytes
     /* invalid inode number */
     if (inode >= boot_block_ptr->num_inodes) return -1;     
     
@@ -283,56 +2535,85 @@ int32_t write_data (uint32_t inode, const uint8_t* buf, uint32_t length)
 
     uint32_t bytes_written = 0;                                                              // holding total bytes being written
 
-    uint32_t max_left_space = (BLOCK_SIZE/4 - 1)*BLOCK_SIZE - target_inode->length;
-    /* eliminate extra length */
-    if (length > max_left_space) length = max_left_space;                                   // if beyond end of file 
+    /* the length has 32 bits */
+    if (offset >= MAX_FILE_SIZE) return -1;
+    if (length > MAX_FILE_SIZE - offset) length = MAX_FILE_SIZE - offset;                    // the caller sees a short write
     /* tricky length */
-    if (length == 0) return 0;                                                              // if reading 0 bytes                 
+    if (length == 0) return 0;                                                              // if writing 0 bytes                 
+    /* a gap after the end of the file becomes a hole */
+    if (offset > target_inode->length) truncate_data(inode, offset);
+    /* a small file, or the tail of a larger one, is written in the inode */
+    if (offset <= target_inode->length && inline_write(inode, offset, buf, length) == 0) {
+        if (offset < 4) update_exec_bit(inode);
+        return length;
+    }
 
+    /* give blocks to the holes and the shared blocks the write covers, in contiguous runs */
+    uint32_t first = offset / BLOCK_SIZE;
+    uint32_t last = (offset + length - 1) / BLOCK_SIZE;
+    uint32_t fb, want, run, old, k = 0;
     int32_t D;
-
-    uint32_t last_block_idx = target_inode->length / BLOCK_SIZE;                            // each data block takes 4kB
-    
-    uint32_t last_block_offset = target_inode->length % BLOCK_SIZE;                         // offset in given data block
-
-    if (target_inode->length == 0){
-        D = find_empty_block();
-        if (D == -1) {
-            printf("Oops! The file system is full right now!");
-            return bytes_written;
+    if (last + 1 >= FILE_BLOCKS(target_inode->length) && inline_unpack(inode) == -1) {
+        printf("Oops! The file system is full right now!\n");                                  // the tail needs a block before the write
+        return 0;
+    }
+    for (fb = first / COMPRESS_CLUSTER; fb <= last / COMPRESS_CLUSTER; fb++) {
+        if (cluster_unpack(inode, fb) == 0) continue;
+        printf("Oops! The file system is full right now!\n");
+        if (fb * COMPRESS_CLUSTER <= first) return 0;
+        length = fb * CLUSTER_SIZE - offset;                                                 // only write the clusters unpacked
+        last = (offset + length - 1) / BLOCK_SIZE;
+        break;
+    }
+    for (fb = first; fb <= last; fb += run) {
+        run = 1;
+        if (!block_needs_copy(inode_block_get(inode, fb, NULL))) continue;
+        for (want = 1; fb + want <= last && block_needs_copy(inode_block_get(inode, fb + want, NULL)); want++);
+        D = alloc_blocks(want, &run);
+        for (k = 0; D != -1 && k < run; k++) {
+            old = inode_block_get(inode, fb + k, NULL);
+            if (inode_block_set(inode, fb + k, D + k) == -1) break;                          // no block left for an indirect block
+            if ((fb + k == first && offset % BLOCK_SIZE != 0) || (fb + k == last && (offset + length) % BLOCK_SIZE != 0)) {
+                if (old == BLOCK_HOLE) data_write(D + k, 0, zeros, BLOCK_SIZE);                       // the bytes around the write read as zeros
+                else copy_block(D + k, old);                                                 // the bytes around the write keep the shared content
+            }
+            if (old != BLOCK_HOLE) free_block(old);                                          // drop this inode's reference to the shared block
+        }
+        extent_map_invalidate(inode);                                                        // blocks replaced holes or shared blocks
+        if (D == -1 || k < run) {
+            printf("Oops! The file system is full right now!\n");
+            fb += k;                                                                         // the blocks before fb have storage
+            for (; D != -1 && k < run; k++) free_block(D + k);
+            if (fb == first) return 0;
+            length = fb * BLOCK_SIZE - offset;                                               // only write what has blocks
+            break;
         }
-        target_inode->data_blocks[0] = D;
-        
-    } else {
-        D = target_inode->data_blocks[last_block_idx];                                 // index within data block array
     }
 
-    /* The start address of writing*/
-    uint8_t* write_ptr = data_block_ptr + BLOCK_SIZE*D + last_block_offset;                  // start reading data from this address
-    uint32_t left_len = BLOCK_SIZE - last_block_offset;                                      // how many bytes still need to copy in given data block
-
-    while (length > left_len){
-        length -= left_len;
-        memcpy(write_ptr, buf, left_len);
-        buf += left_len;
-        bytes_written += left_len;
-
-        int32_t new_D = find_empty_block();
-        if (new_D == -1) {
-            printf("Oops! The file system is full right now!");
-            return bytes_written;
-        }
-        target_inode->data_blocks[last_block_idx+1] = new_D;
-        write_ptr = data_block_ptr + BLOCK_SIZE*new_D;
-        left_len = BLOCK_SIZE;
+    uint32_t start = offset;
+    uint32_t block_offset, copy_len;
+    uint32_t block;
+    while (bytes_written < length) {
+        block_offset = offset % BLOCK_SIZE;                                                  // offset in given data block
 
+        /* write the whole run of consecutive data blocks at once */
+        run = extent_lookup(inode, offset / BLOCK_SIZE, &block);
+        if (!BLOCK_STORED(block)) break;
+        if (run > MAX_FILE_SIZE / BLOCK_SIZE) run = MAX_FILE_SIZE / BLOCK_SIZE;
+        copy_len = run * BLOCK_SIZE - block_offset;
+        if (copy_len > length - bytes_written) copy_len = length - bytes_written;
+        for (k = 0; k * BLOCK_SIZE < block_offset + copy_len; k++) dedup_forget(block + k);  // their fingerprints go stale
+        if (data_write(block, block_offset, buf, copy_len) == -1) break;
+        buf += copy_len;
+        offset += copy_len;
+        bytes_written += copy_len;
     }
-    
-    /* last block of data to read */
-    memcpy(write_ptr, buf, length);                                          
-    buf += length;
-    bytes_written += length;                                                                  // length is less than BLOCK_SIZE
-    target_inode->length += bytes_written;
+
+    if (offset > target_inode->length) target_inode->length = offset;
+    /* the blocks the write went past the end of are complete, share them if an identical one exists */
+    for (fb = start / BLOCK_SIZE; inode != DIR_INODE && fb < offset / BLOCK_SIZE; fb++) dedup_block(inode, fb);
+    inline_pack(inode);                                                                      // a short last block goes back in the inode
+    if (start < 4) update_exec_bit(inode);                                                    // the magic number was written
     return bytes_written;
 }
 
@@ -351,7 +2632,7 @@ int32_t write_data (uint32_t inode, const uint8_t* buf, uint32_t length)
  */
 int32_t file_read (int32_t fd, void* buf, int32_t nbytes)                                               
 {
-    pcb_t* cur_pcb_ptr = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));
+    pcb_t* cur_pcb_ptr = pcb_ptr[(uint8_t)cur_process];
     file_desc_t file_desc = cur_pcb_ptr->file_array[fd];
     
     int32_t bytes_copied = read_data(file_desc.inode, file_desc.file_position, buf, nbytes);                                                       // fd refers to inode index here, 0 means read from the start of file. **for cp2 only**
@@ -361,24 +2642,84 @@ int32_t file_read (int32_t fd, void* buf, int32_t nbytes)
 
 /**
  * file_write
- *  DESCRIPTION : do nothing and return -1
+ *  DESCRIPTION : append n bytes from the given buffer to the file of fd,
+ *                pwrite writes at a given offset instead
  *  INPUTS : int32_t fd - file descriptor
-             void* buf - the buffer that we are going to write to
+             void* buf - the buffer holding the bytes to write
              int32_t nbytes - the number of bytes that need to write
  *  OUTPUTS : none
- *  RETURN VALUE : -1 - always (for read-only)
- *  SIDE EFFECTS : none
+ *  RETURN VALUE : the number of bytes written
+                   -1 - fail to write data, or a process is executing the file
+ *  SIDE EFFECTS : grow the file
  * 
  */
 int32_t file_write(int32_t fd, const void* buf, int32_t nbytes)
 {
-    pcb_t* cur_pcb_ptr = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));
+    pcb_t* cur_pcb_ptr = pcb_ptr[(uint8_t)cur_process];
     file_desc_t file_desc = cur_pcb_ptr->file_array[fd];
 
-    int32_t bytes_written = write_data(file_desc.inode, buf, nbytes);
+    if (inode_in_use(file_desc.inode, 0)) return -1;                                                    // running images are paged in on demand
+    int32_t bytes_written = write_data(file_desc.inode, inode_ptr[file_desc.inode].length, buf, nbytes);     // writes append to the file
     return bytes_written;                                                                                  // always return -1(read only)
 }
 
+/**
+ * file_readv
+ *  DESCRIPTION : read the file of fd into a vector of buffers, in order,
+ *                starting at the position of fd
+ *  INPUTS : int32_t fd - file descriptor
+             const iovec_t* iov - the buffers to fill
+             int32_t iovcnt - the number of buffers
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes read, stops early at the end of the file
+                   -1 - fail to read data
+ *  SIDE EFFECTS : advance the position of fd
+ * 
+ */
+int32_t file_readv (int32_t fd, const iovec_t* iov, int32_t iovcnt)
+{
+    pcb_t* cur_pcb_ptr = pcb_ptr[(uint8_t)cur_process];
+    file_desc_t* file_desc = &cur_pcb_ptr->file_array[fd];
+    int32_t total = 0, bytes, i;
+
+    for (i = 0; i < iovcnt; i++) {
+        bytes = read_data(file_desc->inode, file_desc->file_position, iov[i].iov_base, iov[i].iov_len);
+        if (bytes == -1) return (total > 0) ? total : -1;
+        file_desc->file_position += bytes;
+        total += bytes;
+        if (bytes < (int32_t)iov[i].iov_len) break;                                                    // end of the file
+    }
+    return total;
+}
+
+/**
+ * file_writev
+ *  DESCRIPTION : append a vector of buffers to the file of fd, in order
+ *  INPUTS : int32_t fd - file descriptor
+             const iovec_t* iov - the buffers to write
+             int32_t iovcnt - the number of buffers
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes written, stops early if the file system is full
+                   -1 - fail to write data, or a process is executing the file
+ *  SIDE EFFECTS : grow the file
+ * 
+ */
+int32_t file_writev (int32_t fd, const iovec_t* iov, int32_t iovcnt)
+{
+    pcb_t* cur_pcb_ptr = pcb_ptr[(uint8_t)cur_process];
+    uint32_t inode = cur_pcb_ptr->file_array[fd].inode;
+    int32_t total = 0, bytes, i;
+
+    if (inode_in_use(inode, 0)) return -1;                                                              // running images are paged in on demand
+    for (i = 0; i < iovcnt; i++) {
+        bytes = write_data(inode, inode_ptr[inode].length, iov[i].iov_base, iov[i].iov_len);     // writes append to the file
+        if (bytes == -1) return (total > 0) ? total : -1;
+        total += bytes;
+        if (bytes < (int32_t)iov[i].iov_len) break;                                                    // the file system is full
+    }
+    return total;
+}
+
 /**
  * file_open
  *  DESCRIPTION : check whether we can open a file
@@ -424,13 +2765,14 @@ int32_t file_close (int32_t fd)
 int32_t dir_read (int32_t fd, void* buf, int32_t nbytes)
 {
     int ret;
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
     dentry_t dentry;
+    uint32_t dir = cur_pcb->file_array[fd].inode;                                             // DIR_INODE for the root
     /* subsequent reads until the last is reached, at which point read should repeatedly return 0.*/
-    if ((cur_pcb->file_array[fd].file_position == boot_block_ptr->num_dir_entries) || (cur_pcb->file_array[fd].file_position == MAX_FILES_NUMBER)){
+    if (cur_pcb->file_array[fd].file_position >= dir_entries(dir)){
         return 0;
     }
-    ret = read_dentry_by_index(cur_pcb->file_array[fd].file_position, &dentry);
+    ret = dir_entry_read(dir, cur_pcb->file_array[fd].file_position, &dentry);
     if (ret == -1) return -1;                                                 
     cur_pcb->file_array[fd].file_position += 1;
     uint32_t len = MAX_FILENAME_LEN;
@@ -439,37 +2781,69 @@ int32_t dir_read (int32_t fd, void* buf, int32_t nbytes)
     return len;
 }
 
+/**
+ * dir_getdents
+ *  DESCRIPTION : load as many directory records as fit into the given
+ *                buffer, starting at the position of fd, so that a whole
+ *                directory can be listed in one system call
+ *  INPUTS : int32_t fd - file descriptor of an open directory
+             void* buf - the buffer of dirent_t records
+             int32_t nbytes - the size of the buffer
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes filled, a multiple of sizeof(dirent_t)
+                   0 - the end of the directory is reached
+                   -1 - the buffer cannot hold one record
+ *  SIDE EFFECTS : advance the position of fd
+ * 
+ */
+int32_t dir_getdents (int32_t fd, void* buf, int32_t nbytes)
+{
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
+    uint32_t* position = &cur_pcb->file_array[fd].file_position;
+    uint32_t dir = cur_pcb->file_array[fd].inode;                                             // DIR_INODE for the root
+    dirent_t* record = (dirent_t*)buf;
+    dentry_t dentry;
+    stat_t st;
+    int32_t bytes = 0;
+    if (buf == NULL || nbytes < (int32_t)sizeof(dirent_t)) return -1;
+
+    while (*position < dir_entries(dir) && bytes + (int32_t)sizeof(dirent_t) <= nbytes) {
+        if (dir_entry_read(dir, *position, &dentry) == -1) break;
+        memcpy(record->file_name, dentry.file_name, MAX_FILENAME_LEN);
+        record->file_type = dentry.file_type;
+        record->inode = dentry.inode;
+        if (file_stat(dentry.file_type, dentry.inode, &st) == -1) st.length = st.blocks = 0;
+        record->length = st.length;                                                          // no stat needed by the caller
+        record->blocks = st.blocks;
+        record++;
+        bytes += sizeof(dirent_t);
+        (*position)++;
+    }
+    return bytes;
+}
+
 /**
  * dir_write
- *  DESCRIPTION : do nothing and return -1
+ *  DESCRIPTION : create an empty regular file named by the buffer in the
+ *                directory open on fd
  *  INPUTS : int32_t fd - file descriptor
-             void* buf - the buffer that we are going to write to
-             int32_t nbytes - the number of bytes that need to write
+             void* buf - the name of the new file
+             int32_t nbytes - the length of the name
  *  OUTPUTS : none
- *  RETURN VALUE : -1 - always (for read-only)
- *  SIDE EFFECTS : none
+ *  RETURN VALUE : 0 - the file is created
+                   -1 - see dir_create
+ *  SIDE EFFECTS : add a dentry to the directory
  * 
  */
 int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes)
 {
-    int i;
-    strcpy((int8_t*)dentry_ptr[boot_block_ptr->num_dir_entries].file_name, (int8_t*)buf);
-    dentry_ptr[boot_block_ptr->num_dir_entries].file_type = 2;
-    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++)
-    {
-        if(inode_array[i] == 0)
-        {
-            dentry_ptr[boot_block_ptr->num_dir_entries].inode = i;
-            inode_array[i] = 1;
-            break;
-        }
-    }
-    if(i == boot_block_ptr->num_dir_entries)
-    {
-        return -1;
-    }
-    boot_block_ptr->num_dir_entries++;
-    return 0;                                                                                  // Always return -1 (read-only)
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
+    uint8_t fname[MAX_FILENAME_LEN + 1] = {'\0'};                                              // leave 1 place for "\0"
+    if (buf == NULL || nbytes <= 0) return -1;
+    if (nbytes > MAX_FILENAME_LEN) nbytes = MAX_FILENAME_LEN;
+    strncpy((int8_t*)fname, (int8_t*)buf, nbytes);
+    if (dir_create(cur_pcb->file_array[fd].inode, fname, strlen((int8_t*)fname), 2) == -1) return -1;
+    return 0;
 }
 
 /**
@@ -477,7 +2851,7 @@ int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes)
  *  DESCRIPTION : check whether we can open a directory
  *  INPUTS : const uint8_t* filename - the name of the file we want to open
  *  OUTPUTS : none
- *  RETURN VALUE : 0 - there exists the directory that we want to open (we only use this since there is only one directory)
+ *  RETURN VALUE : 0 - there exists the directory that we want to open, open records its inode in the fd
                    -1 - there is no corresponding directory
  *  SIDE EFFECTS : none
  * 
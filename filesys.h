@@ -9,6 +9,41 @@
 #define RESERVED_BOOT_BLOCK  52
 #define RESERVED_DIR_ENTRY   24
 #define BLOCK_SIZE           4096
+#define DENTRY_HASH_SIZE     128                        // buckets of the name -> dentry index, must be a power of 2
+#define DENTRY_NONE          (-1)                       // end of a hash chain / name not found
+#define MAX_DATA_BLOCKS      4096                       // data blocks tracked by the free-block bitmap
+#define MAX_INODES           512                        // inodes tracked by the free-inode bitmap
+#define INODE_BITMAP_WORDS   (MAX_INODES / 32)          // 32 inodes per bitmap word
+#define BITMAP_WORDS         (MAX_DATA_BLOCKS / 32)     // 32 blocks per bitmap word
+#define MAX_EXTENTS          32                         // runs cached per inode, longer maps fall back to per-block reads
+#define EXTENT_CACHE_SIZE    64                         // direct-mapped extent cache slots, one per inode
+#define DIR_INODE            0                          // inode listing the directory blocks past the boot block
+#define DENTRIES_PER_BLOCK   (BLOCK_SIZE / 64)          // 64B dentries in a directory block
+#define MAX_DIR_BLOCKS       7                          // directory blocks after the boot block
+#define MAX_DIR_ENTRIES      (MAX_FILES_NUMBER + MAX_DIR_BLOCKS * DENTRIES_PER_BLOCK) // 63 + 7 * 64 = 511
+#define NUM_DIRECT_BLOCKS    ((BLOCK_SIZE/4) - 3)       // after the length and the two indirect pointers
+#define PTRS_PER_BLOCK       (BLOCK_SIZE/4)             // block numbers in an indirect block
+#define BLOCK_HOLE           0xFFFFFFFF                 // no storage, the block reads as zeros
+#define MAX_FILE_SIZE        0xFFFFFFFF                 // the length is 32 bits, the blocks could map more
+#define BLOCK_REF_MAX        255                        // extra references a shared data block can take
+#define BLOCK_PACKED         0xFFFFFFFE                 // no block of its own, the data is in the compressed stream of its cluster
+#define BLOCK_INLINE         0xFFFFFFFD                 // the last block of a small file, its bytes fill the direct entries after it
+#define INLINE_CAPACITY(FB)  ((NUM_DIRECT_BLOCKS - 1 - (FB)) * 4) // bytes after the direct entry FB
+#define COMPRESS_CLUSTER     8                          // file blocks compressed together
+#define CLUSTER_SIZE         (COMPRESS_CLUSTER * BLOCK_SIZE)
+#define CLUSTER_CACHE_SIZE   4                          // decompressed clusters kept for small reads
+#define DEDUP_HASH_SIZE      1024                       // buckets of the fingerprint -> data block table, must be a power of 2
+#define DEDUP_NONE           (-1)                       // end of a fingerprint chain / no identical block
+#define DCACHE_SIZE          128                        // slots of the (directory, name) -> dentry cache, must be a power of 2
+#define MAX_PATH_LEN         128                        // bytes of a path, '/' separated names
+#define MAX_DIR_DEPTH        8                          // nested directories filesys_init walks
+#define DIR_SCAN_CHUNK       16                         // subdirectory dentries read at once by a search
+#define SCRUB_STEP           1                          // data blocks the scrub checks each time a terminal polls for input
+#define MKFS_MAGIC           0x53464B4D                 // "MKFS", the image was built by tools/mkfs
+#define MKFS_SORTED          0x1                        // dentries are sorted by name
+#define MKFS_HASHES          0x2                        // dentries carry the hash of their name
+#define MKFS_BITMAP          0x4                        // the boot block carries the free-block bitmap
+#define MKFS_BITMAP_WORDS    (RESERVED_BOOT_BLOCK/4 - 2) // 11 words after mkfs_magic and mkfs_flags, 352 blocks
 
 
 
@@ -19,16 +54,19 @@ typedef struct dentry
     uint8_t file_name[MAX_FILENAME_LEN];
     uint32_t file_type;
     uint32_t inode;
-    uint32_t reserved[RESERVED_DIR_ENTRY/4];            // 24B = 4B * 6
+    uint32_t name_hash;                                 // FNV-1a hash of the name, filled by mkfs (MKFS_HASHES)
+    uint32_t reserved[RESERVED_DIR_ENTRY/4 - 1];        // 20B = 4B * 5
 
 } dentry_t;
 
 typedef struct boot_block
 {
-    uint32_t num_dir_entries;
+    uint32_t num_dir_entries;                          // dentries in the boot block, then in the blocks of DIR_INODE
     uint32_t num_inodes;
     uint32_t num_data_blocks;
-    uint32_t reserved[RESERVED_BOOT_BLOCK/4];          // 52B = 4B * 13
+    uint32_t mkfs_magic;                               // MKFS_MAGIC if tools/mkfs filled the fields below
+    uint32_t mkfs_flags;                               // which precomputed data the image holds
+    uint32_t free_bitmap[MKFS_BITMAP_WORDS];           // busy bits of the first data blocks (MKFS_BITMAP)
     dentry_t dir_entries[MAX_FILES_NUMBER];
 
 } boot_block_t;
@@ -36,28 +74,194 @@ typedef struct boot_block
 typedef struct inode
 {
     uint32_t length;
-    uint32_t data_blocks[(BLOCK_SIZE/4)-1];             // (4KB / 4B) - 1
+    uint32_t data_blocks[NUM_DIRECT_BLOCKS];            // (4KB / 4B) - 3
+    uint32_t single_indirect;                           // block of PTRS_PER_BLOCK data block numbers
+    uint32_t double_indirect;                           // block of PTRS_PER_BLOCK single indirect blocks
 
 } inode_t;
 
+/* one record returned by getdents */
+typedef struct dirent
+{
+    uint8_t  file_name[MAX_FILENAME_LEN];               // not NUL terminated when it takes all 32 bytes
+    uint32_t file_type;
+    uint32_t inode;
+    uint32_t length;                                    // as in stat_t
+    uint32_t blocks;                                    // as in stat_t
+} dirent_t;
+
+/* file metadata returned by stat and fstat */
+typedef struct stat
+{
+    uint32_t file_type;                                 // 0 rtc, 1 directory, 2 regular file
+    uint32_t inode;
+    uint32_t length;                                    // bytes of a file, of the dentries of a directory, 0 for rtc
+    uint32_t blocks;                                    // data blocks stored, holes and indirect blocks excluded
+} stat_t;
+
+/* a run of consecutive data blocks backing consecutive file blocks */
+typedef struct extent
+{
+    uint32_t file_block;                                // first block index within the file
+    uint32_t data_block;                                // first data block number
+    uint32_t count;                                     // number of blocks in the run
+} extent_t;
+
+/* extents of one inode, built lazily on first read */
+typedef struct extent_map
+{
+    uint32_t inode;                                     // inode this map belongs to
+    uint32_t valid;                                     // 1 if the map matches the inode
+    uint32_t num_extents;                               // number of runs in extents[]
+    uint32_t num_blocks;                                // file blocks covered by extents[]
+    extent_t extents[MAX_EXTENTS];
+} extent_map_t;
+
+/* one decompressed cluster of the cluster cache */
+typedef struct cluster_buf
+{
+    uint32_t inode;                                     // inode the cluster belongs to
+    uint32_t cluster;                                   // first file block / COMPRESS_CLUSTER
+    uint32_t valid;                                     // 1 if the slot holds a cluster
+    uint32_t last_use;                                  // LRU stamp
+} cluster_buf_t;
+
+/* access counters of the cluster cache */
+typedef struct cluster_stats
+{
+    uint32_t hits;                                      // reads served from a decompressed cluster
+    uint32_t misses;                                    // clusters that had to be decompressed
+    uint32_t unpacks;                                   // clusters stored back uncompressed before a write
+} cluster_stats_t;
+
+extern cluster_stats_t cluster_stats;
+
+/* counters of the block deduplication */
+typedef struct dedup_stats
+{
+    uint32_t hashed;                                    // blocks fingerprinted
+    uint32_t merged;                                    // blocks that became a reference to an identical block
+    uint32_t zeroed;                                    // blocks of zeros that became holes
+    uint32_t collisions;                                // equal fingerprints of different blocks
+    uint32_t bytes_saved;                               // BLOCK_SIZE for each block merged or zeroed
+} dedup_stats_t;
+
+extern dedup_stats_t dedup_stats;
+
+/* counters of the data block checksums */
+typedef struct crc_stats
+{
+    uint32_t computed;                                  // checksums computed after a write
+    uint32_t verified;                                  // blocks checked against their checksum
+    uint32_t cached;                                    // reads of blocks checked before, not checked again
+    uint32_t bad;                                       // blocks that did not match their checksum
+    uint32_t scrubbed;                                  // blocks the scrub checked
+    uint32_t passes;                                    // scrub passes over the whole image
+} crc_stats_t;
+
+extern crc_stats_t crc_stats;
+extern uint32_t crc_verify_reads;                       // 1 to check the blocks read_data copies
+
+/* one slot of the dentry cache, a negative slot remembers a missing name */
+typedef struct dcache_entry
+{
+    uint32_t parent;                                    // inode of the directory holding the name
+    uint32_t valid;                                     // 1 if the slot holds a lookup
+    uint32_t negative;                                  // 1 if the name does not exist in parent
+    dentry_t dentry;                                    // the dentry found, or just the name if negative
+} dcache_entry_t;
+
+/* counters of the dentry cache */
+typedef struct dcache_stats
+{
+    uint32_t hits;                                      // lookups of an existing name served by the cache
+    uint32_t negative_hits;                             // lookups of a missing name served by the cache
+    uint32_t misses;                                    // lookups that had to search the directory
+    uint32_t evictions;                                 // slots taken over by another name
+} dcache_stats_t;
+
+extern dcache_stats_t dcache_stats;
+
 /* Define the pointer to above structure*/
 boot_block_t* boot_block_ptr;
 inode_t*      inode_ptr;
 dentry_t*     dentry_ptr;
 uint8_t*      data_block_ptr;
-char          all_file_names[MAX_FILES_NUMBER][MAX_FILENAME_LEN];
-int inode_array[64];
+char          all_file_names[MAX_DIR_ENTRIES][MAX_FILENAME_LEN];
+extern uint32_t data_blocks_bitmap[BITMAP_WORDS];       // 1 bit per data block, set means busy
 
 /* Routines provided by file system module */
 
-/* read the dentry corresponding to the filename*/
+/* read the dentry corresponding to the filename, a '/' separated path */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
+/* read the dentry of the first len bytes of a path */
+int32_t path_lookup (const uint8_t* path, uint32_t len, dentry_t* dentry);
+/* forget every cached lookup */
+void dcache_flush (void);
+/* hit rate of the dentry cache in percent */
+uint32_t dcache_hit_rate (void);
+/* number of dentries in a directory */
+uint32_t dir_entries (uint32_t dir);
+/* read the dentry at the given index of a directory */
+int32_t dir_entry_read (uint32_t dir, uint32_t index, dentry_t* dentry);
+/* build the name -> dentry hash index over the whole directory */
+void dentry_index_build (void);
+/* add the dentry at the given index to the hash index */
+void dentry_index_insert (uint32_t index);
+/* drop the dentry at the given index from the hash index */
+void dentry_index_remove (uint32_t index);
+/* return the index of the dentry named fname, or DENTRY_NONE */
+int32_t dentry_index_lookup (const uint8_t* fname);
+/* build the index of the dentries sorted by name */
+void name_index_build (void);
+/* add the dentry at the given index to the sorted name index */
+void name_index_insert (uint32_t index);
+/* drop a dentry from the sorted name index, renumbering the one moved into its slot */
+void name_index_remove (uint32_t index, uint32_t moved_from);
+/* count the names starting with prefix, and give the first one */
+uint32_t name_index_prefix (const uint8_t* prefix, uint32_t len, uint32_t* index);
+/* drop the cached extent map and block count of an inode after its blocks change */
+void extent_map_invalidate (uint32_t inode);
+/* remove the dentry at the given index from the directory */
+int32_t delete_dentry (uint32_t index);
+/* create an empty regular file, return its dentry index */
+int32_t create_file (const uint8_t* fname);
+/* create an empty directory, return its dentry index */
+int32_t make_dir (const uint8_t* dname);
+/* remove a file or an empty directory and free its inode and data blocks */
+int32_t unlink_file (const uint8_t* fname);
 /* read the dentry corresponding to the inode*/
 int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
 /* read up to length bytes starting from position offset in the file with number inode*/
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+/* number of data blocks a file stores, holes and indirect blocks excluded */
+uint32_t inode_data_blocks (uint32_t inode);
+/* type, inode, length and block count of a file, from its inode alone */
+int32_t file_stat (uint32_t file_type, uint32_t inode, stat_t* buf);
+/* check the next data blocks against their checksums, return the corrupted ones */
+uint32_t filesys_scrub (uint32_t count);
+/* address of the data block backing a file block, referenced until unmapped, NULL if it cannot be mapped */
+uint8_t* map_file_block (uint32_t inode, uint32_t file_block);
+/* one more reference on a mapped block, -1 if it has too many */
+int32_t dup_file_block (uint8_t* addr);
+/* drop the reference of a mapping, the block is freed once no file uses it */
+void unmap_file_block (uint8_t* addr);
+/* allocate up to want contiguous free data blocks */
+int32_t alloc_blocks (uint32_t want, uint32_t* count);
+/* return a data block to the free-block bitmap */
+void free_block (uint32_t block);
+/* take a free inode from the free-inode bitmap */
+int32_t alloc_inode (void);
+/* return an inode to the free-inode bitmap */
+void free_inode (uint32_t inode);
+/* 1 if the file starts with the ELF magic number, from a cached bit */
+int32_t is_executable (uint32_t inode);
+/* make a file share the data blocks of another one, copy on write */
+int32_t clone_data (uint32_t src_inode, uint32_t dst_inode);
+/* shrink or grow a file to length bytes */
+int32_t truncate_data (uint32_t inode, uint32_t length);
 /* write up to length bytes starting from position offset in the file with number inode*/
-int32_t write_data (uint32_t inode, const uint8_t* buf, uint32_t length);
+int32_t write_data (uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
 
 
 /* file operation functions */
@@ -66,6 +270,10 @@ void filesys_init (uint32_t filesys_addr);
 int32_t file_read (int32_t fd, void* buf, int32_t nbytes);
 /* do nothing and return -1 */
 int32_t file_write(int32_t fd, const void* buf, int32_t nbytes);
+/* read the file into a vector of buffers */
+int32_t file_readv (int32_t fd, const iovec_t* iov, int32_t iovcnt);
+/* append a vector of buffers to the file */
+int32_t file_writev (int32_t fd, const iovec_t* iov, int32_t iovcnt);
 /* initialize any temporary sturctures, return 0 */
 int32_t file_open (const uint8_t* filename);
 /* undo what was done in the open function, return 0 */
@@ -73,7 +281,9 @@ int32_t file_close (int32_t fd);
 
 /* read files filename by filename, including "." */
 int32_t dir_read (int32_t fd, void* buf, int32_t nbytes);
-/* do nothing and return -1 */
+/* fill buf with as many directory records as fit */
+int32_t dir_getdents (int32_t fd, void* buf, int32_t nbytes);
+/* create an empty regular file named by buf in the directory */
 int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes);
 /* open a directory file, return 0 */
 int32_t dir_open (const uint8_t* filename);
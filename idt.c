@@ -1,6 +1,7 @@
 #include "idt.h"
 #include "handler.h"
 #include "system_call.h"
+#include "paging.h"
 
 /* gate types */
 uint32_t trap_gate = 0xF;
@@ -144,6 +145,11 @@ init_idt(void){
  */
 void
 exception_handler(reg_t regs, uint32_t ds, uint32_t es, uint32_t fs, uint32_t excep_num, uint32_t error){
+    if(excep_num == PAGE_FAULT){
+        uint32_t fault_addr;
+        asm volatile("movl %%cr2, %0" : "=r"(fault_addr));
+        if(demand_page_fault(fault_addr) == 0) return;                      // lazily loaded program page, restart the instruction
+    }
     clear();
     printf("EXCEPTION(%d): %s\n", excep_num, EXCEPTION_NAME[excep_num]);
     exception_flag = 1;
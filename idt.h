@@ -5,6 +5,7 @@
 #include "lib.h"
 
 #define NUM_EXCEPTION   20
+#define PAGE_FAULT      14
 #define DPL_KERNEL      0
 #define DPL_USER        3
 #define PIT_VEC         0x20
@@ -15,6 +15,7 @@
 #include "paging.h"
 #include "filesys.h"
 #include "pit.h"
+#include "buddy.h"
 // #include "gtk/gtk.h"
 
 #define RUN_TESTS
@@ -155,6 +156,7 @@ void entry(unsigned long magic, unsigned long addr) {
 
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
+    buddy_init(mbi);                                        // before anything allocates, while memory is still unpaged
     filesys_init(filesys_addr);
     keyboard_init();
     rtc_init();
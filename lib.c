@@ -6,6 +6,7 @@
 #include "system_call.h"
 
 #define VIDEO       0xB8000
+#define PUTBUF_CHUNK 256                                    // characters putbuf prints per cli
 
 static int screen_x;
 static int screen_y;
@@ -220,18 +221,17 @@ int32_t puts_intr(int8_t* s) {
 }
 
 /**
- * putc
- *  DESCRIPTION : Output a character to the console. For user program.
- *  INPUTS : a character to print.
+ * putc_locked
+ *  DESCRIPTION : Output a character to the screen of a terminal, without
+ *                taking cli or moving the cursor. The caller does both once.
+ *  INPUTS : c -- a character to print.
+ *           term_id -- the terminal whose screen position is used.
  *  OUTPUTS : the input character.
  *  RETURN VALUE : none.
  *  SIDE EFFECTS : print the char on the terminal screen.
  */
-void putc(uint8_t c) {
-    uint32_t flags;
-    cli_and_save(flags);                                    // avoid being interrupted by pit and executing scheduling
-    uint8_t term_id = sche_term;
-    uint8_t attrib = ATTRIB[sche_term];
+static void putc_locked(uint8_t c, uint8_t term_id) {
+    uint8_t attrib = ATTRIB[term_id];
 
     screen_x = multi_terms[term_id].x;
     screen_y = multi_terms[term_id].y;
@@ -291,10 +291,60 @@ void putc(uint8_t c) {
     }
     multi_terms[term_id].x = screen_x;
     multi_terms[term_id].y = screen_y;
-    
+}
+
+/**
+ * putc
+ *  DESCRIPTION : Output a character to the console. For user program.
+ *  INPUTS : a character to print.
+ *  OUTPUTS : the input character.
+ *  RETURN VALUE : none.
+ *  SIDE EFFECTS : print the char on the terminal screen.
+ */
+void putc(uint8_t c) {
+    uint32_t flags;
+    cli_and_save(flags);                                    // avoid being interrupted by pit and executing scheduling
+    uint8_t term_id = sche_term;
+    putc_locked(c, term_id);
+
     // if the terminal index is current terminal. update the cursor location.
     if(sche_term == cur_terminal){
-        update_cursor(screen_x ,screen_y);
+        update_cursor(multi_terms[term_id].x, multi_terms[term_id].y);
+    }
+
+    restore_flags(flags);
+}
+
+/**
+ * putbuf
+ *  DESCRIPTION : Output n characters to the console with a single cursor update.
+ *                cli is taken per PUTBUF_CHUNK characters, so a long write does not
+ *                hold off the pit and the rtc. NUL bytes are skipped. For user program.
+ *  INPUTS : buf -- the characters to print.
+ *           n -- the number of characters.
+ *  OUTPUTS : the input characters.
+ *  RETURN VALUE : none.
+ *  SIDE EFFECTS : print the chars on the terminal screen.
+ */
+void putbuf(const uint8_t* buf, uint32_t n) {
+    uint32_t flags;
+    uint32_t i = 0, end;
+    uint8_t term_id;
+    while (i < n) {
+        end = (n - i > PUTBUF_CHUNK) ? i + PUTBUF_CHUNK : n;
+        cli_and_save(flags);                                // avoid being interrupted by pit and executing scheduling
+        term_id = sche_term;
+        for (; i < end; i++) {
+            if (buf[i] != 0x0) putc_locked(buf[i], term_id);    // not print the NULL bytes.
+        }
+        restore_flags(flags);                               // let the pit and the rtc in between chunks
+    }
+
+    // if the terminal index is current terminal. update the cursor location.
+    cli_and_save(flags);
+    term_id = sche_term;
+    if(sche_term == cur_terminal){
+        update_cursor(multi_terms[term_id].x, multi_terms[term_id].y);
     }
 
     restore_flags(flags);
@@ -727,6 +777,23 @@ int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n) {
     return 0;
 }
 
+/* int32_t memcmp(const void* s1, const void* s2, uint32_t n)
+ * Inputs: const void* s1 = first buffer to compare
+ *         const void* s2 = second buffer to compare
+ *               uint32_t n = number of bytes to compare
+ * Return Value: zero if the n bytes are equal, otherwise the difference
+ *               of the first pair of bytes that differ, as unsigned bytes
+ * Function: compares two buffers, unlike strncmp it does not stop at '\0' */
+int32_t memcmp(const void* s1, const void* s2, uint32_t n) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (a[i] != b[i]) return a[i] - b[i];
+    }
+    return 0;
+}
+
 /* int8_t* strcpy(int8_t* dest, const int8_t* src)
  * Inputs:      int8_t* dest = destination string of copy
  *         const int8_t* src = source string of copy
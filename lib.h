@@ -26,6 +26,7 @@ extern uint8_t rainbow_ptr[NUM_TERMINAL];
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
+void putbuf(const uint8_t* buf, uint32_t n);
 int32_t puts(int8_t *s);
 int32_t puts_intr(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
@@ -44,6 +45,7 @@ void* memset_dword(void* s, int32_t c, uint32_t n);
 void* memcpy(void* dest, const void* src, uint32_t n);
 void* memmove(void* dest, const void* src, uint32_t n);
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
+int32_t memcmp(const void* s1, const void* s2, uint32_t n);
 int8_t* strcpy(int8_t* dest, const int8_t*src);
 int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 void test_interrupts(void);
@@ -177,4 +179,16 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Index of the lowest set bit of "word" (bsf).  The result is
+ * undefined when word is 0, so callers must check first */
+static inline uint32_t find_first_set(uint32_t word) {
+    uint32_t index;
+    asm volatile ("bsfl %1, %0"
+            : "=r"(index)
+            : "rm"(word)
+            : "cc"
+    );
+    return index;
+}
+
 #endif /* _LIB_H */
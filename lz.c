@@ -0,0 +1,76 @@
+#include "lz.h"
+#include "lib.h"
+
+/**
+ * lz_length
+ *  DESCRIPTION : read the extra bytes of a length field that holds 15
+ *  INPUTS : const uint8_t** ip - the read position, moved past the bytes
+ *           const uint8_t* iend - the end of the stream
+ *           uint32_t* len - the length to add the bytes to
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 - success, -1 - the stream ends inside the field
+ *  SIDE EFFECTS : none
+ */
+static int32_t lz_length (const uint8_t** ip, const uint8_t* iend, uint32_t* len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * lz_decompress
+ *  DESCRIPTION : decode an LZ4 block. Every length and offset is checked
+ *                against both buffers, a corrupted stream cannot write
+ *                outside dst.
+ *  INPUTS : const uint8_t* src - the compressed stream
+ *           uint32_t src_len - the bytes in the stream
+ *           uint8_t* dst - the output buffer
+ *           uint32_t dst_cap - the size of the output buffer
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes produced
+ *                 -1 - the stream is corrupted or does not fit in dst
+ *  SIDE EFFECTS : fill dst
+ */
+int32_t lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+    const uint8_t* match;
+    uint32_t token, len, offset;
+
+    while (ip < iend) {
+        token = *ip++;
+        /* literals */
+        len = token >> 4;
+        if (len == 15 && lz_length(&ip, iend, &len) == -1) return -1;
+        if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op)) return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend) break;                                                               // the last sequence has no match
+
+        /* match */
+        if (iend - ip < 2) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) return -1;
+        len = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15 && lz_length(&ip, iend, &len) == -1) return -1;
+        if (len > (uint32_t)(oend - op)) return -1;
+        match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);                                                          // no overlap
+            op += len;
+        } else {
+            while (len--) *op++ = *match++;                                                  // a run repeating the last offset bytes
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "types.h"
+
+/* Macro numbers */
+#define LZ_MIN_MATCH         4                          // shortest match a sequence can hold
+#define LZ_MAX_OFFSET        65535                      // farthest back a match can start, 16 bits
+
+/*
+ * LZ4 block format, one sequence after another:
+ *   token        high 4 bits literal count, low 4 bits match length - LZ_MIN_MATCH,
+ *                15 in a field means more 255-saturated length bytes follow
+ *   literals     copied as they are
+ *   offset       16 bits little endian, distance back to the match
+ * the last sequence stops after its literals.
+ */
+
+/* decompress src_len bytes of src into dst, return the bytes produced or -1 on a bad stream */
+int32_t lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif
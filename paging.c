@@ -1,6 +1,10 @@
 #include "paging.h"
 #include "system_call.h"
 #include "lib.h"
+#include "buddy.h"
+#include "filesys.h"
+
+static uint8_t frame_shares[BUDDY_NUM_FRAMES];                                      // page tables mapping a user frame, besides the first
 
 /**
  * paging_init
@@ -27,6 +31,7 @@ void paging_init(void)
     page_dir[1].present = 1;
     page_dir[1].read_write = 1;
     page_dir[1].page_size = 1;                                              // 4MB kernel
+    page_dir[1].global_page = 1;                                            // same in every page directory, kept across CR3 loads
     page_dir[1].base_addr = KERNEL_START_ADDR / PAGE_SIZE;                  // Find the 20-bit address, which is the 
     
     //Initialize other directory entries
@@ -35,6 +40,12 @@ void paging_init(void)
         memset(&page_dir[i], 0, sizeof(page_dir[i]));
         page_dir[i].read_write = 1;
         page_dir[i].page_size = 1; 
+        if(i >= BUDDY_START / PAGE_SIZE_4M && i < BUDDY_END / PAGE_SIZE_4M)
+        {
+            page_dir[i].present = 1;                                        // memory of the buddy allocator, kernel only
+            page_dir[i].global_page = 1;
+            page_dir[i].base_addr = i * (PAGE_SIZE_4M / PAGE_SIZE);         // mapped 1:1
+        }
     }
 
     //Initialize table entries for 0-4M 
@@ -44,6 +55,7 @@ void paging_init(void)
         if( i == (VMEM_START_ADDR >> 12) || i == (BACK_VID_1 >> 12) || i == (BACK_VID_2 >> 12) || i == (BACK_VID_3 >> 12))    // the index of video memory page and background video mem page                                                     
         {
             page_tbl[i].present = 1;                                        // If it is video memory, set present to 1
+            page_tbl[i].global_page = 1;                                    // remapped with invlpg, see update_video_mem_paging
         }
         else page_tbl[i].present = 0;                                       // Else set it to 0
 
@@ -53,3 +65,275 @@ void paging_init(void)
     load_page_directory((uint32_t)page_dir);
     enable_paging();
 }
+
+/**
+ * user_page_table
+ *  DESCRIPTION : find the 4KB page table behind a 4MB user region of a page directory
+ *  INPUTS : dir -- the page directory of a process
+ *           virt_addr -- an address inside the region
+ *  OUTPUTS : none
+ *  RETURN VALUE : the page table, NULL if the region is not mapped by a page table
+ *  SIDE EFFECTS : none
+ */
+page_table_entry_t* user_page_table(page_directory_entry_t* dir, uint32_t virt_addr)
+{
+    page_directory_entry_t* pde = &dir[virt_addr / PAGE_SIZE_4M];
+    if(!pde->present || pde->page_size) return NULL;
+    return (page_table_entry_t*)(pde->base_addr * PAGE_SIZE);             // page tables come from the buddy allocator, mapped 1:1
+}
+
+/**
+ * set_user_table
+ *  DESCRIPTION : point a 4MB user region of a page directory at a page table
+ *  INPUTS : dir -- the page directory
+ *           virt_addr -- the start of the region
+ *           tbl -- the page table
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : overwrite the directory entry
+ */
+static void set_user_table(page_directory_entry_t* dir, uint32_t virt_addr, page_table_entry_t* tbl)
+{
+    page_directory_entry_t* pde = &dir[virt_addr / PAGE_SIZE_4M];
+    memset(pde, 0, sizeof(*pde));
+    pde->present = 1;
+    pde->read_write = 1;                                                    // the PTEs decide, mapped file pages are read-only
+    pde->user_sup = 1;                                                      // user accessible
+    pde->base_addr = (uint32_t)tbl / PAGE_SIZE;
+}
+
+/**
+ * alloc_user_paging
+ *  DESCRIPTION : allocate a page directory whose kernel entries are copies of page_dir, so the
+ *                kernel page tables are shared, with empty 4KB page tables for the user program
+ *                and mmap regions, all from the buddy allocator
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : the page directory, NULL if no memory is left
+ *  SIDE EFFECTS : allocate three pages
+ */
+static page_directory_entry_t* alloc_user_paging(void)
+{
+    page_directory_entry_t* dir = (page_directory_entry_t*)buddy_alloc(0);
+    page_table_entry_t* tbl = (page_table_entry_t*)buddy_alloc(0);
+    page_table_entry_t* mmap_tbl = (page_table_entry_t*)buddy_alloc(0);
+    if(dir == NULL || tbl == NULL || mmap_tbl == NULL)
+    {
+        if(dir != NULL) buddy_free((uint32_t)dir);
+        if(tbl != NULL) buddy_free((uint32_t)tbl);
+        if(mmap_tbl != NULL) buddy_free((uint32_t)mmap_tbl);
+        return NULL;
+    }
+    memcpy(dir, page_dir, sizeof(page_dir));                                // page_dir maps the kernel only and never changes after paging_init
+    memset(tbl, 0, PAGE_SIZE);
+    memset(mmap_tbl, 0, PAGE_SIZE);                                         // no file is mapped yet
+    set_user_table(dir, user_virt_addr, tbl);
+    set_user_table(dir, user_mmap_addr, mmap_tbl);
+    return dir;
+}
+
+/**
+ * init_user_paging
+ *  DESCRIPTION : build the address space of a new process, see alloc_user_paging.
+ *                No program page has a frame yet, each one gets a 4KB frame on first touch,
+ *                see demand_page_fault. Pages holding the executable image are marked lazy and
+ *                read from the filesystem, the others are zero filled.
+ *  INPUTS : image_len -- the length of the executable, loaded at user_img_addr
+ *  OUTPUTS : none
+ *  RETURN VALUE : the page directory, NULL if no memory is left
+ *  SIDE EFFECTS : allocate three pages
+ */
+page_directory_entry_t* init_user_paging(uint32_t image_len)
+{
+    uint32_t i;
+    uint32_t first_image_page = (user_img_addr - user_virt_addr) / PAGE_SIZE;
+    uint32_t end_image_page = first_image_page + (image_len + PAGE_SIZE - 1) / PAGE_SIZE;
+    page_directory_entry_t* dir = alloc_user_paging();
+    if(dir == NULL) return NULL;
+    page_table_entry_t* tbl = user_page_table(dir, user_virt_addr);
+    for(i = 0; i < DIR_TBL_SIZE; i++)
+    {
+        tbl[i].read_write = 1;
+        tbl[i].user_sup = 1;                                                // user accessible
+        if(i >= first_image_page && i < end_image_page) tbl[i].available = PTE_LAZY;
+        else tbl[i].available = PTE_ZERO;                                   // stack, heap and the space below the image
+    }
+    return dir;
+}
+
+/**
+ * fork_user_paging
+ *  DESCRIPTION : build the address space of a forked process. Program pages with a frame are
+ *                shared: both page tables map the frame read-only and marked copy on write, the
+ *                first write on either side copies it, see demand_page_fault. Pages without a frame
+ *                fault in on their own in each process. Mapped files and the video page are shared,
+ *                each mapped file block takes one more reference.
+ *  INPUTS : parent -- the page directory of the forking process
+ *  OUTPUTS : none
+ *  RETURN VALUE : the page directory, NULL if no memory is left or a mapped block has too many references
+ *  SIDE EFFECTS : make the program pages of parent read-only, the caller reloads CR3
+ */
+page_directory_entry_t* fork_user_paging(page_directory_entry_t* parent)
+{
+    uint32_t i;
+    uint32_t video_dir_idx = user_video_addr / PAGE_SIZE_4M;
+    page_directory_entry_t* dir = alloc_user_paging();
+    if(dir == NULL) return NULL;
+    page_table_entry_t* tbl = user_page_table(dir, user_virt_addr);
+    page_table_entry_t* parent_tbl = user_page_table(parent, user_virt_addr);
+    page_table_entry_t* mmap_tbl = user_page_table(dir, user_mmap_addr);
+    page_table_entry_t* parent_mmap_tbl = user_page_table(parent, user_mmap_addr);
+    for(i = 0; i < DIR_TBL_SIZE; i++)
+    {
+        if(!parent_mmap_tbl[i].present) continue;
+        if(dup_file_block((uint8_t*)(parent_mmap_tbl[i].base_addr * PAGE_SIZE)) == -1) break;
+        mmap_tbl[i] = parent_mmap_tbl[i];
+    }
+    if(i < DIR_TBL_SIZE)
+    {
+        free_user_paging(dir);                                              // drops the references taken so far
+        return NULL;
+    }
+    for(i = 0; i < DIR_TBL_SIZE; i++)
+    {
+        if(parent_tbl[i].present)
+        {
+            parent_tbl[i].read_write = 0;
+            parent_tbl[i].available = PTE_COW;
+            frame_shares[(parent_tbl[i].base_addr * PAGE_SIZE - BUDDY_START) / PAGE_SIZE]++;
+        }
+        tbl[i] = parent_tbl[i];
+    }
+    dir[video_dir_idx] = parent[video_dir_idx];                             // vidmap of the parent stays mapped
+    return dir;
+}
+
+/**
+ * free_user_paging
+ *  DESCRIPTION : give the address space of a process back to the buddy allocator:
+ *                every frame of the program region no other process shares, the page tables
+ *                and the page directory. The video page table is shared. Mapped file blocks
+ *                belong to the filesystem, only their references are dropped.
+ *  INPUTS : dir -- the page directory of the process being halted
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : dir must not be in CR3 anymore
+ */
+void free_user_paging(page_directory_entry_t* dir)
+{
+    uint32_t i, frame;
+    page_table_entry_t* tbl = user_page_table(dir, user_virt_addr);
+    page_table_entry_t* mmap_tbl = user_page_table(dir, user_mmap_addr);
+    for(i = 0; i < DIR_TBL_SIZE; i++)
+    {
+        if(!tbl[i].present) continue;
+        frame = (tbl[i].base_addr * PAGE_SIZE - BUDDY_START) / PAGE_SIZE;
+        if(frame_shares[frame] > 0) frame_shares[frame]--;                  // still mapped by a forked process
+        else buddy_free(tbl[i].base_addr * PAGE_SIZE);
+    }
+    for(i = 0; i < DIR_TBL_SIZE; i++)
+    {
+        if(mmap_tbl[i].present) unmap_file_block((uint8_t*)(mmap_tbl[i].base_addr * PAGE_SIZE));
+    }
+    buddy_free((uint32_t)tbl);
+    buddy_free((uint32_t)mmap_tbl);
+    buddy_free((uint32_t)dir);
+}
+
+/**
+ * set_user_paging
+ *  DESCRIPTION : switch to the address space of a process with a single CR3 load,
+ *                which also drops the TLB entries of the previous one
+ *  INPUTS : pid -- the process whose address space becomes visible
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : load CR3
+ */
+void set_user_paging(uint8_t pid)
+{
+    load_page_directory((uint32_t)pcb_ptr[pid]->pgdir);
+}
+
+/**
+ * demand_page_fault
+ *  DESCRIPTION : back a page of the running program that has no frame yet with a 4KB frame
+ *                from the buddy allocator. A lazy page is filled from the executable, the bytes
+ *                past the end of the file in the last image page are zeroed. Other pages are zeroed.
+ *                A write to a copy on write page copies it unless no other process maps it anymore.
+ *  INPUTS : fault_addr -- the faulting linear address (CR2)
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 if the page was filled and the faulting instruction can be restarted
+ *                 -1 if the fault is not a lazy, zero filled or copy on write program page,
+ *                    i.e. a real page fault, or no frame is left
+ *  SIDE EFFECTS : make the page present and count image pages in the pcb
+ */
+int32_t demand_page_fault(uint32_t fault_addr)
+{
+    if(cur_process < 0) return -1;
+    if(fault_addr < user_virt_addr || fault_addr >= user_virt_addr + PAGE_SIZE_4M) return -1;
+    uint32_t page = (fault_addr - user_virt_addr) / PAGE_SIZE;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
+    page_table_entry_t* pte = &user_page_table(cur_pcb->pgdir, user_virt_addr)[page];
+    uint8_t* page_addr = (uint8_t*)(user_virt_addr + page * PAGE_SIZE);
+    uint32_t frame;
+    if(pte->present)
+    {
+        if(pte->available != PTE_COW) return -1;                            // a write to a page that is read-only for real
+        uint32_t shared = (pte->base_addr * PAGE_SIZE - BUDDY_START) / PAGE_SIZE;
+        if(frame_shares[shared] > 0)                                        // the other process still maps it, copy
+        {
+            frame = buddy_alloc(0);
+            if(frame == 0) return -1;
+            memcpy((void*)frame, (void*)(pte->base_addr * PAGE_SIZE), PAGE_SIZE);   // frames are mapped 1:1 for the kernel
+            frame_shares[shared]--;
+            pte->base_addr = frame / PAGE_SIZE;
+        }
+        pte->available = 0;
+        pte->read_write = 1;                                                // the last one keeps the frame
+        invlpg(page_addr);
+        return 0;
+    }
+    if(pte->available != PTE_LAZY && pte->available != PTE_ZERO) return -1;
+    frame = buddy_alloc(0);
+    if(frame == 0) return -1;                                               // out of memory, the program is killed
+
+    int32_t bytes = 0;
+    uint32_t lazy = (pte->available == PTE_LAZY);
+    pte->available = 0;
+    pte->base_addr = frame / PAGE_SIZE;
+    pte->present = 1;
+    invlpg(page_addr);
+
+    if(lazy)
+    {
+        bytes = read_data(cur_pcb->exe_inode, (uint32_t)page_addr - user_img_addr, page_addr, PAGE_SIZE);
+        if(bytes < 0) bytes = 0;
+        cur_pcb->faulted_pages++;
+    }
+    memset(page_addr + bytes, 0, PAGE_SIZE - bytes);                        // past the end of the file
+    return 0;
+}
+
+/**
+ * fault_in_user_range
+ *  DESCRIPTION : fill the lazy and zero filled pages of a user buffer up front. Filling a lazy
+ *                page reads the executable through the block cache, so the fault must not
+ *                happen in the middle of a block cache copy that holds a pool buffer.
+ *  INPUTS : buf -- the start of the buffer
+ *           nbytes -- the length of the buffer, nothing is done if it is not positive
+ *  OUTPUTS : none
+ *  RETURN VALUE : none
+ *  SIDE EFFECTS : make the pages of the buffer inside the program region present
+ */
+void fault_in_user_range(const void* buf, int32_t nbytes)
+{
+    uint32_t addr = (uint32_t)buf & ~(PAGE_SIZE - 1);
+    uint32_t end = (uint32_t)buf + nbytes;
+    if(cur_process < 0 || nbytes <= 0) return;
+    page_table_entry_t* tbl = user_page_table(pcb_ptr[(uint8_t)cur_process]->pgdir, user_virt_addr);
+    if(tbl == NULL) return;
+    if(addr < user_virt_addr) addr = user_virt_addr;
+    if(end > user_virt_addr + PAGE_SIZE_4M || end < (uint32_t)buf) end = user_virt_addr + PAGE_SIZE_4M;
+    for(; addr < end; addr += PAGE_SIZE)                                    // a bad page is left to fault, the program is killed then
+        if(!tbl[(addr - user_virt_addr) / PAGE_SIZE].present) demand_page_fault(addr);
+}
@@ -9,8 +9,12 @@
 #define PAGE_SIZE_4M    0x400000
 #define VMEM_START_ADDR 0xB8000                             // The address of video memory
 #define KERNEL_START_ADDR 0x400000                          // The start address of kenel
-#define USER_START_ADDR 0x800000                            // The start address of user-space
-#define PROGRAM_SIZE    0x400000                            // A user program occupies 4M physical mem.
+#define PTE_LAZY        1                                   // "available" bits of a not-present image page filled on first touch
+#define PTE_ZERO        2                                   // "available" bits of a not-present page zero filled on first touch
+#define PTE_COW         3                                   // "available" bits of a read-only page shared by fork, copied on write
+
+/* drop the TLB entry of the page holding addr, cheaper than flush_TLB which drops every non-global entry */
+#define invlpg(addr)    asm volatile("invlpg (%0)" : : "r"(addr) : "memory")
 
 /* define a structure for page directory entriy */
 struct page_directory_entry
@@ -56,6 +60,20 @@ extern void enable_paging(void);
 extern void load_page_directory(int dir);
 /* Flush TLB after swapping page */
 extern void flush_TLB(void);
+/* build the page directory and 4KB page tables of a new program, image pages are left to fault in */
+extern page_directory_entry_t* init_user_paging(uint32_t image_len);
+/* build the page directory of a forked program, sharing the frames of the parent copy on write */
+extern page_directory_entry_t* fork_user_paging(page_directory_entry_t* parent);
+/* give the frames, page tables and page directory of a program back to the buddy allocator */
+extern void free_user_paging(page_directory_entry_t* dir);
+/* switch to the page directory of a process */
+extern void set_user_paging(uint8_t pid);
+/* the page table behind a 4MB user region of a page directory */
+extern page_table_entry_t* user_page_table(page_directory_entry_t* dir, uint32_t virt_addr);
+/* back a lazily loaded or zero filled program page with a frame, or copy a shared one on write, called by the page fault handler */
+extern int32_t demand_page_fault(uint32_t fault_addr);
+/* fill the not yet present program pages of a user buffer before the kernel copies through it */
+extern void fault_in_user_range(const void* buf, int32_t nbytes);
 
 /* define the page directory and page table */
 page_directory_entry_t page_dir[DIR_TBL_SIZE] __attribute__((aligned (PAGE_SIZE)));
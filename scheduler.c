@@ -13,19 +13,21 @@ uint8_t sche_term = 0;                                      // currently executi
  *  INPUTS : term_id -- the foreground terminal id
  *  OUTPUTS : none
  *  RETURN VALUE : none
- *  SIDE EFFECTS : update video memory mapping. 
+ *  SIDE EFFECTS : update video memory mapping, invalidate the two video pages if they moved
  */
 void update_video_mem_paging(uint8_t term_id){
-    if(term_id == cur_terminal){
-        page_tbl[VMEM_START_ADDR / SIZE_4KB].base_addr = VMEM_START_ADDR / SIZE_4KB;              // If the specified terminal is currently presented terminal, map virtual video memory to physical video memory
-        page_tbl_usr_video.base_addr = VMEM_START_ADDR / SIZE_4KB;                                // update user program's video memory mapping
+    uint32_t vid_base_addr = VMEM_START_ADDR / SIZE_4KB;                                          // If the specified terminal is currently presented terminal, map virtual video memory to physical video memory
+    if(term_id != cur_terminal){
+        vid_base_addr = back_video_buf_addr[sche_term] / SIZE_4KB;                                // If they are not the same terminal, map virtual video memory to the corresponding background video memory
     }
-    else{
-        uint32_t back_vid_base_addr = back_video_buf_addr[sche_term] / SIZE_4KB;                  // If they are not the same terminal, map virtual video memory to the corresponding background video memory
-        page_tbl[VMEM_START_ADDR / SIZE_4KB].base_addr = back_vid_base_addr;
-        page_tbl_usr_video.base_addr = back_vid_base_addr;                                        // update user program's video memory mapping
+    if(page_tbl[VMEM_START_ADDR / SIZE_4KB].base_addr != vid_base_addr){
+        page_tbl[VMEM_START_ADDR / SIZE_4KB].base_addr = vid_base_addr;
+        invlpg(VMEM_START_ADDR);                                                                  // a global page, only invlpg drops it
+    }
+    if(page_tbl_usr_video.base_addr != vid_base_addr){
+        page_tbl_usr_video.base_addr = vid_base_addr;                                             // update user program's video memory mapping
+        invlpg(user_video_addr);
     }
-    flush_TLB();                                                                                  // After changing mapping relationship, flush TLB
 }
 
 int8_t get_owner_terminal(uint8_t pid){
@@ -45,11 +47,13 @@ int8_t get_owner_terminal(uint8_t pid){
  */
 void scheduler(void){
     /* store current scheduler ebp */
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (active_array[sche_term] + 1));
-    asm volatile(
-        "movl   %%ebp, %0\n"                                                                        // store current ebp
-        : "=r"(cur_pcb->sche_ebp)
-    );
+    if(active_array[sche_term] != -1){                                                              // nothing runs on a terminal before its base shell
+        pcb_t* cur_pcb = pcb_ptr[(uint8_t)active_array[sche_term]];
+        asm volatile(
+            "movl   %%ebp, %0\n"                                                                    // store current ebp
+            : "=r"(cur_pcb->sche_ebp)
+        );
+    }
 
     /* update scheduled terminal and scheduled pid */
     sche_term = (sche_term + 1) % NUM_TERMINAL;                                                     // Get the next scheduled terminal
@@ -62,18 +66,14 @@ void scheduler(void){
     if(cur_process == -1) execute((uint8_t*)"shell");                                               // Start up 3 base shells at the beginning
 
     /* remaping user paging */
-    uint32_t phys_addr = USER_START_ADDR + cur_process * PROGRAM_SIZE;
-    page_dir[user_virt_addr / PAGE_SIZE_4M].base_addr = phys_addr / PAGE_SIZE;                      // virtual mem. 128M -> phys mem. (8M + pid * 4M)
-    page_dir[user_virt_addr / PAGE_SIZE_4M].present = 1;                                            // Set the paging bits to be present and to user level
-    page_dir[user_virt_addr / PAGE_SIZE_4M].user_sup = 1;
-    flush_TLB();                                                                                    // Flush TLB after swapping page
+    set_user_paging(cur_process);                                                                   // load the page directory of the process, no flush needed
 
     /* change tss */
     tss.ss0 = KERNEL_DS;
-    tss.esp0 = KERNEL_STACK_START - SIZE_8KB * cur_process - sizeof(uint32_t);
+    tss.esp0 = KERNEL_STACK_TOP((uint8_t)cur_process);
 
     /* get next scheduler ebp */
-    pcb_t* next_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (active_array[sche_term] + 1));      // Get the pcb of the next process
+    pcb_t* next_pcb = pcb_ptr[(uint8_t)active_array[sche_term]];                                    // Get the pcb of the next process
     asm volatile(
         "movl   %0, %%ebp\n"                                                                        // restore next ebp
         :
@@ -16,7 +16,7 @@ void kill_the_task(void){
 }
 
 void ignore(void){
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
     cur_pcb->sig_mask = 0;
     return;
 }
@@ -25,9 +25,10 @@ void send_signal(int8_t sig_num){
     if(sig_num < 0 || sig_num >= NUM_SIGNAL) return;
     pcb_t* cur_pcb;
     if(sig_num == INTERRUPT){
-        cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (active_array[cur_terminal] + 1));
+        if(active_array[cur_terminal] == -1) return;                  // no shell on the terminal yet
+        cur_pcb = pcb_ptr[(uint8_t)active_array[cur_terminal]];
     }else{
-        cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));
+        cur_pcb = pcb_ptr[(uint8_t)cur_process];
     }
     cur_pcb->sig_pending[(uint8_t)sig_num] = 1;
     return;
@@ -36,7 +37,7 @@ void send_signal(int8_t sig_num){
 void* dft_sig_handler[NUM_SIGNAL] = {&kill_the_task, &kill_the_task, &kill_the_task, &ignore, &ignore};
 
 void do_signal(context_t context){
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
     uint32_t sig_num;
     for(sig_num = 0; sig_num < NUM_SIGNAL; sig_num++){
         if(cur_pcb->sig_pending[sig_num]){
@@ -7,11 +7,14 @@
 #include "terminal.h"
 #include "scheduler.h"
 #include "signal.h"
+#include "buddy.h"
 
 uint8_t process_array[MAX_PROCESS] = {0,0,0,0,0,0};         // 1 means busy, 0 means free
 int8_t  cur_process = -1;                                   // Denote the process under execution
 int8_t  parent_pid[MAX_PROCESS] = {-1,-1,-1,-1,-1,-1};      // record parent pid of each process
+pcb_t*  pcb_ptr[MAX_PROCESS];                               // pcb at the bottom of each process's kernel stack
 uint8_t exception_flag = 0;                                 // Denote whether there is exception occur
+static uint32_t halted_stack = 0;                           // kernel stack of a halting base shell, reused by the next execute
 
 /*
  * bad_call_open
@@ -62,11 +65,11 @@ int32_t bad_call_write(int32_t fd, const void* buf, int32_t nbytes){
     return -1;
 }
 
-file_op_t stdin_op = {&bad_call_open, &bad_call_close, &terminal_read, &bad_call_write};            // Initialize the operation table for each file
-file_op_t stdout_op = {&bad_call_open, &bad_call_close, &bad_call_read, &terminal_write};
-file_op_t file_op = {&file_open, &file_close, &file_read, &file_write};
-file_op_t dir_op = {&dir_open, &dir_close, &dir_read, &dir_write};
-file_op_t rtc_op = {&rtc_open, &rtc_close, &rtc_read, &rtc_write};
+file_op_t stdin_op = {&bad_call_open, &bad_call_close, &terminal_read, &bad_call_write, NULL, NULL};            // Initialize the operation table for each file
+file_op_t stdout_op = {&bad_call_open, &bad_call_close, &bad_call_read, &terminal_write, NULL, &terminal_writev};
+file_op_t file_op = {&file_open, &file_close, &file_read, &file_write, &file_readv, &file_writev};
+file_op_t dir_op = {&dir_open, &dir_close, &dir_read, &dir_write, NULL, NULL};
+file_op_t rtc_op = {&rtc_open, &rtc_close, &rtc_read, &rtc_write, NULL, NULL};
 
 /*
  * sys_call_handler_temp
@@ -93,28 +96,32 @@ int32_t halt (uint8_t status){
     cli();
 
     /* Restore parent data */
-    pcb_t* halt_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));                  // Reserved for deleting relevant FDs; halt_pcb is the pcb of child process we will halt 
-    cur_process = parent_pid[(uint8_t)cur_process];                                                 // Set cur_process to the parent process of the process going to be halted
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));                   // Set current pcb
+    pcb_t* halt_pcb = pcb_ptr[(uint8_t)cur_process];                                                // Reserved for deleting relevant FDs; halt_pcb is the pcb of child process we will halt 
+    uint8_t halt_pid = halt_pcb->pid;
+    cur_process = parent_pid[halt_pid];                                                             // Set cur_process to the parent process of the process going to be halted
 
-    process_array[halt_pcb->pid] = 0;                                                               // Set the process going to be halted status to free
-    if(parent_pid[halt_pcb->pid] == -1){
+    process_array[halt_pid] = 0;                                                                    // Set the process going to be halted status to free
+    if(parent_pid[halt_pid] == -1){
         printf("Can not halt base shell!\n");
         cur_process = -1;
+        load_page_directory((uint32_t)page_dir);                                                    // kernel mappings only, while the directory is freed
+        free_user_paging(halt_pcb->pgdir);
+        pcb_ptr[halt_pid] = NULL;
+        halted_stack = (uint32_t)halt_pcb;                                                          // still running on it, the new shell takes it over instead of freeing it
         execute((const uint8_t*)"shell");
     }
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Set current pcb
 
     tss.ss0 = KERNEL_DS;                                                                            // Set ss0 and esp0 in tss
-    tss.esp0 = KERNEL_STACK_START - SIZE_8KB * (cur_pcb->pid) - sizeof(uint32_t);
+    tss.esp0 = KERNEL_STACK_TOP(cur_pcb->pid);
 
     /* update scheduling active array */
     active_array[sche_term] = cur_process;
-    parent_pid[halt_pcb->pid] = -1;                                                                 // Set the parent of the halted process to -1
+    parent_pid[halt_pid] = -1;                                                                      // Set the parent of the halted process to -1
 
     /* Restore parent paging */
-    uint32_t phys_addr = USER_START_ADDR + cur_process * PROGRAM_SIZE;
-    page_dir[user_virt_addr / PAGE_SIZE_4M].base_addr = phys_addr / PAGE_SIZE;                      // virtual mem. 128M -> phys mem. (8M + pid * 4M)
-    flush_TLB();                                                                                    // Flush TLB after swapping page
+    set_user_paging(cur_process);                                                                   // load the parent's page directory
+    free_user_paging(halt_pcb->pgdir);                                                              // no longer in CR3, give the memory back
 
     /* Close any relevant FDs */
     uint8_t i;
@@ -132,13 +139,16 @@ int32_t halt (uint8_t status){
         halt_ret = EXCEPTION_RET;                                                                   // If exception occur, return EXCEPTION_RET: 256
         exception_flag = 0;
     }
+    uint32_t exe_ebp = halt_pcb->exe_ebp;
+    pcb_ptr[halt_pid] = NULL;
+    buddy_free((uint32_t)halt_pcb);                                                                 // still running on it until the jump, nothing allocates before
     asm volatile(
         "movl   %0, %%eax\n"                                                                        // Push the return value
         "movl   %1, %%ebp\n"                                                                        // Return to the execute environment and ready to leave and ret
         "leave\n"
         "ret\n"
         :
-        : "r"(halt_ret), "r"(halt_pcb->exe_ebp)                           
+        : "r"(halt_ret), "r"(exe_ebp)                           
     );
     
     return 0;
@@ -161,12 +171,12 @@ int32_t execute (const uint8_t* command){
     /* Parse args */
     if(NULL == command) return -1;                                                                  // If command is NULL(invalid), return -1
     uint32_t cmd_len = strlen((int8_t*)command);
-    int8_t   exe_file[MAX_FILENAME_LEN + 1] = {'\0'};                                               // leave 1 place for "\0"
+    int8_t   exe_file[MAX_PATH_LEN + 1] = {'\0'};                                                   // leave 1 place for "\0"
     int8_t   args[BUFFER_SIZE + 1] = {'\0'};                                                        // leave 1 place for "\0"
     uint8_t i;
     for(i = 0; i <= cmd_len; i++){
         if(command[i] == '\0' || command[i] == ' '){
-            uint32_t exe_len = MAX_FILENAME_LEN;
+            uint32_t exe_len = MAX_PATH_LEN;
             if(exe_len > i) exe_len = i;
             strncpy(exe_file, (int8_t*)command, exe_len);                                           // Store the exe_file given by the command
             break;
@@ -205,18 +215,24 @@ int32_t execute (const uint8_t* command){
         printf("Cannot create new process!\n");                                                     // If it is full, we cannot create a new process
         return -1;
     }
+    uint32_t image_len = (inode_ptr[exe_dentry.inode]).length;
+    uint32_t reused_stack = halted_stack;                                                           // the stack we run on if a base shell is restarting
+    uint32_t kernel_stack = reused_stack;
+    halted_stack = 0;
+    if(kernel_stack == 0) kernel_stack = buddy_alloc(KERNEL_STACK_ORDER);                           // 8KB aligned, the pcb lives at its bottom
+    page_directory_entry_t* pgdir = init_user_paging(image_len);                                    // virtual mem. 128M, frames are allocated on first touch
+    if(kernel_stack == 0 || pgdir == NULL){
+        if(kernel_stack != 0 && kernel_stack != reused_stack) buddy_free(kernel_stack);
+        if(pgdir != NULL) free_user_paging(pgdir);
+        process_array[cur_pid] = 0;
+        printf("Cannot create new process!\n");                                                     // No memory left for its kernel stack or page tables
+        return -1;
+    }
+    pcb_ptr[cur_pid] = (pcb_t*)kernel_stack;
     active_array[sche_term] = cur_pid;
     parent_pid[cur_pid] = cur_process;
 
-    /* Set up program paging */
-    uint32_t phys_addr = USER_START_ADDR + cur_pid * PROGRAM_SIZE;
-    page_dir[user_virt_addr / PAGE_SIZE_4M].base_addr = phys_addr / PAGE_SIZE;                      // virtual mem. 128M -> phys mem. (8M + pid * 4M)
-    page_dir[user_virt_addr / PAGE_SIZE_4M].present = 1;                                            // Set the paging bits to be present and to user level
-    page_dir[user_virt_addr / PAGE_SIZE_4M].user_sup = 1;
-    flush_TLB();                                                                                    // Flush TLB after swapping page
-
-    /* User-level Program loader */
-    read_data(exe_dentry.inode, 0, (uint8_t*)user_img_addr,(inode_ptr[exe_dentry.inode]).length);   // Load the program
+    /* User-level Program loader: image pages are read on first touch by the page fault handler */
 
     /* Create PCB */
     pcb_t cur_pcb;
@@ -224,9 +240,15 @@ int32_t execute (const uint8_t* command){
     cur_process = cur_pid;
 
     memset(cur_pcb.CMD, '\0', MAX_FILENAME_LEN + 1);
-    memcpy(cur_pcb.CMD, exe_file, strlen(exe_file));
+    memcpy(cur_pcb.CMD, exe_dentry.file_name, MAX_FILENAME_LEN);                                  // the name without its directories
     memset(cur_pcb.args, '\0', BUFFER_SIZE+1);
     memcpy(cur_pcb.args, args, strlen(args));                                                       // Copy cmd args to pcb
+    cur_pcb.mmap_top = 0;                                                                           // mmap region is empty
+    cur_pcb.exe_inode = exe_dentry.inode;                                                           // demand paging reads the image from here
+    cur_pcb.image_pages = (image_len + SIZE_4KB - 1) / SIZE_4KB;
+    cur_pcb.faulted_pages = 0;
+    cur_pcb.pgdir = pgdir;
+    cur_pcb.fork_child = -1;                                                                        // nothing to wait for
 
     for(i = 0; i < MAX_FILE_NUM; i++){
         cur_pcb.file_array[i].flags = 0;                                                            // Initialize all the files to "not busy"
@@ -248,16 +270,19 @@ int32_t execute (const uint8_t* command){
         cur_pcb.sig_handler[i] = dft_sig_handler[i];
     }
 
-    pcb_t* pcb_addr = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_pid + 1));                      // Find the pcb address of current process
+    pcb_t* pcb_addr = pcb_ptr[cur_pid];                                                             // Find the pcb address of current process
     *pcb_addr = cur_pcb; 
 
+    /* Set up program paging */
+    set_user_paging(cur_pid);                                                                       // one CR3 load, no shared entry to rewrite
+
     /* Context Switch */
     uint32_t eip;
     read_data(exe_dentry.inode, EIP_START, (uint8_t*)&eip, 4);                                      // Set eip by the 24-27 bytes
     uint32_t cs = USER_CS;                                                                          // Get the arguments needed for IRET
     uint32_t ds = USER_DS;
     uint32_t esp = user_virt_addr + SIZE_4MB - sizeof(uint32_t);                                    
-    tss.esp0 = KERNEL_STACK_START - SIZE_8KB * cur_pid - sizeof(uint32_t);
+    tss.esp0 = KERNEL_STACK_TOP(cur_pid);
     tss.ss0 = KERNEL_DS;
     asm volatile(                                                                        
         "movl   %%ebp, %0\n"                                                                        // Store execute's ebp
@@ -294,8 +319,9 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes){
         printf("invalid file descriptor!\n");
         return -1;
     }
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));                     // Get the current pcb based on cur_process
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
     if(cur_pcb->file_array[fd].flags == 0) return -1;
+    fault_in_user_range(buf, nbytes);                                                               // no page fault inside the block cache
     int32_t res = cur_pcb->file_array[fd].file_op_ptr->read(fd, buf, nbytes);                       // Call the corresponding read function
     return res;
 }
@@ -317,8 +343,9 @@ int32_t write (int32_t fd, const void* buf, int32_t nbytes){
         printf("invalid file descriptor!\n");
         return -1;
     }
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));                     // Get the current pcb based on cur_process
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
     if(cur_pcb->file_array[fd].flags == 0) return -1;
+    fault_in_user_range(buf, nbytes);                                                               // no page fault inside the block cache
     int32_t res = cur_pcb->file_array[fd].file_op_ptr->write(fd, buf, nbytes);                      // Call the corresponding write function
     return res;
 }
@@ -337,7 +364,7 @@ int32_t open (const uint8_t* filename){
     dentry_t dentry;
     int32_t i;
     if (-1 == read_dentry_by_name(filename, &dentry)) return -1;
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));                     // Get the current pcb based on cur_process
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
     for(i = 0; i < MAX_FILE_NUM; i++){
         if(0 == cur_pcb->file_array[i].flags){
             fd = i;                                                                                 // Traverse to get the "not busy" position
@@ -360,7 +387,7 @@ int32_t open (const uint8_t* filename){
 
     else if (dentry.file_type == 1) {
         /* directory type file */
-        cur_pcb->file_array[fd].inode = 0;                                                          // not a data file
+        cur_pcb->file_array[fd].inode = dentry.inode;                                               // DIR_INODE for the root, read through the directory ops
         cur_pcb->file_array[fd].file_op_ptr = &dir_op;                                              // Set operation table
     }
 
@@ -389,7 +416,7 @@ int32_t close (int32_t fd){
         return -1;
     }              
     
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));                     // Get the current pcb based on cur_process
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
     if(cur_pcb->file_array[fd].flags == 0) return -1;
     cur_pcb->file_array[fd].flags = 0; // available (not busy)    
     
@@ -408,7 +435,7 @@ int32_t close (int32_t fd){
  *  SIDE EFFECTS : modify the user-level buffer
  */
 int32_t getargs (uint8_t* buf, int32_t nbytes){
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process+1));                     // Get the current pcb based on cur_process
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
     int8_t* args = cur_pcb->args;
     if(args[0] == '\0' || (strlen((int8_t*)args) > nbytes)) return -1;                              // check the existence of argument, or avoid not fitting in the buffer
     strncpy((int8_t*)buf, args, nbytes);
@@ -427,24 +454,25 @@ int32_t getargs (uint8_t* buf, int32_t nbytes){
 int32_t vidmap (uint8_t** screen_start){
     if((uint32_t)screen_start < user_virt_addr || (uint32_t)screen_start >= (user_virt_addr + PAGE_SIZE_4M)) return -1; // if the pointer is out of user-space range, return -1
     uint32_t video_dir_idx = (uint32_t)user_video_addr / PAGE_SIZE_4M;
-    memset(&page_dir[video_dir_idx], 0, sizeof(page_dir[video_dir_idx]));                           // set PDE, user can access video mem. via virtual mem. 132M (4K page)
-    page_dir[video_dir_idx].present = 1;                                                
-    page_dir[video_dir_idx].read_write = 1;
-    page_dir[video_dir_idx].base_addr = (uint32_t)(&page_tbl_usr_video) / PAGE_SIZE;    
-    page_dir[video_dir_idx].user_sup = 1;                                                           // user accessible
+    page_directory_entry_t* pgdir = pcb_ptr[(uint8_t)cur_process]->pgdir;                           // only this process sees the video page
+    memset(&pgdir[video_dir_idx], 0, sizeof(pgdir[video_dir_idx]));                                 // set PDE, user can access video mem. via virtual mem. 132M (4K page)
+    pgdir[video_dir_idx].present = 1;                                                
+    pgdir[video_dir_idx].read_write = 1;
+    pgdir[video_dir_idx].base_addr = (uint32_t)(&page_tbl_usr_video) / PAGE_SIZE;    
+    pgdir[video_dir_idx].user_sup = 1;                                                              // user accessible
     memset(&page_tbl_usr_video, 0, sizeof(page_table_entry_t));                                     // set PTE
     page_tbl_usr_video.present = 1;
     page_tbl_usr_video.read_write = 1;
     page_tbl_usr_video.base_addr = VMEM_START_ADDR / PAGE_SIZE;                                     // map to video mem.
     page_tbl_usr_video.user_sup = 1;                                                                // user accessible
     *screen_start = (uint8_t*)user_video_addr;                                                      // link the screen addr. to user video mem.
-    flush_TLB();
+    invlpg(user_video_addr);
     return 0;
 }
 
 int32_t set_handler (int32_t signum, void* handler_address){
     if(signum < 0 || signum >= NUM_SIGNAL) return -1;
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
     if(handler_address != NULL){
         cur_pcb->sig_handler[signum] = handler_address;
     }else{
@@ -454,7 +482,7 @@ int32_t set_handler (int32_t signum, void* handler_address){
 }
 
 int32_t sigreturn (void){
-    pcb_t* cur_pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (cur_process + 1));
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];
     uint32_t ebp;
     asm volatile(                                                                        
         "movl   %%ebp, %0\n"
@@ -482,7 +510,7 @@ int32_t color (int32_t att){
 }
 
 int32_t ps (void){
-    printf("PID  TERMINAL  STATE  CMD\n");
+    printf("PID  TERMINAL  STATE  PAGES    CMD\n");
     uint8_t pid, term;
     pcb_t* pcb;
     for(pid = 0; pid < MAX_PROCESS; pid++){
@@ -491,26 +519,37 @@ int32_t ps (void){
             printf(" %d      %d      ", pid, term);
             if(active_array[term] == pid) printf(" RUN   ");
             else printf("BLOCK  ");
-            pcb = (pcb_t*)(KERNEL_STACK_START - SIZE_8KB * (pid + 1));
+            pcb = pcb_ptr[pid];
+            printf("%d/%d    ", pcb->faulted_pages, pcb->image_pages);                             // image pages faulted in / image pages
             printf((int8_t*)(pcb->CMD));
             printf("\n");
         }
     }
+    printf("MEMORY  %d pages free, %d pages used\n", buddy_stats.free_pages, buddy_stats.used_pages);   // buddy allocator counters
     return 0;
 }
 
+/*
+ * cp
+ *  DESCRIPTION : copy a file by making the destination share the data blocks of the source.
+ *                No data is copied: each block is copied on the first write into it.
+ *  INPUTS : buf -- "src dst", the destination is created if it does not exist
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 if dst is a copy of src
+ *                 -1 if src is not a regular file, dst cannot be created or is being executed,
+ *                    or the filesystem has no block left for the indirect blocks of dst
+ *  SIDE EFFECTS : replace the content of dst
+ */
 int32_t cp (uint8_t* buf)
 {
-    int8_t   src[32 + 1] = {'\0'};                                               // leave 1 place for "\0"
-    int8_t   dst[32 + 1] = {'\0'};                                               // leave 1 place for "\0"
+    int8_t   src[MAX_PATH_LEN + 1] = {'\0'};                                     // leave 1 place for "\0"
+    int8_t   dst[MAX_PATH_LEN + 1] = {'\0'};                                     // leave 1 place for "\0"
     uint8_t i;
-    int32_t fd_src, fd_dst, cnt;
-    uint8_t cp_buf[1024];
     /* try to split the two arguments */
     uint32_t args_len = strlen((int8_t*)buf);
     for(i = 0; i <= args_len; i++){
         if(buf[i] == '\0' || buf[i] == ' '){
-            uint32_t src_len = 32;
+            uint32_t src_len = MAX_PATH_LEN;
             if(src_len > i) src_len = i;
             strncpy(src, (int8_t*)buf, src_len);                                           // Store the exe_file given by the buf
             break;
@@ -518,66 +557,478 @@ int32_t cp (uint8_t* buf)
     }
     for(; i < args_len; i++){
         if(buf[i] != '\0' && buf[i] != ' '){
-            strncpy(dst, (int8_t*)(buf + i), args_len - i);                                     // Store the argument given by the buf
+            uint32_t dst_len = MAX_PATH_LEN;
+            if(dst_len > args_len - i) dst_len = args_len - i;
+            strncpy(dst, (int8_t*)(buf + i), dst_len);                                     // Store the argument given by the buf
             break;
         }
     }
 
     /* read dentries for two args*/
     dentry_t src_dentry, dst_dentry;
-    if(-1 == read_dentry_by_name((uint8_t*)src, &src_dentry)){
+    if(-1 == read_dentry_by_name((uint8_t*)src, &src_dentry) || src_dentry.file_type != 2){
         printf("cannot find file \"%s\"\n", (char*)src);
         return -1;
     }
     if(-1 == read_dentry_by_name((uint8_t*)dst, &dst_dentry)){
-        printf("cannot find file \"%s\"\n", (char*)dst);
-        return -1;
+        if(-1 == create_file((uint8_t*)dst) || -1 == read_dentry_by_name((uint8_t*)dst, &dst_dentry)){
+            printf("cannot create file \"%s\"\n", (char*)dst);
+            return -1;
+        }
     }
+    if(dst_dentry.file_type != 2 || inode_in_use(dst_dentry.inode, 0)) return -1;              // running images are paged in on demand
 
-    // inode_t* src_inode_ptr = inode_ptr + src_dentry.inode;
-    // inode_t* dst_inode_ptr = inode_ptr + dst_dentry.inode;
+    return clone_data(src_dentry.inode, dst_dentry.inode);                                      // share the blocks, copy on write
+}
 
-    // memcpy(dst_inode_ptr, src_inode_ptr, 4096);
+/*
+ * mmap
+ *  DESCRIPTION : map the data blocks of an open file read-only into the user mmap region,
+ *                so the program can reread the file without copies or system calls.
+ *                Each page maps one data block of the filesystem image directly.
+ *  INPUTS : fd -- file descriptor of an open regular file
+ *           length -- number of bytes to map from the start of the file, cut to the file length
+ *  OUTPUTS : none
+ *  RETURN VALUE : the user address of the mapping
+ *                 -1 if fd is not a regular file, the file is empty, length is 0,
+ *                    the mmap region is full or the filesystem cannot be mapped
+ *  SIDE EFFECTS : add read-only pages to the current process's mmap page table.
+ *                 Each mapped block holds a reference until the process halts, so the
+ *                 pages keep the bytes the file had at the time of the call: a later
+ *                 write copies the block first, a truncate or unlink leaves it mapped.
+ */
+int32_t mmap (int32_t fd, uint32_t length){
+    if ((fd >= MAX_FILE_NUM) || (fd < 0) || length == 0) return -1;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    file_desc_t* file_desc = &cur_pcb->file_array[fd];
+    if (file_desc->flags == 0 || file_desc->file_op_ptr != &file_op) return -1;                     // only regular files have data blocks
 
-    fd_src = open((uint8_t*)src);
-    fd_dst = open((uint8_t*)dst);
+    uint32_t file_len = inode_ptr[file_desc->inode].length;
+    if (length > file_len) length = file_len;
+    if (length == 0) return -1;
 
-    while (0 != (cnt = file_read (fd_src, cp_buf, 1024))) 
-    {
-        if (-1 == cnt) {
-	    printf("file read failed\n");
-	    return -1;
-	}
-	if (-1 == file_write (fd_dst, cp_buf, cnt))
-	    return -1;
+    uint32_t first_page = cur_pcb->mmap_top / SIZE_4KB;
+    uint32_t num_pages = (length + SIZE_4KB - 1) / SIZE_4KB;
+    if (first_page + num_pages > DIR_TBL_SIZE) return -1;                                          // the 4MB region is full
+
+    uint32_t i;
+    page_table_entry_t* pte = &user_page_table(cur_pcb->pgdir, user_mmap_addr)[first_page];
+    for (i = 0; i < num_pages; i++){
+        uint8_t* block = map_file_block(file_desc->inode, i);
+        if (block == NULL || ((uint32_t)block & (SIZE_4KB - 1))){                                  // blocks must be page aligned to map them
+            if (block != NULL) unmap_file_block(block);
+            while (i > 0){                                                                          // undo the partial mapping
+                i--;
+                unmap_file_block((uint8_t*)(pte[i].base_addr * PAGE_SIZE));
+                memset(&pte[i], 0, sizeof(page_table_entry_t));
+                invlpg(user_mmap_addr + (first_page + i) * SIZE_4KB);
+            }
+            return -1;
+        }
+        memset(&pte[i], 0, sizeof(page_table_entry_t));
+        pte[i].present = 1;
+        pte[i].read_write = 0;                                                                      // read-only
+        pte[i].user_sup = 1;                                                                        // user accessible
+        pte[i].base_addr = (uint32_t)block / PAGE_SIZE;
+        invlpg(user_mmap_addr + (first_page + i) * SIZE_4KB);
     }
 
-    return 0;
+    cur_pcb->mmap_top += num_pages * SIZE_4KB;
+    return user_mmap_addr + first_page * SIZE_4KB;
 }
 
-int32_t rm(uint8_t* buf)
-{
-    /* non-existent file */
-    uint32_t name_len = strlen((char *)buf);
+/*
+ * getdents
+ *  DESCRIPTION : read as many directory records as fit into buf in one call.
+ *                Each record holds the name and what stat returns for the file.
+ *  INPUTS : fd -- file descriptor of an open directory
+ *           buf -- the buffer of dirent_t records
+ *           nbytes -- the size of the buffer
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes filled, 0 at the end of the directory
+ *                 -1 if fd is not an open directory or buf cannot hold one record
+ *  SIDE EFFECTS : advance the position of fd
+ */
+int32_t getdents (int32_t fd, void* buf, int32_t nbytes){
+    if ((fd >= MAX_FILE_NUM) || (fd < 0)) return -1;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    if(cur_pcb->file_array[fd].flags == 0 || cur_pcb->file_array[fd].file_op_ptr != &dir_op) return -1;
+    return dir_getdents(fd, buf, nbytes);
+}
 
-    if(buf == NULL) return -1;                                                                    // If the filename is NULL, return -1
+/*
+ * get_regular_file
+ *  DESCRIPTION : find the file descriptor of an open regular file of the current process
+ *  INPUTS : fd -- file descriptor
+ *  OUTPUTS : none
+ *  RETURN VALUE : the file descriptor entry, NULL if fd is not an open regular file
+ *  SIDE EFFECTS : none
+ */
+static file_desc_t* get_regular_file (int32_t fd){
+    if ((fd >= MAX_FILE_NUM) || (fd < 0)) return NULL;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    if(cur_pcb->file_array[fd].flags == 0 || cur_pcb->file_array[fd].file_op_ptr != &file_op) return NULL;
+    return &cur_pcb->file_array[fd];
+}
 
-    if (name_len > MAX_FILENAME_LEN) return -1;                                                                   // If the filename length is out of range, return -1
+/*
+ * lseek
+ *  DESCRIPTION : move the position of an open regular file
+ *  INPUTS : fd -- file descriptor
+ *           offset -- the signed distance to move
+ *           whence -- SEEK_SET, SEEK_CUR or SEEK_END, what offset is relative to
+ *  OUTPUTS : none
+ *  RETURN VALUE : the new position
+ *                 -1 if fd is not an open regular file, whence is invalid or the position would be negative
+ *  SIDE EFFECTS : modify the file position. Seeking past the end is allowed, reads there return 0.
+ */
+int32_t lseek (int32_t fd, int32_t offset, int32_t whence){
+    file_desc_t* file_desc = get_regular_file(fd);
+    int32_t base;
+    if(file_desc == NULL) return -1;
+    if(whence == SEEK_SET) base = 0;
+    else if(whence == SEEK_CUR) base = file_desc->file_position;
+    else if(whence == SEEK_END) base = inode_ptr[file_desc->inode].length;
+    else return -1;
+    if(base + offset < 0) return -1;
+    file_desc->file_position = base + offset;
+    return file_desc->file_position;
+}
 
-    int i, j;
-    for(i = 0; i < (boot_block_ptr->num_dir_entries); i++){                                         // Traverse the dentries
-        dentry_t* cur_dentry = &(dentry_ptr[i]);
-        uint32_t dentry_len = strlen((int8_t*)(cur_dentry->file_name));
-        if(dentry_len > MAX_FILENAME_LEN) dentry_len = MAX_FILENAME_LEN;
-        if((name_len == dentry_len) && (!strncmp((int8_t*)buf, (int8_t*)(cur_dentry->file_name), name_len))){      // If we find the corresponding file, call read_dentry_by_index to write to the buffer
-            break;                                                                              // Successfully find the file: return 0
+/*
+ * pread
+ *  DESCRIPTION : read nbytes at a given offset of an open regular file, without moving its position
+ *  INPUTS : fd -- file descriptor
+ *           buf -- the destination
+ *           nbytes -- number of bytes to be read
+ *           offset -- where to read in the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes read, 0 past the end of the file
+ *                 -1 if fd is not an open regular file
+ *  SIDE EFFECTS : modify the buf
+ */
+int32_t pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset){
+    file_desc_t* file_desc = get_regular_file(fd);
+    if(file_desc == NULL || buf == NULL || nbytes < 0) return -1;
+    fault_in_user_range(buf, nbytes);                                                               // no page fault inside the block cache
+    return read_data(file_desc->inode, offset, buf, nbytes);
+}
+
+/*
+ * pwrite
+ *  DESCRIPTION : write nbytes at a given offset of an open regular file, without moving its position.
+ *                Existing bytes are overwritten in place, only missing blocks are allocated.
+ *  INPUTS : fd -- file descriptor
+ *           buf -- the source
+ *           nbytes -- number of bytes to be written
+ *           offset -- where to write in the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes written
+ *                 -1 if fd is not an open regular file or a process is executing it
+ *  SIDE EFFECTS : modify the file, may grow it
+ */
+int32_t pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset){
+    file_desc_t* file_desc = get_regular_file(fd);
+    if(file_desc == NULL || buf == NULL || nbytes < 0) return -1;
+    if(inode_in_use(file_desc->inode, 0)) return -1;                                               // running images are paged in on demand
+    fault_in_user_range(buf, nbytes);                                                               // no page fault inside the block cache
+    return write_data(file_desc->inode, offset, buf, nbytes);
+}
+
+/*
+ * readv
+ *  DESCRIPTION : read from fd into a vector of buffers, in order, with one system call.
+ *                The file's readv hook handles the whole vector when it has one,
+ *                otherwise its read hook is called once per buffer.
+ *  INPUTS : fd -- file descriptor
+ *           iov -- the buffers to fill
+ *           iovcnt -- the number of buffers, at most MAX_IOV
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes read
+ *                 -1 if fd or the vector is invalid, or the first read fails
+ *  SIDE EFFECTS : modify the buffers
+ */
+int32_t readv (int32_t fd, const iovec_t* iov, int32_t iovcnt){
+    int32_t i, bytes, total = 0;
+    if ((fd >= MAX_FILE_NUM) || (fd < 0) || iov == NULL || iovcnt <= 0 || iovcnt > MAX_IOV) return -1;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    if(cur_pcb->file_array[fd].flags == 0) return -1;
+    for(i = 0; i < iovcnt; i++) fault_in_user_range(iov[i].iov_base, (int32_t)iov[i].iov_len);              // no page fault inside the block cache
+    file_op_t* ops = cur_pcb->file_array[fd].file_op_ptr;
+    if(ops->readv != NULL) return ops->readv(fd, iov, iovcnt);                                     // the backend takes the whole vector
+    for(i = 0; i < iovcnt; i++){
+        bytes = ops->read(fd, iov[i].iov_base, iov[i].iov_len);
+        if(bytes == -1) return (total > 0) ? total : -1;
+        total += bytes;
+        if(bytes < (int32_t)iov[i].iov_len) break;                                                 // short read, stop like read would
+    }
+    return total;
+}
+
+/*
+ * writev
+ *  DESCRIPTION : write a vector of buffers to fd, in order, with one system call.
+ *                The file's writev hook handles the whole vector when it has one,
+ *                otherwise its write hook is called once per buffer.
+ *  INPUTS : fd -- file descriptor
+ *           iov -- the buffers to write
+ *           iovcnt -- the number of buffers, at most MAX_IOV
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes written
+ *                 -1 if fd or the vector is invalid, or the first write fails
+ *  SIDE EFFECTS : modify the fd file
+ */
+int32_t writev (int32_t fd, const iovec_t* iov, int32_t iovcnt){
+    int32_t i, bytes, total = 0;
+    if ((fd >= MAX_FILE_NUM) || (fd < 0) || iov == NULL || iovcnt <= 0 || iovcnt > MAX_IOV) return -1;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    if(cur_pcb->file_array[fd].flags == 0) return -1;
+    for(i = 0; i < iovcnt; i++) fault_in_user_range(iov[i].iov_base, (int32_t)iov[i].iov_len);              // no page fault inside the block cache
+    file_op_t* ops = cur_pcb->file_array[fd].file_op_ptr;
+    if(ops->writev != NULL) return ops->writev(fd, iov, iovcnt);                                   // the backend takes the whole vector
+    for(i = 0; i < iovcnt; i++){
+        bytes = ops->write(fd, iov[i].iov_base, iov[i].iov_len);
+        if(bytes == -1) return (total > 0) ? total : -1;
+        total += bytes;
+        if(bytes < (int32_t)iov[i].iov_len) break;
+    }
+    return total;
+}
+
+/*
+ * inode_in_use
+ *  DESCRIPTION : check whether a running process still needs an inode
+ *  INPUTS : inode -- the inode number
+ *           check_open -- 1 to also count files opened by a process, 0 to only count executables
+ *  OUTPUTS : none
+ *  RETURN VALUE : 1 if a process executes the inode (or has it open as a file or a directory), 0 otherwise
+ *  SIDE EFFECTS : none
+ */
+int32_t inode_in_use (uint32_t inode, uint32_t check_open){
+    uint8_t pid, i;
+    for(pid = 0; pid < MAX_PROCESS; pid++){
+        if(!process_array[pid]) continue;
+        pcb_t* pcb = pcb_ptr[pid];
+        if(pcb->exe_inode == inode) return 1;                                                       // its image is paged in on demand
+        if(!check_open) continue;
+        for(i = 2; i < MAX_FILE_NUM; i++){
+            if(!pcb->file_array[i].flags || pcb->file_array[i].inode != inode) continue;
+            if(pcb->file_array[i].file_op_ptr == &file_op || pcb->file_array[i].file_op_ptr == &dir_op) return 1;
         }
     }
-    if(i == (boot_block_ptr->num_dir_entries)) return -1;
-    for(j = i; j < (boot_block_ptr->num_dir_entries); j++)
-    {
-        memcpy(dentry_ptr + j, dentry_ptr + j + 1, 64);
+    return 0;
+}
+
+/*
+ * create
+ *  DESCRIPTION : create an empty regular file
+ *  INPUTS : fname -- the path of the new file, its directory must exist
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 if the file is created
+ *                 -1 if the name is invalid or taken, or no dentry or inode is left
+ *  SIDE EFFECTS : add a dentry to the directory
+ */
+int32_t create (const uint8_t* fname){
+    if(create_file(fname) == -1) return -1;
+    return 0;
+}
+
+/*
+ * unlink
+ *  DESCRIPTION : remove a regular file or an empty directory and reclaim its inode and data blocks
+ *  INPUTS : fname -- the path of the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 if the file is removed
+ *                 -1 if there is no such file, the directory is not empty,
+ *                    or a process has it open or is executing it
+ *  SIDE EFFECTS : remove the dentry from its directory
+ */
+int32_t unlink (const uint8_t* fname){
+    dentry_t dentry;
+    if(-1 == read_dentry_by_name(fname, &dentry)) return -1;
+    if(dentry.file_type != 0 && inode_in_use(dentry.inode, 1)) return -1;                          // the inode must not be reused under a process
+    return unlink_file(fname);
+}
+
+/*
+ * truncate
+ *  DESCRIPTION : set the length of a regular file, freeing the blocks past the new end or appending a hole
+ *  INPUTS : fname -- the name of the file
+ *           length -- the new length
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 on success
+ *                 -1 if there is no such regular file or a process is executing it
+ *  SIDE EFFECTS : modify the file
+ */
+int32_t truncate (const uint8_t* fname, uint32_t length){
+    dentry_t dentry;
+    if(-1 == read_dentry_by_name(fname, &dentry) || dentry.file_type != 2) return -1;
+    if(inode_in_use(dentry.inode, 0)) return -1;                                                   // running images are paged in on demand
+    return truncate_data(dentry.inode, length);
+}
+
+/*
+ * mkdir
+ *  DESCRIPTION : create an empty directory
+ *  INPUTS : dname -- the path of the new directory, its parent must exist
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 if the directory is created
+ *                 -1 if the name is invalid or taken, or no dentry, block or inode is left
+ *  SIDE EFFECTS : add a dentry to the parent directory
+ */
+int32_t mkdir (const uint8_t* dname){
+    if(make_dir(dname) == -1) return -1;
+    return 0;
+}
+
+/*
+ * stat
+ *  DESCRIPTION : get the type, inode, length and block count of a file without opening or reading it
+ *  INPUTS : fname -- the path of the file
+ *           buf -- where to store the stat_t
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 on success
+ *                 -1 if there is no such file or buf is NULL
+ *  SIDE EFFECTS : modify the buf
+ */
+int32_t stat (const uint8_t* fname, stat_t* buf){
+    dentry_t dentry;
+    if(buf == NULL || -1 == read_dentry_by_name(fname, &dentry)) return -1;
+    return file_stat(dentry.file_type, dentry.inode, buf);
+}
+
+/*
+ * fstat
+ *  DESCRIPTION : get the type, inode, length and block count of an open file
+ *  INPUTS : fd -- file descriptor of an open file, directory or rtc
+ *           buf -- where to store the stat_t
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 on success
+ *                 -1 if fd is not open, is a terminal, or buf is NULL
+ *  SIDE EFFECTS : modify the buf
+ */
+int32_t fstat (int32_t fd, stat_t* buf){
+    if ((fd >= MAX_FILE_NUM) || (fd < 0) || buf == NULL) return -1;
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    file_desc_t* file_desc = &cur_pcb->file_array[fd];
+    if (file_desc->flags == 0) return -1;
+    if (file_desc->file_op_ptr == &file_op) return file_stat(2, file_desc->inode, buf);
+    if (file_desc->file_op_ptr == &dir_op) return file_stat(1, file_desc->inode, buf);
+    if (file_desc->file_op_ptr == &rtc_op) return file_stat(0, 0, buf);
+    return -1;                                                                                      // the terminals have no inode
+}
+
+/*
+ * fork_wait
+ *  DESCRIPTION : run a forked child until it halts. The parent's frame stays on its kernel stack,
+ *                the child returns to user space through its copy of the syscall frame.
+ *  INPUTS : child_pcb -- the pcb of the child
+ *           child_context -- the child's copy of the syscall frame of the parent
+ *  OUTPUTS : none
+ *  RETURN VALUE : the status of the child, halt returns here like it returns from execute
+ *  SIDE EFFECTS : switch to the child
+ */
+static int32_t __attribute__((noinline)) fork_wait (pcb_t* child_pcb, context_t* child_context){
+    asm volatile(
+        "movl   %%ebp, %0\n"                                                                        // halt of the child returns from this frame
+        : "=r"(child_pcb->exe_ebp)
+    );
+    cur_process = child_pcb->pid;
+    tss.ss0 = KERNEL_DS;
+    tss.esp0 = KERNEL_STACK_TOP(child_pcb->pid);
+    set_user_paging(child_pcb->pid);                                                                // also drops the parent's writable TLB entries
+    asm volatile(
+        "movl   %0, %%esp\n"                                                                        // the child's syscall frame
+        "xorl   %%eax, %%eax\n"                                                                     // fork returns 0 in the child
+        "jmp    sys_call_return\n"
+        :
+        : "r"(child_context)
+        : "memory"
+    );
+    return 0;
+}
+
+/*
+ * fork
+ *  DESCRIPTION : duplicate the calling process. The child shares the parent's program pages
+ *                copy on write and gets copies of its pcb, open files and signal state.
+ *                The scheduler runs one process per terminal, the one in active_array, and halt
+ *                returns into the frame of the waiting parent, so the child cannot run next to
+ *                its parent: as with vfork, the parent is suspended until the child halts, and
+ *                wait hands out the child's status. Running workers concurrently would need a
+ *                run queue, which this scheduler does not have.
+ *  INPUTS : none
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 in the child
+ *                 the pid of the child in the parent, once the child has halted
+ *                 -1 if no pid or no memory for the kernel stack and page tables is left
+ *  SIDE EFFECTS : make the parent's program pages read-only until they are written
+ */
+int32_t fork (void){
+    cli();
+    uint32_t ebp;
+    asm volatile(
+        "movl   %%ebp, %0\n"
+        : "=r"(ebp)
+    );
+    context_t* linkage = (context_t*)(ebp + 2*sizeof(uint32_t));                                   // c_convention, ebp + 8 -> the syscall frame
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+
+    /* Obtain pid */
+    volatile uint8_t child_pid;                                                                     // read after halt of the child returns to fork_wait
+    uint8_t i;
+    for(i = 0; i < MAX_PROCESS; i++){
+        if(process_array[i] == 0) break;
     }
-    return 0;                                                                                      // Cannot find the corresponding file after traversing: return -1
+    if(i == MAX_PROCESS) return -1;
+    child_pid = i;
+    uint32_t kernel_stack = buddy_alloc(KERNEL_STACK_ORDER);
+    page_directory_entry_t* pgdir = (kernel_stack == 0) ? NULL : fork_user_paging(cur_pcb->pgdir);
+    if(pgdir == NULL){
+        if(kernel_stack != 0) buddy_free(kernel_stack);
+        return -1;
+    }
+    process_array[child_pid] = 1;
+    pcb_ptr[child_pid] = (pcb_t*)kernel_stack;
+    parent_pid[child_pid] = cur_process;
+    active_array[sche_term] = child_pid;
+
+    /* Copy PCB: open files, signal handlers, pending and masked signals, mmap region */
+    pcb_t* child_pcb = pcb_ptr[child_pid];
+    *child_pcb = *cur_pcb;
+    child_pcb->pid = child_pid;
+    child_pcb->pgdir = pgdir;
+    child_pcb->fork_child = -1;
+
+    /* The child returns from the same syscall frame, at the same place on its own kernel stack */
+    context_t* child_context = (context_t*)(kernel_stack + ((uint32_t)linkage - (uint32_t)cur_pcb));
+    *child_context = *linkage;
+
+    int32_t status = fork_wait(child_pcb, child_context);                                           // what halt of the child hands back
+    cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                        // halt does not restore the registers
+    cur_pcb->fork_status = status;
+    cur_pcb->fork_child = child_pid;
+    return child_pid;
 }
 
+/*
+ * wait
+ *  DESCRIPTION : collect the status of a child made by fork. fork only returns in the parent
+ *                once the child has halted, so the status is already there and wait never blocks.
+ *  INPUTS : pid -- what fork returned in the parent
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 to 255 from the halt of the child, 256 if it died by an exception
+ *                 -1 if pid is not the last child forked by the caller, or was collected already
+ *  SIDE EFFECTS : forget the child
+ */
+int32_t wait (int32_t pid){
+    pcb_t* cur_pcb = pcb_ptr[(uint8_t)cur_process];                                                 // Get the current pcb based on cur_process
+    if(cur_pcb->fork_child < 0 || cur_pcb->fork_child != pid) return -1;
+    cur_pcb->fork_child = -1;
+    return cur_pcb->fork_status;
+}
+
+int32_t rm(uint8_t* buf)
+{
+    return unlink(buf);                                                                            // same as unlink
+}
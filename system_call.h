@@ -5,6 +5,7 @@
 #include "terminal.h"
 #include "signal.h"
 #include "filesys.h"
+#include "paging.h"
 
 #define MAX_PROCESS     6
 #define MAX_FILE_NUM    8
@@ -12,14 +13,21 @@
 #define user_virt_addr      0x08000000          // 128M
 #define user_img_addr       0x08048000
 #define user_video_addr     (user_virt_addr + SIZE_4MB)
-#define KERNEL_STACK_START  0x800000            // 8M
+#define user_mmap_addr      (user_video_addr + SIZE_4MB)  // 136M, files mapped by mmap
 #define SIZE_4KB            0x1000              // 4K
 #define SIZE_8KB            0x2000              // 8K
+#define KERNEL_STACK_ORDER  1                   // buddy order of a kernel stack, 8K with the pcb at its bottom
+#define KERNEL_STACK_TOP(pid) ((uint32_t)pcb_ptr[pid] + SIZE_8KB - sizeof(uint32_t))
 #define SIZE_4MB            0x400000            // 4M
 #define EIP_START           24                  // EIP stored in bytes 24-27 of the executable
+#define MAX_IOV             64                  // most buffers in one readv/writev
 
 #define EXCEPTION_RET       256
 
+#define SEEK_SET            0                   // lseek from the start of the file
+#define SEEK_CUR            1                   // lseek from the current position
+#define SEEK_END            2                   // lseek from the end of the file
+
 #define BACK_VID_1          (VMEM_START_ADDR + 1 * SIZE_4KB)
 #define BACK_VID_2          (VMEM_START_ADDR + 2 * SIZE_4KB)
 #define BACK_VID_3          (VMEM_START_ADDR + 3 * SIZE_4KB)
@@ -30,6 +38,8 @@ typedef struct file_operations                           // The struct for file
     int32_t (*close) (int32_t fd);
     int32_t (*read) (int32_t fd, void* buf, int32_t nbytes);
     int32_t (*write) (int32_t fd, const void* buf, int32_t nbytes);
+    int32_t (*readv) (int32_t fd, const iovec_t* iov, int32_t iovcnt);          // optional, NULL falls back to read per buffer
+    int32_t (*writev) (int32_t fd, const iovec_t* iov, int32_t iovcnt);         // optional, NULL falls back to write per buffer
 } file_op_t;
 
 typedef struct file_desc                                // The struct for files
@@ -51,11 +61,19 @@ typedef struct pcb
     uint8_t     sig_pending[NUM_SIGNAL];                // Record user program's pending signal
     uint8_t     sig_mask;                               // Record masked signals
     void*       sig_handler[NUM_SIGNAL];                // The handler of each signal
+    uint32_t    mmap_top;                               // Bytes of the mmap region in use
+    uint32_t    exe_inode;                              // Inode of the executable, lazily paged in
+    uint32_t    image_pages;                            // Pages of the program image
+    uint32_t    faulted_pages;                          // Image pages filled on first touch so far
+    page_directory_entry_t* pgdir;                      // Page directory, kernel entries shared with page_dir
+    int8_t      fork_child;                             // Pid of the last forked child until wait collects it, -1 if none
+    int32_t     fork_status;                            // Its halt status
 } pcb_t;
 
 
 extern int8_t cur_process;
 extern uint8_t process_array[MAX_PROCESS];
+extern pcb_t*  pcb_ptr[MAX_PROCESS];
 extern int8_t  parent_pid[MAX_PROCESS];
 extern uint8_t exception_flag;
 extern file_op_t stdin_op;
@@ -104,4 +122,36 @@ extern int32_t cp (uint8_t* buf);
 
 extern int32_t rm(uint8_t* buf);
 
+extern int32_t mmap (int32_t fd, uint32_t length);
+
+extern int32_t create (const uint8_t* fname);
+
+extern int32_t unlink (const uint8_t* fname);
+
+extern int32_t truncate (const uint8_t* fname, uint32_t length);
+
+extern int32_t getdents (int32_t fd, void* buf, int32_t nbytes);
+
+extern int32_t lseek (int32_t fd, int32_t offset, int32_t whence);
+
+extern int32_t pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t readv (int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+extern int32_t writev (int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+extern int32_t mkdir (const uint8_t* dname);
+
+extern int32_t stat (const uint8_t* fname, stat_t* buf);
+
+extern int32_t fstat (int32_t fd, stat_t* buf);
+
+extern int32_t fork (void);
+
+extern int32_t wait (int32_t pid);
+
+int32_t inode_in_use (uint32_t inode, uint32_t check_open);
+
 #endif
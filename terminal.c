@@ -31,7 +31,6 @@ int32_t terminal_open(const uint8_t* filename) {
         multi_terms[i].x = 0;
         multi_terms[i].y = 0;
         multi_terms[i].char_location = 0;
-        multi_terms[i].flag_cnt = 0;
         for (j = 0; j < BUFFER_SIZE; j++){
             multi_terms[i].line_buffer[j] = '\0';
         }
@@ -62,7 +61,7 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes){
     multi_terms[sche_term].read_open = 1;
     /* user is input something, wait the enter pressed. */
     while (!multi_terms[sche_term].enter_flag){
-
+        filesys_scrub(SCRUB_STEP);                          // idle time, check the filesystem for corrupted blocks
     };
     /* the number to be copied should be min(nbytes, count) */
     if (multi_terms[sche_term].count < nbytes){                        
@@ -108,14 +107,32 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes){
  *  SIDE EFFECTS : 
  */
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
-    int i;
     if (nbytes < 0 || buf == NULL){                         // check valid
         return -1;
     }
-    for (i = 0; i < nbytes; i++){
-        if (!((char*)buf)[i] == 0x0){                      // not print the NULL bytes.
-            putc(((char*)buf)[i]);
-        }
+    putbuf((const uint8_t*)buf, nbytes);                    // one cursor update, NULL bytes are not printed
+    return nbytes;
+}
+
+/**
+ * terminal_writev
+ *  DESCRIPTION : write a vector of user buffers to screen, in order. 
+ *  INPUTS : fd - file descriptor index.
+ *           iov - the buffers to write, in order.
+ *           iovcnt - the number of buffers.
+ *  OUTPUTS : none
+ *  RETURN VALUE : return number of bytes successfully written. otherwise return -1.
+ *  SIDE EFFECTS : 
+ */
+int32_t terminal_writev(int32_t fd, const iovec_t* iov, int32_t iovcnt){
+    int i;
+    int32_t nbytes = 0;
+    for (i = 0; i < iovcnt; i++){
+        if (iov[i].iov_base == NULL && iov[i].iov_len != 0) return -1;     // check valid
+    }
+    for (i = 0; i < iovcnt; i++){
+        putbuf((const uint8_t*)iov[i].iov_base, iov[i].iov_len);
+        nbytes += iov[i].iov_len;
     }
     return nbytes;
 }
@@ -20,7 +20,6 @@ typedef struct terminal_t
 	int		x;									/* current x coordinate of video mem */
 	int		y;									/* current y coordinate of video mem */
 	int		char_location;
-	int		flag_cnt;
 }terminal_t;
 
 extern volatile uint8_t cur_terminal;
@@ -41,6 +40,9 @@ extern int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes);
 /* write nbytes from buf to screen directly.*/
 extern int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes);
 
+/* write a vector of buffers to screen directly.*/
+extern int32_t terminal_writev(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
 /* put a char into buffer */
 extern int32_t fill_line_buffer(uint8_t c);
 
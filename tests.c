@@ -4,6 +4,11 @@
 #include "rtc.h"
 #include "filesys.h"
 #include "terminal.h" 
+#include "bcache.h"
+#include "crc32c.h"
+#include "buddy.h"
+#include "paging.h"
+#include "system_call.h"
 
 #define PASS 1
 #define FAIL 0
@@ -14,6 +19,20 @@
 #define TEST_OUTPUT(name, result)	\
 	printf("[TEST %s] Result = %s\n", name, (result) ? "PASS" : "FAIL");
 
+/* read the low 32 bits of the time-stamp counter, enough for short benchmarks */
+static inline uint32_t rdtsc(){
+	uint32_t low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return low;
+}
+
+/* the page directory in use, tests that switch address spaces put it back */
+static inline uint32_t read_cr3(){
+	uint32_t cr3;
+	asm volatile("movl %%cr3, %0" : "=r"(cr3));
+	return cr3;
+}
+
 static inline void assertion_failure(){
 	/* Use exception #15 for assertions, otherwise
 	   reserved by Intel */
@@ -363,6 +382,1054 @@ int file_test(const char* fname)
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+/* linear dentry scan, the lookup read_dentry_by_name used before the hash index */
+static int32_t linear_dentry_lookup(const uint8_t* fname){
+	uint32_t i, dentry_len;
+	uint32_t name_len = strlen((int8_t*)fname);
+	for(i = 0; i < boot_block_ptr->num_dir_entries; i++){
+		dentry_t* cur_dentry = &(dentry_ptr[i]);
+		dentry_len = strlen((int8_t*)(cur_dentry->file_name));
+		if(dentry_len > MAX_FILENAME_LEN) dentry_len = MAX_FILENAME_LEN;
+		if((name_len == dentry_len) && (!strncmp((int8_t*)fname, (int8_t*)(cur_dentry->file_name), name_len))){
+			return i;
+		}
+	}
+	return DENTRY_NONE;
+}
+
+/* dentry_index_bench
+ * Compares the linear dentry scan with the hash index on a directory
+ * filled up to MAX_FILES_NUMBER entries
+ * Inputs: None
+ * Outputs: cycles per lookup of both methods/PASS/FAIL
+ * Side Effects: temporarily fills the boot block, restored afterwards
+ * Coverage: dentry_index_build, dentry_index_lookup, read_dentry_by_name
+ * Files: filesys.c/h
+ */
+int dentry_index_bench(){
+	TEST_HEADER;
+	static boot_block_t saved_boot_block;
+	static char saved_names[MAX_FILES_NUMBER][MAX_FILENAME_LEN];
+	uint8_t names[MAX_FILES_NUMBER][MAX_FILENAME_LEN + 1];
+	uint32_t i, round, start, linear_cycles, index_cycles;
+	uint32_t flags;
+	int result = PASS;
+	const uint32_t rounds = 100;
+
+	cli_and_save(flags);
+	bcache_sync();														// the boot block in memory must be current
+	memcpy(&saved_boot_block, boot_block_ptr, sizeof(boot_block_t));
+	memcpy(saved_names, all_file_names, sizeof(saved_names));
+	for(i = boot_block_ptr->num_dir_entries; i < MAX_FILES_NUMBER; i++){	// fill the directory with "bench_NN"
+		memset(&dentry_ptr[i], 0, sizeof(dentry_t));
+		strcpy((int8_t*)dentry_ptr[i].file_name, "bench_");
+		dentry_ptr[i].file_name[6] = '0' + i / 10;
+		dentry_ptr[i].file_name[7] = '0' + i % 10;
+		dentry_ptr[i].file_type = 2;
+		memcpy(all_file_names[i], dentry_ptr[i].file_name, MAX_FILENAME_LEN);
+	}
+	boot_block_ptr->num_dir_entries = MAX_FILES_NUMBER;
+	dentry_index_build();
+	for(i = 0; i < MAX_FILES_NUMBER; i++){
+		memset(names[i], '\0', MAX_FILENAME_LEN + 1);
+		memcpy(names[i], dentry_ptr[i].file_name, MAX_FILENAME_LEN);
+	}
+
+	start = rdtsc();
+	for(round = 0; round < rounds; round++){
+		for(i = 0; i < MAX_FILES_NUMBER; i++){
+			if(linear_dentry_lookup(names[i]) != i) result = FAIL;
+		}
+	}
+	linear_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for(round = 0; round < rounds; round++){
+		for(i = 0; i < MAX_FILES_NUMBER; i++){
+			if(dentry_index_lookup(names[i]) != i) result = FAIL;
+		}
+	}
+	index_cycles = rdtsc() - start;
+	if(dentry_index_lookup((uint8_t*)"bench_xx") != DENTRY_NONE) result = FAIL;
+
+	memcpy(boot_block_ptr, &saved_boot_block, sizeof(boot_block_t));
+	memcpy(all_file_names, saved_names, sizeof(saved_names));
+	dentry_index_build();
+	restore_flags(flags);
+
+	printf("%d dentries: linear scan %d cycles/lookup, hash index %d cycles/lookup\n", MAX_FILES_NUMBER,
+		linear_cycles / (rounds * MAX_FILES_NUMBER), index_cycles / (rounds * MAX_FILES_NUMBER));
+	return result;
+}
+
+
+/* extent_truncate_test
+ * Asserts that lookups after a truncate see the new block list, not what was
+ * cached before it: the block count drops at once, and blocks cut and grown
+ * back read as zeros even after another file reuses them
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the files "extent_test" and "extent_test2"
+ * Coverage: extent_lookup, extent_map_invalidate, inode_data_blocks, read_data, truncate_data
+ * Files: filesys.c/h
+ */
+int extent_truncate_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"extent_test";
+	const uint8_t* fname2 = (uint8_t*)"extent_test2";
+	static uint8_t buf[3 * BLOCK_SIZE];
+	dentry_t dentry, dentry2;
+	stat_t st;
+	uint32_t i;
+	int result = PASS;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	for(i = 0; i < 3; i++) memset(buf + i * BLOCK_SIZE, 'a' + i, BLOCK_SIZE);
+	if(write_data(dentry.inode, 0, buf, sizeof(buf)) != sizeof(buf)) result = FAIL;
+	if(read_data(dentry.inode, 0, buf, sizeof(buf)) != sizeof(buf) || buf[2 * BLOCK_SIZE] != 'c') result = FAIL;	// the map is cached
+	if(file_stat(2, dentry.inode, &st) == -1 || st.blocks != 3) result = FAIL;				// and so is the block count
+	if(truncate_data(dentry.inode, BLOCK_SIZE) == -1) result = FAIL;
+	if(read_data(dentry.inode, 0, buf, sizeof(buf)) != BLOCK_SIZE) result = FAIL;
+	if(file_stat(2, dentry.inode, &st) == -1 || st.blocks != 1) result = FAIL;				// the cached count went with the extents
+	memset(buf, 'x', sizeof(buf));
+	if(create_file(fname2) == -1 || read_dentry_by_name(fname2, &dentry2) == -1) result = FAIL;
+	else if(write_data(dentry2.inode, 0, buf, sizeof(buf)) != sizeof(buf)) result = FAIL;		// may take the freed blocks
+	if(truncate_data(dentry.inode, sizeof(buf)) == -1) result = FAIL;
+	if(read_data(dentry.inode, 0, buf, sizeof(buf)) != sizeof(buf)) result = FAIL;
+	if(buf[BLOCK_SIZE - 1] != 'a') result = FAIL;
+	for(i = BLOCK_SIZE; i < sizeof(buf); i++){
+		if(buf[i] != 0) result = FAIL;									// a hole, not a stale extent
+	}
+	unlink_file(fname);
+	unlink_file(fname2);
+	return result;
+}
+
+/* count the busy blocks of the free-block bitmap */
+static uint32_t busy_blocks(){
+	uint32_t i, count = 0;
+	for(i = 0; i < MAX_DATA_BLOCKS; i++){
+		if(data_blocks_bitmap[i / 32] & (1U << (i % 32))) count++;
+	}
+	return count;
+}
+
+/* bitmap_alloc_test
+ * Asserts that alloc_blocks hands out a run of free blocks and marks them busy,
+ * that free_block clears them once and ignores a second free, and that a
+ * freed block can be allocated again
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: allocates and frees data blocks
+ * Coverage: alloc_blocks, free_block
+ * Files: filesys.c/h
+ */
+int bitmap_alloc_test(){
+	TEST_HEADER;
+	uint32_t i, run, run2, busy = busy_blocks();
+	int32_t D, D2;
+	int result = PASS;
+	if(alloc_blocks(0, &run) != -1 || run != 0) result = FAIL;
+	D = alloc_blocks(4, &run);
+	if(D == -1 || run == 0 || run > 4) return FAIL;
+	for(i = 0; i < run; i++){
+		if(!(data_blocks_bitmap[(D + i) / 32] & (1U << ((D + i) % 32)))) result = FAIL;
+	}
+	if(busy_blocks() != busy + run) result = FAIL;
+	for(i = 0; i < run; i++) free_block(D + i);
+	if(busy_blocks() != busy) result = FAIL;
+	free_block(D);														// already free
+	if(busy_blocks() != busy) result = FAIL;
+	D2 = alloc_blocks(run, &run2);
+	if(D2 == -1 || run2 == 0) return FAIL;
+	if(busy_blocks() != busy + run2) result = FAIL;
+	for(i = 0; i < run2; i++) free_block(D2 + i);
+	if(busy_blocks() != busy) result = FAIL;
+	return result;
+}
+
+/* bcache_test
+ * Asserts that repeated small reads of a file are served from the block cache
+ * Inputs: fname - a file of at least one byte
+ * Outputs: cache counters/PASS/FAIL
+ * Side Effects: None
+ * Coverage: bcache_read, read_data
+ * Files: bcache.c/h, filesys.c/h
+ */
+int bcache_test(const char* fname){
+	TEST_HEADER;
+	dentry_t dentry;
+	uint8_t first[4], second[4];
+	if(read_dentry_by_name((const uint8_t*)fname, &dentry) == -1) return FAIL;
+	read_data(dentry.inode, 0, first, 4);								// miss, the block gets a buffer
+	uint32_t hits = bcache_stats.hits;
+	read_data(dentry.inode, 0, second, 4);								// hit
+	printf("hits %d, misses %d, bypasses %d, evictions %d, writebacks %d\n", bcache_stats.hits, bcache_stats.misses,
+		bcache_stats.bypasses, bcache_stats.evictions, bcache_stats.writebacks);
+	if(bcache_stats.hits != hits + 1) return FAIL;
+	if(memcmp(first, second, 4)) return FAIL;
+	return PASS;
+}
+
+/* mmap_test
+ * Asserts that every block mmap would map holds the same bytes read_data returns
+ * Inputs: fname - a regular file
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: map_file_block, unmap_file_block, bcache_map
+ * Files: filesys.c/h, bcache.c/h
+ */
+int mmap_test(const char* fname){
+	TEST_HEADER;
+	dentry_t dentry;
+	static uint8_t buf[BLOCK_SIZE];
+	uint32_t i, len;
+	int result = PASS;
+	if(read_dentry_by_name((const uint8_t*)fname, &dentry) == -1) return FAIL;
+	for(i = 0; result == PASS && (len = read_data(dentry.inode, i * BLOCK_SIZE, buf, BLOCK_SIZE)) > 0; i++){
+		uint8_t* block = map_file_block(dentry.inode, i);
+		if(block == NULL) return FAIL;
+		if(((uint32_t)block & (BLOCK_SIZE - 1)) || memcmp(block, buf, len)) result = FAIL;	// mmap needs page aligned blocks
+		unmap_file_block(block);
+	}
+	if(result == PASS && map_file_block(dentry.inode, i) != NULL) result = FAIL;	// nothing past the end of the file
+	return result;
+}
+
+/* mmap_pin_test
+ * Asserts that a mapped block keeps its bytes through a write, a truncate and
+ * an unlink of its file, and only goes back to the bitmap once it is unmapped
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the files "pin_test" and "pin_test2"
+ * Coverage: map_file_block, unmap_file_block, free_block, write_data, truncate_data
+ * Files: filesys.c/h
+ */
+int mmap_pin_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"pin_test";
+	const uint8_t* fname2 = (uint8_t*)"pin_test2";
+	static uint8_t buf[BLOCK_SIZE];
+	static uint8_t other[BLOCK_SIZE];
+	dentry_t dentry;
+	uint8_t* block;
+	uint32_t D;
+	int result = PASS;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	memset(buf, 'p', sizeof(buf));
+	buf[0] = '\0';														// memcmp must look past it
+	if(write_data(dentry.inode, 0, buf, sizeof(buf)) != sizeof(buf) || (block = map_file_block(dentry.inode, 0)) == NULL){
+		unlink_file(fname);
+		return FAIL;
+	}
+	D = inode_ptr[dentry.inode].data_blocks[0];
+	memset(other, 'q', sizeof(other));
+	if(write_data(dentry.inode, 0, other, sizeof(other)) != sizeof(other)) result = FAIL;
+	if(inode_ptr[dentry.inode].data_blocks[0] == D) result = FAIL;			// the write copied the mapped block
+	if(memcmp(block, buf, sizeof(buf))) result = FAIL;
+	truncate_data(dentry.inode, 0);
+	unlink_file(fname);
+	if(!(data_blocks_bitmap[D / 32] & (1U << (D % 32)))) result = FAIL;		// still mapped, not free
+	if(create_file(fname2) == -1 || read_dentry_by_name(fname2, &dentry) == -1) result = FAIL;
+	else if(write_data(dentry.inode, 0, other, sizeof(other)) != sizeof(other)) result = FAIL;
+	if(memcmp(block, buf, sizeof(buf))) result = FAIL;						// no other file reused it
+	unlink_file(fname2);
+	unmap_file_block(block);
+	if(data_blocks_bitmap[D / 32] & (1U << (D % 32))) result = FAIL;			// the last reference is gone
+	return result;
+}
+
+/* demand_paging_test
+ * Asserts that a program gets frames only for the pages it touches: an image
+ * page is read from the executable and a stack page reads as zeros
+ * Inputs: fname - an executable
+ * Outputs: PASS/FAIL
+ * Side Effects: runs the address space of fname in a free pid, restored on return
+ * Coverage: init_user_paging, demand_page_fault, free_user_paging
+ * Files: paging.c/h, idt.c
+ */
+int demand_paging_test(const char* fname){
+	TEST_HEADER;
+	static uint8_t buf[PAGE_SIZE];
+	dentry_t dentry;
+	uint32_t i, flags, pid, len, present = 0;
+	uint32_t free_pages = buddy_stats.free_pages;
+	uint32_t cr3 = read_cr3();
+	int8_t old_process = cur_process;
+	uint8_t* image = (uint8_t*)user_img_addr;
+	uint32_t* stack = (uint32_t*)(user_virt_addr + SIZE_4MB - PAGE_SIZE);		// the top page, where the user stack starts
+	page_table_entry_t* tbl;
+	pcb_t* pcb;
+	int result = PASS;
+	if(read_dentry_by_name((const uint8_t*)fname, &dentry) == -1) return FAIL;
+	for(pid = 0; pid < MAX_PROCESS && process_array[pid]; pid++);
+	if(pid == MAX_PROCESS) return FAIL;
+	pcb = (pcb_t*)buddy_alloc(KERNEL_STACK_ORDER);
+	if(pcb == NULL) return FAIL;
+	memset(pcb, 0, sizeof(pcb_t));										// no pending signal for do_signal after the faults
+	pcb->pid = pid;
+	pcb->exe_inode = dentry.inode;
+	pcb->image_pages = (inode_ptr[dentry.inode].length + PAGE_SIZE - 1) / PAGE_SIZE;
+	pcb->faulted_pages = 0;
+	pcb->pgdir = init_user_paging(inode_ptr[dentry.inode].length);
+	if(pcb->pgdir == NULL){
+		buddy_free((uint32_t)pcb);
+		return FAIL;
+	}
+	tbl = user_page_table(pcb->pgdir, user_virt_addr);
+
+	cli_and_save(flags);												// the scheduler must not see the borrowed pid
+	pcb_ptr[pid] = pcb;
+	cur_process = pid;
+	set_user_paging(pid);
+	if(memcmp(image, "\177ELF", 4)) result = FAIL;						// faults the first image page in
+	len = read_data(dentry.inode, 0, buf, PAGE_SIZE);
+	if(len == 0 || len > PAGE_SIZE || memcmp(image, buf, len)) result = FAIL;
+	for(i = 0; i < PAGE_SIZE / 4; i++){
+		if(stack[i] != 0) result = FAIL;								// a zero-fill page
+	}
+	cur_process = old_process;
+	load_page_directory(cr3);
+	pcb_ptr[pid] = NULL;
+	restore_flags(flags);
+
+	for(i = 0; i < DIR_TBL_SIZE; i++){
+		if(tbl[i].present) present++;
+	}
+	if(present != 2 || pcb->faulted_pages != 1) result = FAIL;				// only the two pages touched
+	if(!tbl[(user_img_addr - user_virt_addr) / PAGE_SIZE].present || !tbl[DIR_TBL_SIZE - 1].present) result = FAIL;
+	free_user_paging(pcb->pgdir);
+	buddy_free((uint32_t)pcb);
+	if(buddy_stats.free_pages != free_pages) result = FAIL;
+	return result;
+}
+
+/* create_unlink_test
+ * Asserts that create/truncate/unlink keep the directory consistent and that
+ * an unlinked file gives its inode back for reuse
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "create_test"
+ * Coverage: create_file, truncate_data, unlink_file, alloc_inode, free_inode
+ * Files: filesys.c/h
+ */
+int create_unlink_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"create_test";
+	static uint8_t buf[2 * BLOCK_SIZE];
+	dentry_t dentry;
+	uint32_t inode, num_entries = boot_block_ptr->num_dir_entries;
+	if(create_file(fname) == -1) return FAIL;
+	if(create_file(fname) != -1) return FAIL;							// names are unique
+	if(read_dentry_by_name(fname, &dentry) == -1 || inode_ptr[dentry.inode].length != 0) return FAIL;
+	inode = dentry.inode;
+	memset(buf, 'a', sizeof(buf));
+	if(write_data(inode, 0, buf, sizeof(buf)) != sizeof(buf)) return FAIL;
+	if(truncate_data(inode, 10) == -1 || inode_ptr[inode].length != 10) return FAIL;
+	if(truncate_data(inode, 20) == -1 || read_data(inode, 0, buf, sizeof(buf)) != 20) return FAIL;
+	if(buf[9] != 'a' || buf[10] != '\0') return FAIL;						// grown bytes read back as zeros
+	if(unlink_file(fname) == -1 || read_dentry_by_name(fname, &dentry) != -1) return FAIL;
+	if(boot_block_ptr->num_dir_entries != num_entries) return FAIL;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	unlink_file(fname);
+	if(dentry.inode != inode) return FAIL;								// the first free inode is reused
+	return PASS;
+}
+
+/* the fd based calls need a pcb, the tests run before any process does */
+static int test_process_enter(pcb_t* pcb, int8_t* old_process){
+	uint8_t pid;
+	for(pid = 0; pid < MAX_PROCESS && process_array[pid]; pid++);
+	if(pid == MAX_PROCESS) return FAIL;
+	memset(pcb, 0, sizeof(pcb_t));										// every fd closed
+	pcb->pid = pid;
+	pcb_ptr[pid] = pcb;
+	*old_process = cur_process;
+	cur_process = pid;
+	return PASS;
+}
+static void test_process_leave(pcb_t* pcb, int8_t old_process){
+	pcb_ptr[pcb->pid] = NULL;
+	cur_process = old_process;
+}
+
+/* getdents_test
+ * Asserts that getdents called with room for a few records at a time returns
+ * every dentry of the directory once, in order, then 0 at the end
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the files "getdents_0" to "getdents_4"
+ * Coverage: getdents, dir_getdents, file_stat
+ * Files: system_call.c/h, filesys.c/h
+ */
+int getdents_test(){
+	TEST_HEADER;
+	static pcb_t pcb;
+	uint8_t fname[] = "getdents_0";
+	dirent_t records[2];
+	dentry_t dentry;
+	uint32_t i, k, index = 0, found = 0;
+	int32_t fd, bytes;
+	int8_t old_process;
+	int result = PASS;
+	for(i = 0; i < 5; i++){
+		fname[9] = '0' + i;
+		if(create_file(fname) == -1) result = FAIL;
+	}
+	if(test_process_enter(&pcb, &old_process) == FAIL) return FAIL;
+	fd = open((uint8_t*)".");
+	if(fd == -1 || getdents(fd, records, sizeof(dirent_t) - 1) != -1) result = FAIL;	// no room for one record
+	while(fd != -1 && (bytes = getdents(fd, records, sizeof(records))) > 0){
+		if(bytes % sizeof(dirent_t) != 0) result = FAIL;
+		for(k = 0; k < bytes / sizeof(dirent_t); k++, index++){
+			if(dir_entry_read(DIR_INODE, index, &dentry) == -1) result = FAIL;		// more records than dentries
+			else if(strncmp((int8_t*)records[k].file_name, (int8_t*)dentry.file_name, MAX_FILENAME_LEN) || records[k].inode != dentry.inode) result = FAIL;
+			if(!strncmp((int8_t*)records[k].file_name, "getdents_", 9)) found++;
+		}
+	}
+	if(fd == -1 || bytes != 0 || getdents(fd, records, sizeof(records)) != 0) result = FAIL;	// stays at the end
+	if(index != dir_entries(DIR_INODE) || found != 5) result = FAIL;					// nothing skipped or repeated
+	if(fd != -1) close(fd);
+	test_process_leave(&pcb, old_process);
+	for(i = 0; i < 5; i++){
+		fname[9] = '0' + i;
+		unlink_file(fname);
+	}
+	return result;
+}
+
+/* write_offset_test
+ * Asserts that write_data overwrites in place and zero-fills a gap past the end
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "offset_test"
+ * Coverage: write_data, read_data
+ * Files: filesys.c/h
+ */
+int write_offset_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"offset_test";
+	dentry_t dentry;
+	uint8_t buf[16];
+	int result = PASS;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	if(write_data(dentry.inode, 0, (uint8_t*)"hello", 5) != 5) result = FAIL;
+	if(write_data(dentry.inode, 1, (uint8_t*)"EL", 2) != 2) result = FAIL;		// overwrite, no growth
+	if(inode_ptr[dentry.inode].length != 5) result = FAIL;
+	if(write_data(dentry.inode, 8, (uint8_t*)"!", 1) != 1) result = FAIL;			// leaves a 3 byte gap
+	if(read_data(dentry.inode, 0, buf, sizeof(buf)) != 9) result = FAIL;
+	if(strncmp((int8_t*)buf, "hELlo", 5) || buf[5] != 0 || buf[7] != 0 || buf[8] != '!') result = FAIL;
+	unlink_file(fname);
+	return result;
+}
+
+/* readv_writev_test
+ * Asserts that writev appends scattered buffers in order, skipping an empty
+ * one, and that readv fills a vector up to the end of the file, stopping at
+ * the buffer where the file ends
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "iov_test"
+ * Coverage: readv, writev, file_readv, file_writev, lseek
+ * Files: system_call.c/h, filesys.c/h
+ */
+int readv_writev_test(){
+	TEST_HEADER;
+	static pcb_t pcb;
+	const uint8_t* fname = (uint8_t*)"iov_test";
+	uint8_t a[3], b[4], c[8], d[4];
+	iovec_t out[4] = {{"abc", 3}, {"", 0}, {"defg", 4}, {"hij", 3}};
+	iovec_t in[5] = {{a, sizeof(a)}, {NULL, 0}, {b, sizeof(b)}, {c, sizeof(c)}, {d, sizeof(d)}};
+	int32_t fd;
+	int8_t old_process;
+	int result = PASS;
+	if(create_file(fname) == -1) return FAIL;
+	if(test_process_enter(&pcb, &old_process) == FAIL){
+		unlink_file(fname);
+		return FAIL;
+	}
+	fd = open(fname);
+	if(fd == -1 || writev(fd, out, 4) != 10) result = FAIL;
+	memset(c, '.', sizeof(c));
+	memset(d, '.', sizeof(d));
+	if(fd == -1 || lseek(fd, 0, SEEK_SET) != 0 || readv(fd, in, 5) != 10) result = FAIL;	// c gets 3 of its 8 bytes
+	if(memcmp(a, "abc", 3) || memcmp(b, "defg", 4) || memcmp(c, "hij.....", 8)) result = FAIL;
+	if(memcmp(d, "....", 4)) result = FAIL;								// nothing read after the short buffer
+	if(fd != -1 && readv(fd, in, 5) != 0) result = FAIL;						// at the end of the file
+	if(fd != -1) close(fd);
+	test_process_leave(&pcb, old_process);
+	unlink_file(fname);
+	return result;
+}
+
+/* name_index_test
+ * Asserts that prefix search over the sorted name index counts matches
+ * and that the cached exec bit tells executables from data files
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: name_index_prefix, is_executable, find_similar_file
+ * Files: filesys.c/h
+ */
+int name_index_test(){
+	TEST_HEADER;
+	uint32_t index;
+	dentry_t dentry;
+	char completion[MAX_FILENAME_LEN + 1];
+	if(name_index_prefix((uint8_t*)"frame", 5, &index) != 2) return FAIL;				// frame0.txt, frame1.txt
+	if(name_index_prefix((uint8_t*)"fis", 3, &index) != 1) return FAIL;
+	if(strncmp((int8_t*)all_file_names[index], "fish", 5)) return FAIL;
+	if(name_index_prefix((uint8_t*)"zzz", 3, &index) != 0) return FAIL;
+	if(read_dentry_by_name((uint8_t*)"fish", &dentry) == -1 || !is_executable(dentry.inode)) return FAIL;
+	if(read_dentry_by_name((uint8_t*)"frame0.txt", &dentry) == -1 || is_executable(dentry.inode)) return FAIL;
+	if(find_similar_file("she", completion) != 0 || strncmp(completion, "shell", 6)) return FAIL;
+	if(find_similar_file("frame", completion) != 1) return FAIL;					// ambiguous
+	return PASS;
+}
+
+/* sparse_file_test
+ * Asserts that a write far past the end leaves a hole that reads as zeros
+ * and only allocates the blocks written and the indirect blocks on the way
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "sparse_test"
+ * Coverage: write_data, read_data, truncate_data, map_file_block
+ * Files: filesys.c/h
+ */
+int sparse_file_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"sparse_test";
+	const uint32_t offset = (NUM_DIRECT_BLOCKS + PTRS_PER_BLOCK + 10) * BLOCK_SIZE;	// in the double indirect range
+	dentry_t dentry;
+	uint8_t buf[16];
+	uint32_t i;
+	int result = PASS;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	if(write_data(dentry.inode, offset, (uint8_t*)"end", 3) != 3) result = FAIL;
+	if(inode_ptr[dentry.inode].length != offset + 3) result = FAIL;
+	if(inode_ptr[dentry.inode].data_blocks[0] != BLOCK_HOLE) result = FAIL;		// nothing before the write has storage
+	if(inode_ptr[dentry.inode].single_indirect != BLOCK_HOLE) result = FAIL;
+	if(inode_ptr[dentry.inode].double_indirect == BLOCK_HOLE) result = FAIL;
+	if(read_data(dentry.inode, offset - 8, buf, sizeof(buf)) != 11) result = FAIL;
+	for(i = 0; i < 8; i++) if(buf[i] != 0) result = FAIL;
+	if(strncmp((int8_t*)buf + 8, "end", 3)) result = FAIL;
+	if(map_file_block(dentry.inode, 0) == NULL) result = FAIL;				// holes map to the zero block
+	if(truncate_data(dentry.inode, 1) == -1 || inode_ptr[dentry.inode].double_indirect != BLOCK_HOLE) result = FAIL;
+	unlink_file(fname);
+	return result;
+}
+
+/* clone_test
+ * Asserts that a clone shares the data blocks of its source and that a
+ * write into the clone copies only the block written
+ * Inputs: fname - a file of at least two blocks
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "clone_test"
+ * Coverage: clone_data, write_data, free_block
+ * Files: filesys.c/h
+ */
+int clone_test(const char* fname){
+	TEST_HEADER;
+	const uint8_t* cname = (uint8_t*)"clone_test";
+	dentry_t src, dst;
+	uint8_t before[4], after[4];
+	int result = PASS;
+	if(read_dentry_by_name((uint8_t*)fname, &src) == -1 || inode_ptr[src.inode].length <= BLOCK_SIZE) return FAIL;
+	if(create_file(cname) == -1 || read_dentry_by_name(cname, &dst) == -1) return FAIL;
+	if(clone_data(src.inode, dst.inode) == -1) result = FAIL;
+	if(inode_ptr[dst.inode].length != inode_ptr[src.inode].length) result = FAIL;
+	if(inode_ptr[dst.inode].data_blocks[0] != inode_ptr[src.inode].data_blocks[0]) result = FAIL;	// shared, nothing copied
+	read_data(src.inode, 0, before, 4);
+	if(write_data(dst.inode, 0, (uint8_t*)"COW!", 4) != 4) result = FAIL;
+	if(inode_ptr[dst.inode].data_blocks[0] == inode_ptr[src.inode].data_blocks[0]) result = FAIL;	// the written block was copied
+	if(inode_ptr[dst.inode].data_blocks[1] != inode_ptr[src.inode].data_blocks[1]) result = FAIL;	// the others are still shared
+	read_data(src.inode, 0, after, 4);
+	if(memcmp(before, after, 4)) result = FAIL;											// the source is untouched
+	unlink_file(cname);
+	return result;
+}
+
+/* dir_spill_test
+ * Asserts that the directory spills past the boot block into directory
+ * blocks, that spilled dentries are found through the index, and that the
+ * directory block is freed once the files are removed
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the files "spill_NNN"
+ * Coverage: create_file, unlink_file, read_dentry_by_index, dentry_index_lookup
+ * Files: filesys.c/h
+ */
+int dir_spill_test(){
+	TEST_HEADER;
+	uint8_t fname[MAX_FILENAME_LEN + 1] = {"spill_000"};
+	uint32_t i, created, num_entries = boot_block_ptr->num_dir_entries;
+	uint32_t dir_length = inode_ptr[DIR_INODE].length;
+	int32_t index;
+	dentry_t dentry;
+	int result = PASS;
+	for(created = 0; created < 100; created++){						// until the inodes run out
+		fname[6] = '0' + created / 100;
+		fname[7] = '0' + (created / 10) % 10;
+		fname[8] = '0' + created % 10;
+		if(create_file(fname) == -1) break;
+	}
+	if(boot_block_ptr->num_dir_entries <= MAX_FILES_NUMBER) {
+		printf("not enough free inodes to fill the boot block\n");
+		result = FAIL;
+	}
+	else if(inode_ptr[DIR_INODE].length == dir_length) result = FAIL;		// no directory block was chained
+	for(i = 0; i < created; i++){
+		fname[6] = '0' + i / 100;
+		fname[7] = '0' + (i / 10) % 10;
+		fname[8] = '0' + i % 10;
+		index = dentry_index_lookup(fname);
+		if(index == DENTRY_NONE || read_dentry_by_index(index, &dentry) == -1) result = FAIL;
+		else if(strncmp((int8_t*)dentry.file_name, (int8_t*)fname, MAX_FILENAME_LEN)) result = FAIL;
+	}
+	for(i = 0; i < created; i++){										// the first ones are removed first, moving the spilled ones back
+		fname[6] = '0' + i / 100;
+		fname[7] = '0' + (i / 10) % 10;
+		fname[8] = '0' + i % 10;
+		if(unlink_file(fname) == -1) result = FAIL;
+	}
+	if(boot_block_ptr->num_dir_entries != num_entries) result = FAIL;
+	if(inode_ptr[DIR_INODE].length != dir_length) result = FAIL;			// the empty directory block is freed
+	return result;
+}
+
+/* compress_bench
+ * Reports how many blocks the compressed files of the image save, and how
+ * fast read_data decompresses them, cold and from the cluster cache
+ * Inputs: None
+ * Outputs: compression ratio, cycles per KB/PASS/FAIL
+ * Side Effects: None
+ * Coverage: read_data, cluster cache, lz_decompress, inode_data_blocks
+ * Files: filesys.c/h, lz.c/h
+ */
+int compress_bench(){
+	TEST_HEADER;
+	static uint8_t cold[CLUSTER_SIZE], warm[CLUSTER_SIZE];				// two 32KB clusters, the kernel stack is 8KB
+	uint32_t i, offset, chunk, start, cold_cycles = 0, warm_cycles = 0;
+	uint32_t file_blocks = 0, stored_blocks = 0, packed_bytes = 0, packed_inode = 0, hits;
+	int32_t n;
+	dentry_t dentry;
+	int result = PASS;
+
+	for(i = 0; i < boot_block_ptr->num_dir_entries; i++){
+		if(read_dentry_by_index(i, &dentry) == -1 || dentry.file_type != 2) continue;
+		uint32_t length = inode_ptr[dentry.inode].length;
+		uint32_t nblocks = length / BLOCK_SIZE + (length % BLOCK_SIZE != 0);
+		uint32_t stored = inode_data_blocks(dentry.inode);
+		file_blocks += nblocks;
+		stored_blocks += stored;
+		if(stored >= nblocks) continue;									// every block stored, nothing saved
+		packed_inode = dentry.inode;
+		for(offset = 0; offset < length; offset += chunk){
+			extent_map_invalidate(dentry.inode);						// drop the decompressed clusters
+			start = rdtsc();
+			n = read_data(dentry.inode, offset, cold, CLUSTER_SIZE);
+			cold_cycles += rdtsc() - start;
+			chunk = (n > 0) ? n : CLUSTER_SIZE;
+			start = rdtsc();
+			if(read_data(dentry.inode, offset, warm, CLUSTER_SIZE) != n) result = FAIL;
+			warm_cycles += rdtsc() - start;
+			if(n <= 0 || memcmp(cold, warm, n)) result = FAIL;
+			packed_bytes += chunk;
+		}
+	}
+	if(packed_bytes == 0){
+		printf("no compressed file, build the image with tools/mkfs -z\n");
+		return result;
+	}
+
+	hits = cluster_stats.hits;
+	for(i = 0; i < 64; i++) read_data(packed_inode, 0, cold, 64);		// small reads of the last compressed file
+	if(cluster_stats.hits - hits < 63) result = FAIL;					// decompressed once at most
+
+	printf("%d file blocks stored in %d blocks (%d%%)\n", file_blocks, stored_blocks, stored_blocks * 100 / file_blocks);
+	printf("%d KB: decompress %d cycles/KB, cached %d cycles/KB\n", packed_bytes / 1024,
+		cold_cycles / (packed_bytes / 1024 + 1), warm_cycles / (packed_bytes / 1024 + 1));
+	return result;
+}
+
+/* dedup_test
+ * Asserts that two files written with the same blocks share them, and
+ * that a write into one of them copies the block first
+ * Inputs: None
+ * Outputs: deduplication counters/PASS/FAIL
+ * Side Effects: creates and removes the files "dedup_a" and "dedup_b"
+ * Coverage: write_data, dedup_block, block_needs_copy
+ * Files: filesys.c/h
+ */
+int dedup_test(){
+	TEST_HEADER;
+	static uint8_t data[2 * BLOCK_SIZE];
+	const uint8_t* aname = (uint8_t*)"dedup_a";
+	const uint8_t* bname = (uint8_t*)"dedup_b";
+	uint32_t i, saved = dedup_stats.bytes_saved;
+	uint8_t c;
+	dentry_t a, b;
+	int result = PASS;
+	for(i = 0; i < sizeof(data); i++) data[i] = i * 7 + i / 251;
+	if(create_file(aname) == -1 || create_file(bname) == -1) return FAIL;
+	read_dentry_by_name(aname, &a);
+	read_dentry_by_name(bname, &b);
+	if(write_data(a.inode, 0, data, sizeof(data)) != sizeof(data)) result = FAIL;
+	if(write_data(b.inode, 0, data, sizeof(data)) != sizeof(data)) result = FAIL;
+	if(inode_ptr[a.inode].data_blocks[1] != inode_ptr[b.inode].data_blocks[1]) result = FAIL;	// b took a's blocks
+	if(dedup_stats.bytes_saved - saved < sizeof(data)) result = FAIL;
+	if(write_data(b.inode, BLOCK_SIZE, (uint8_t*)"X", 1) != 1) result = FAIL;
+	if(inode_ptr[a.inode].data_blocks[1] == inode_ptr[b.inode].data_blocks[1]) result = FAIL;	// copied before the write
+	if(read_data(a.inode, BLOCK_SIZE, &c, 1) != 1 || c != data[BLOCK_SIZE]) result = FAIL;
+	printf("hashed %d, merged %d, zero blocks %d, %d bytes saved\n", dedup_stats.hashed, dedup_stats.merged,
+		dedup_stats.zeroed, dedup_stats.bytes_saved);
+	unlink_file(aname);
+	unlink_file(bname);
+	return result;
+}
+
+/* inline_test
+ * Asserts that a small file keeps its bytes in the inode, and that the
+ * last block moves to a data block and back as the file grows and shrinks
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "inline_a"
+ * Coverage: write_data, truncate_data, inline_pack, inline_unpack
+ * Files: filesys.c/h
+ */
+int inline_test(){
+	TEST_HEADER;
+	static uint8_t data[BLOCK_SIZE + 1000];
+	static uint8_t check[BLOCK_SIZE + 1000];
+	const uint8_t* name = (uint8_t*)"inline_a";
+	uint32_t i, blocks;
+	dentry_t a;
+	int result = PASS;
+	for(i = 0; i < sizeof(data); i++) data[i] = i * 5 + i / 253;
+	if(create_file(name) == -1) return FAIL;
+	read_dentry_by_name(name, &a);
+	if(write_data(a.inode, 0, data, 100) != 100) result = FAIL;
+	if(inode_ptr[a.inode].data_blocks[0] != BLOCK_INLINE) result = FAIL;	// 100 bytes take no data block
+	if(inode_data_blocks(a.inode) != 0) result = FAIL;
+	if(read_data(a.inode, 0, check, 100) != 100) result = FAIL;
+	for(i = 0; i < 100; i++) if(check[i] != data[i]) result = FAIL;
+	if(write_data(a.inode, 100, data + 100, sizeof(data) - 100) != sizeof(data) - 100) result = FAIL;
+	if(inode_ptr[a.inode].data_blocks[0] == BLOCK_INLINE) result = FAIL;	// the first block filled up
+	if(inode_ptr[a.inode].data_blocks[1] != BLOCK_INLINE) result = FAIL;	// the 1000 byte tail stays inline
+	blocks = inode_data_blocks(a.inode);
+	if(read_data(a.inode, 0, check, sizeof(data)) != sizeof(data)) result = FAIL;
+	for(i = 0; i < sizeof(data); i++) if(check[i] != data[i]) result = FAIL;
+	if(truncate_data(a.inode, 50) == -1) result = FAIL;
+	if(inode_ptr[a.inode].data_blocks[0] != BLOCK_INLINE) result = FAIL;	// packed back after the shrink
+	if(read_data(a.inode, 0, check, 100) != 50) result = FAIL;
+	for(i = 0; i < 50; i++) if(check[i] != data[i]) result = FAIL;
+	printf("%d data block(s) at %d bytes, %d inline bytes for one block\n", blocks, sizeof(data), INLINE_CAPACITY(0));
+	unlink_file(name);
+	return result;
+}
+
+/* crc_bench
+ * Reports the CRC32C throughput of the table method and of the SSE4.2
+ * instruction, and what checking the blocks costs read_data the first time
+ * and once they are in the verified cache
+ * Inputs: None
+ * Outputs: cycles per KB of each method/PASS/FAIL
+ * Side Effects: creates and removes the file "crc_bench"
+ * Coverage: crc32c_sw, crc32c_hw, read_data, block_verify, filesys_scrub
+ * Files: filesys.c/h, crc32c.c/h
+ */
+int crc_bench(){
+	TEST_HEADER;
+	static uint8_t data[16 * BLOCK_SIZE], check[16 * BLOCK_SIZE];		// 128KB in all, in bss rather than on an 8KB stack
+	const uint8_t* name = (uint8_t*)"crc_bench";
+	uint32_t i, start, sw_cycles, hw_cycles = 0, off_cycles, cold_cycles, warm_cycles;
+	uint32_t kb = sizeof(data) / 1024, verified, bad = crc_stats.bad;
+	dentry_t dentry;
+	int result = PASS;
+
+	for(i = 0; i < sizeof(data); i++) data[i] = i * 11 + i / 509;
+	if(crc32c_sw(0, (uint8_t*)"123456789", 9) != 0xE3069283) result = FAIL;	// the CRC32C check value
+	if(crc32c_sse42 && crc32c_hw(0, (uint8_t*)"123456789", 9) != 0xE3069283) result = FAIL;
+	if(crc32c_sse42 && crc32c_hw(0, data, sizeof(data)) != crc32c_sw(0, data, sizeof(data))) result = FAIL;
+	start = rdtsc();
+	crc32c_sw(0, data, sizeof(data));
+	sw_cycles = rdtsc() - start;
+	if(crc32c_sse42){
+		start = rdtsc();
+		crc32c_hw(0, data, sizeof(data));
+		hw_cycles = rdtsc() - start;
+	}
+
+	if(create_file(name) == -1) return FAIL;
+	read_dentry_by_name(name, &dentry);
+	if(write_data(dentry.inode, 0, data, sizeof(data)) != sizeof(data)) result = FAIL;
+	verified = crc_stats.verified;
+	start = rdtsc();
+	if(read_data(dentry.inode, 0, check, sizeof(data)) != sizeof(data)) result = FAIL;	// checks every block once
+	cold_cycles = rdtsc() - start;
+	if(crc_stats.verified == verified) result = FAIL;
+	verified = crc_stats.verified;
+	start = rdtsc();
+	if(read_data(dentry.inode, 0, check, sizeof(data)) != sizeof(data)) result = FAIL;	// served by the verified cache
+	warm_cycles = rdtsc() - start;
+	if(crc_stats.verified != verified) result = FAIL;
+	crc_verify_reads = 0;
+	start = rdtsc();
+	if(read_data(dentry.inode, 0, check, sizeof(data)) != sizeof(data)) result = FAIL;
+	off_cycles = rdtsc() - start;
+	crc_verify_reads = 1;
+	for(i = 0; i < sizeof(data); i++) if(check[i] != data[i]) result = FAIL;
+	if(filesys_scrub(boot_block_ptr->num_data_blocks) != 0 || crc_stats.bad != bad) result = FAIL;
+
+	printf("crc32c: tables %d cycles/KB, sse4.2 %d cycles/KB%s\n", sw_cycles / kb, hw_cycles / kb, crc32c_sse42 ? "" : " (not supported)");
+	printf("read_data: no check %d, first check %d, verified cache %d cycles/KB\n", off_cycles / kb, cold_cycles / kb, warm_cycles / kb);
+	unlink_file(name);
+	return result;
+}
+
+/* dcache_test
+ * Asserts that paths reach files in subdirectories, that repeated lookups of
+ * existing and missing names are served by the dentry cache, and that only
+ * empty directories can be removed
+ * Inputs: None
+ * Outputs: the dentry cache counters and hit rate/FAIL
+ * Side Effects: creates and removes the directory "dcache_dir" and its files
+ * Coverage: path_lookup, make_dir, create_file, unlink_file, dir_entries, dir_entry_read, dcache_hit_rate
+ * Files: filesys.c/h
+ */
+int dcache_test(){
+	TEST_HEADER;
+	dentry_t dentry, dir;
+	uint32_t i, misses;
+	int result = PASS;
+	if(make_dir((uint8_t*)"dcache_dir") == -1) return FAIL;
+	if(make_dir((uint8_t*)"dcache_dir/sub") == -1 || create_file((uint8_t*)"dcache_dir/sub/file") == -1) result = FAIL;
+	if(read_dentry_by_name((uint8_t*)"dcache_dir", &dir) == -1 || dir.file_type != 1) result = FAIL;
+	if(dir_entries(dir.inode) != 1 || dir_entry_read(dir.inode, 0, &dentry) == -1 || dentry.file_type != 1) result = FAIL;
+	if(read_dentry_by_name((uint8_t*)"/dcache_dir//sub/./file", &dentry) == -1 || dentry.file_type != 2) result = FAIL;
+	if(read_dentry_by_name((uint8_t*)"dcache_dir/sub/file/x", &dentry) != -1) result = FAIL;	// a file has no names under it
+	read_dentry_by_name((uint8_t*)"dcache_dir/sub/missing", &dentry);
+	misses = dcache_stats.misses;
+	for(i = 0; i < 1000; i++){
+		if(read_dentry_by_name((uint8_t*)"dcache_dir/sub/file", &dentry) == -1) result = FAIL;
+		if(read_dentry_by_name((uint8_t*)"dcache_dir/sub/missing", &dentry) != -1) result = FAIL;
+	}
+	if(dcache_stats.misses != misses) result = FAIL;							// no directory was searched
+	printf("dcache: %d hits, %d negative hits, %d misses, %d evictions, %d%% hit rate\n",
+		dcache_stats.hits, dcache_stats.negative_hits, dcache_stats.misses, dcache_stats.evictions, dcache_hit_rate());
+	if(create_file((uint8_t*)"dcache_dir/sub/missing") == -1 || read_dentry_by_name((uint8_t*)"dcache_dir/sub/missing", &dentry) == -1) result = FAIL;
+	if(unlink_file((uint8_t*)"dcache_dir/sub") != -1) result = FAIL;					// not empty
+	unlink_file((uint8_t*)"dcache_dir/sub/missing");
+	unlink_file((uint8_t*)"dcache_dir/sub/file");
+	if(read_dentry_by_name((uint8_t*)"dcache_dir/sub/file", &dentry) != -1) result = FAIL;
+	if(unlink_file((uint8_t*)"dcache_dir/sub") == -1 || unlink_file((uint8_t*)"dcache_dir") == -1) result = FAIL;
+	if(read_dentry_by_name((uint8_t*)"dcache_dir", &dentry) != -1) result = FAIL;
+	return result;
+}
+
+/* stat_test
+ * Asserts that file_stat reports the length and the block count of a file as
+ * they change, and the length of a directory from its dentries
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: creates and removes the file "stat_test"
+ * Coverage: file_stat, inode_data_blocks
+ * Files: filesys.c/h
+ */
+int stat_test(){
+	TEST_HEADER;
+	const uint8_t* fname = (uint8_t*)"stat_test";
+	static uint8_t buf[3 * BLOCK_SIZE];								// 12KB, more than a kernel stack holds
+	stat_t st;
+	dentry_t dentry;
+	int result = PASS;
+	if(create_file(fname) == -1 || read_dentry_by_name(fname, &dentry) == -1) return FAIL;
+	if(file_stat(2, dentry.inode, &st) == -1 || st.file_type != 2 || st.inode != dentry.inode || st.length != 0 || st.blocks != 0) result = FAIL;
+	memset(buf, 'a', sizeof(buf));
+	if(write_data(dentry.inode, 0, buf, sizeof(buf)) != sizeof(buf)) result = FAIL;
+	if(file_stat(2, dentry.inode, &st) == -1 || st.length != sizeof(buf) || st.blocks != 3) result = FAIL;
+	if(truncate_data(dentry.inode, 5 * BLOCK_SIZE) == -1) result = FAIL;				// a hole takes no block
+	if(file_stat(2, dentry.inode, &st) == -1 || st.length != 5 * BLOCK_SIZE || st.blocks != 3) result = FAIL;
+	if(truncate_data(dentry.inode, 10) == -1) result = FAIL;						// the tail moves into the inode
+	if(file_stat(2, dentry.inode, &st) == -1 || st.length != 10 || st.blocks != 0) result = FAIL;
+	if(file_stat(1, DIR_INODE, &st) == -1 || st.file_type != 1 || st.length != boot_block_ptr->num_dir_entries * sizeof(dentry_t)) result = FAIL;
+	unlink_file(fname);
+	return result;
+}
+
+/* buddy_test
+ * Asserts that blocks of every order are aligned to their size, that a split
+ * 4MB block merges back once its pages are freed, and that the page counters
+ * return to where they started
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: allocates and frees blocks of the buddy allocator
+ * Coverage: buddy_alloc, buddy_free, buddy_order, buddy_stats
+ * Files: buddy.c/h
+ */
+int buddy_test(){
+	TEST_HEADER;
+	static uint32_t big[(BUDDY_NUM_FRAMES >> BUDDY_MAX_ORDER) + 1];			// every 4MB block the allocator has, and the 0 ending them
+	uint32_t blocks[BUDDY_MAX_ORDER + 1];
+	uint32_t order, num_big, i, page;
+	uint32_t free_pages = buddy_stats.free_pages;
+	int result = PASS;
+	if(buddy_order(1) != 0 || buddy_order(BUDDY_PAGE_SIZE + 1) != 1 || buddy_order(BUDDY_PAGE_SIZE << BUDDY_MAX_ORDER) != BUDDY_MAX_ORDER) result = FAIL;
+	for(order = 0; order <= BUDDY_MAX_ORDER; order++){
+		blocks[order] = buddy_alloc(order);
+		if(blocks[order] == 0 || (blocks[order] & ((BUDDY_PAGE_SIZE << order) - 1))) result = FAIL;
+	}
+	for(order = 0; order <= BUDDY_MAX_ORDER; order++){
+		if(blocks[order] != 0 && buddy_free(blocks[order]) == -1) result = FAIL;
+	}
+	if(buddy_stats.free_pages != free_pages) result = FAIL;
+	page = buddy_alloc(0);
+	if(page == 0 || buddy_free(page) == -1 || buddy_free(page) != -1) result = FAIL;		// freed twice
+	for(num_big = 0; (big[num_big] = buddy_alloc(BUDDY_MAX_ORDER)) != 0; num_big++);
+	for(i = 0; i < num_big; i++) buddy_free(big[i]);
+	page = buddy_alloc(0);										// splits a 4MB block
+	buddy_free(page);
+	for(i = 0; (big[i] = buddy_alloc(BUDDY_MAX_ORDER)) != 0; i++);			// all of them again if it merged
+	if(i != num_big) result = FAIL;
+	while(i > 0) buddy_free(big[--i]);
+	if(buddy_stats.free_pages != free_pages) result = FAIL;
+	return result;
+}
+
+/* user_paging_test
+ * Asserts that a new address space shares every kernel entry of page_dir,
+ * maps the program and mmap regions with 4KB page tables whose pages have no
+ * frame yet, and gives all of its pages back when it is freed
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: allocates and frees a page directory
+ * Coverage: init_user_paging, user_page_table, free_user_paging
+ * Files: paging.c/h
+ */
+int user_paging_test(){
+	TEST_HEADER;
+	uint32_t i;
+	uint32_t free_pages = buddy_stats.free_pages;
+	page_directory_entry_t* dir = init_user_paging(2 * PAGE_SIZE);
+	page_table_entry_t* tbl;
+	int result = PASS;
+	if(dir == NULL) return FAIL;
+	for(i = 0; i < user_virt_addr / PAGE_SIZE_4M; i++){
+		if(*(uint32_t*)&dir[i] != *(uint32_t*)&page_dir[i]) result = FAIL;			// kernel entries are shared
+	}
+	tbl = user_page_table(dir, user_virt_addr);
+	if(tbl == NULL || user_page_table(dir, user_mmap_addr) == NULL || user_page_table(dir, user_video_addr) != NULL) result = FAIL;
+	for(i = 0; tbl != NULL && i < DIR_TBL_SIZE; i++){
+		if(tbl[i].present || !tbl[i].user_sup) result = FAIL;				// frames come on first touch
+	}
+	if(tbl != NULL && tbl[(user_img_addr - user_virt_addr) / PAGE_SIZE].available != PTE_LAZY) result = FAIL;
+	free_user_paging(dir);
+	if(buddy_stats.free_pages != free_pages) result = FAIL;
+	return result;
+}
+
+/* read and write CR4, the benchmark below turns global pages off and on */
+static inline uint32_t read_cr4(){
+	uint32_t cr4;
+	asm volatile("movl %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+static inline void write_cr4(uint32_t cr4){
+	asm volatile("movl %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/* switch_bench
+ * Reports the cycles of one context switch and the kernel accesses after it,
+ * done the old way (global pages off, the whole TLB flushed by the video
+ * remap and by the user directory remap) and the new way (global kernel
+ * pages, a CR3 load and invlpg of the remapped video page)
+ * Inputs: None
+ * Outputs: cycles per switch of each way/PASS/FAIL
+ * Side Effects: loads page_dir into CR3 and toggles CR4.PGE, both restored on return
+ * Coverage: invlpg, global pages set up by paging_init
+ * Files: paging.c/h, load_enable_paging.S
+ */
+int switch_bench(){
+	TEST_HEADER;
+	const uint32_t rounds = 1000;
+	const uint32_t stride = 64;										// bytes between the kernel accesses
+	volatile uint8_t* kernel = (volatile uint8_t*)KERNEL_START_ADDR;
+	volatile uint8_t* video = (volatile uint8_t*)VMEM_START_ADDR;
+	volatile uint8_t* buffer = (volatile uint8_t*)buddy_alloc(2);			// 16KB from the 1:1 mapped buddy region
+	uint32_t cr4 = read_cr4(), i, j, start, flush_cycles, invlpg_cycles, sum = 0;
+	uint32_t cr3 = read_cr3();											// a process's directory, its user pages come back with it
+	int result = PASS;
+	if(buffer == NULL) return FAIL;
+	if(!(cr4 & 0x80)){													// PGE is on after enable_paging
+		buddy_free((uint32_t)buffer);
+		return FAIL;
+	}
+
+	write_cr4(cr4 & ~0x80);										// before: global bits are ignored
+	start = rdtsc();
+	for(i = 0; i < rounds; i++){
+		load_page_directory((uint32_t)page_dir);
+		flush_TLB();											// the video remap
+		flush_TLB();											// the user directory entry remap
+		for(j = 0; j < 4 * BUDDY_PAGE_SIZE; j += stride) sum += kernel[j] + buffer[j];
+		sum += video[i & (PAGE_SIZE - 1)];
+	}
+	flush_cycles = rdtsc() - start;
+
+	write_cr4(cr4);											// after: kernel pages survive the CR3 load
+	start = rdtsc();
+	for(i = 0; i < rounds; i++){
+		load_page_directory((uint32_t)page_dir);
+		invlpg(VMEM_START_ADDR);									// the video remap
+		for(j = 0; j < 4 * BUDDY_PAGE_SIZE; j += stride) sum += kernel[j] + buffer[j];
+		sum += video[i & (PAGE_SIZE - 1)];
+	}
+	invlpg_cycles = rdtsc() - start;
+	load_page_directory(cr3);
+	buddy_free((uint32_t)buffer);
+
+	printf("context switch: flush_TLB %d cycles, global pages + invlpg %d cycles (%d)\n", flush_cycles / rounds, invlpg_cycles / rounds, sum & 1);
+	if(read_cr4() != cr4 || read_cr3() != cr3) result = FAIL;
+	return result;
+}
+
+/* fork_paging_test
+ * Asserts that a forked address space maps the resident program pages of its
+ * parent read-only and copy on write on both sides, and that a shared frame
+ * is only freed with the last address space mapping it
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: allocates and frees two page directories and a frame
+ * Coverage: fork_user_paging, free_user_paging
+ * Files: paging.c/h
+ */
+int fork_paging_test(){
+	TEST_HEADER;
+	const uint32_t page = 5;
+	uint32_t free_pages = buddy_stats.free_pages, forked_pages;
+	uint32_t frame = buddy_alloc(0);
+	page_directory_entry_t* parent = init_user_paging(0);
+	page_directory_entry_t* child;
+	page_table_entry_t *tbl, *child_tbl;
+	int result = PASS;
+	if(frame == 0 || parent == NULL) return FAIL;
+	tbl = user_page_table(parent, user_virt_addr);
+	tbl[page].base_addr = frame / PAGE_SIZE;							// as if the page had been touched
+	tbl[page].available = 0;
+	tbl[page].present = 1;
+	forked_pages = buddy_stats.free_pages;
+	child = fork_user_paging(parent);
+	if(child == NULL) return FAIL;
+	child_tbl = user_page_table(child, user_virt_addr);
+	if(child_tbl == tbl || child_tbl[page].base_addr != tbl[page].base_addr) result = FAIL;
+	if(tbl[page].read_write || tbl[page].available != PTE_COW) result = FAIL;
+	if(child_tbl[page].read_write || child_tbl[page].available != PTE_COW) result = FAIL;
+	if(child_tbl[page + 1].present || child_tbl[page + 1].available != PTE_ZERO) result = FAIL;	// faults in on its own
+	free_user_paging(child);
+	if(buddy_stats.free_pages != forked_pages) result = FAIL;					// the frame is still the parent's
+	free_user_paging(parent);
+	if(buddy_stats.free_pages != free_pages) result = FAIL;
+	return result;
+}
 
 /* Test suite entry point */
 void launch_tests(){
@@ -390,4 +1457,31 @@ void launch_tests(){
 	// TEST_OUTPUT("file_test", file_test("fish"));
 	// TEST_OUTPUT("file_test", file_test("verylargetextwithverylongname.tx"));
 	// TEST_OUTPUT("file_test", file_test("non-exist-file"));
+
+	/* Checkpoint 5 tests */
+	// TEST_OUTPUT("dentry_index_bench", dentry_index_bench());
+	// TEST_OUTPUT("extent_truncate_test", extent_truncate_test());
+	// TEST_OUTPUT("bitmap_alloc_test", bitmap_alloc_test());
+	// TEST_OUTPUT("bcache_test", bcache_test("frame0.txt"));
+	// TEST_OUTPUT("mmap_test", mmap_test("frame0.txt"));
+	// TEST_OUTPUT("mmap_pin_test", mmap_pin_test());
+	// TEST_OUTPUT("demand_paging_test", demand_paging_test("ls"));
+	// TEST_OUTPUT("create_unlink_test", create_unlink_test());
+	// TEST_OUTPUT("getdents_test", getdents_test());
+	// TEST_OUTPUT("write_offset_test", write_offset_test());
+	// TEST_OUTPUT("readv_writev_test", readv_writev_test());
+	// TEST_OUTPUT("name_index_test", name_index_test());
+	// TEST_OUTPUT("dir_spill_test", dir_spill_test());
+	// TEST_OUTPUT("sparse_file_test", sparse_file_test());
+	// TEST_OUTPUT("clone_test", clone_test("verylargetextwithverylongname.tx"));
+	// TEST_OUTPUT("compress_bench", compress_bench());
+	// TEST_OUTPUT("dedup_test", dedup_test());
+	// TEST_OUTPUT("inline_test", inline_test());
+	// TEST_OUTPUT("crc_bench", crc_bench());
+	// TEST_OUTPUT("dcache_test", dcache_test());
+	// TEST_OUTPUT("stat_test", stat_test());
+	// TEST_OUTPUT("buddy_test", buddy_test());
+	// TEST_OUTPUT("user_paging_test", user_paging_test());
+	// TEST_OUTPUT("switch_bench", switch_bench());
+	// TEST_OUTPUT("fork_paging_test", fork_paging_test());
 }
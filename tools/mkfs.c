@@ -0,0 +1,902 @@
+/* mkfs.c - Host tool that builds filesys_img from a directory tree,
+ * or extracts the files of an existing image into a directory tree.
+ * Built and run on the host, not part of the kernel.
+ *
+ *   mkfs [-z] [-i inodes] [-s spare_blocks] -o filesys_img dir
+ *   mkfs -x filesys_img dir
+ *
+ * Layout (see filesys.h, the structures below must match it):
+ *   block 0                      boot block: header + 63 dentries
+ *   blocks 1 .. num_inodes       inodes
+ *   blocks num_inodes + 1 ..     data blocks
+ *
+ * Dentries past the 63rd go to directory blocks, 64 per block, which are
+ * the first data blocks and are listed by inode 0.
+ *
+ * An inode lists 1021 data blocks, then a single and a double indirect
+ * block. Blocks of zeros become holes (0xFFFFFFFF) and take no space.
+ * When the bytes of the last block fit in the direct entries after its
+ * own, that entry is 0xFFFFFFFD (BLOCK_INLINE) and the bytes follow it,
+ * so small files and short tails take no data block.
+ *
+ * With -z, files are compressed in clusters of 8 blocks (32KB) with an LZ4
+ * block codec. A cluster whose stream, after a 4-byte length, takes fewer
+ * blocks than the cluster lists the stream blocks first and 0xFFFFFFFE
+ * (BLOCK_PACKED) for the blocks it saved, the others stay plain.
+ *
+ * A directory below the top one is a dentry of type 1 with an inode of its
+ * own, whose data is the dense array of its dentries, stored uncompressed.
+ * The top directory is inode 0 as above. Directories deeper than 7 levels
+ * are skipped.
+ *
+ * Every file gets one contiguous run of data blocks, so the kernel reads
+ * it with a single extent. Dentries are sorted by name. The reserved
+ * header words carry a precomputed free-block bitmap and the dentries
+ * carry their name hash, so filesys_init does not rebuild them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE          4096
+#define MAX_FILES_NUMBER    63                          // dentries in the boot block
+#define DENTRIES_PER_BLOCK  (BLOCK_SIZE / 64)           // dentries in a directory block
+#define MAX_DIR_BLOCKS      7
+#define MAX_DIR_ENTRIES     (MAX_FILES_NUMBER + MAX_DIR_BLOCKS * DENTRIES_PER_BLOCK)
+#define MAX_INODES          512                         // the most inodes the kernel tracks
+#define DIR_INODE           0                           // inode listing the directory blocks
+#define MAX_DATA_BLOCKS     4096                        // the most data blocks the kernel tracks
+#define NUM_DIRECT_BLOCKS   (BLOCK_SIZE / 4 - 3)
+#define PTRS_PER_BLOCK      (BLOCK_SIZE / 4)
+#define BLOCK_HOLE          0xFFFFFFFF
+#define BLOCK_PACKED        0xFFFFFFFE                  // the block is in the compressed stream of its cluster
+#define BLOCK_INLINE        0xFFFFFFFD                  // the last block, its bytes follow its entry in the inode
+#define INLINE_CAPACITY(FB) ((NUM_DIRECT_BLOCKS - 1 - (FB)) * 4)
+#define COMPRESS_CLUSTER    8                           // file blocks compressed together
+#define CLUSTER_SIZE        (COMPRESS_CLUSTER * BLOCK_SIZE)
+#define LZ_MIN_MATCH        4
+#define LZ_MAX_OFFSET       65535
+#define LZ_HASH_LOG         14                          // positions remembered by the match finder
+#define LZ_BOUND(n)         ((n) + (n) / 255 + 16)      // worst case of incompressible input
+#define SINGLE_INDIRECT     (1 + NUM_DIRECT_BLOCKS)     // word of the single indirect block in an inode
+#define DOUBLE_INDIRECT     (2 + NUM_DIRECT_BLOCKS)     // word of the double indirect block in an inode
+#define MAX_FILENAME_LEN    32
+#define DEFAULT_INODES      64
+#define MAX_DIR_DEPTH       8                           // nested directories the kernel walks at boot
+#define MAX_NODES           (MAX_INODES + 2)            // a file or directory takes an inode, "." and "rtc" do not
+#define DEFAULT_SPARE       64                          // free data blocks left for files created at run time
+#define MKFS_MAGIC          0x53464B4D                  // "MKFS"
+#define MKFS_SORTED         0x1                         // dentries are sorted by name
+#define MKFS_HASHES         0x2                         // dentries carry the hash of their name
+#define MKFS_BITMAP         0x4                         // the header carries the free-block bitmap
+#define MKFS_BITMAP_WORDS   11                          // header words left for the bitmap
+#define FILE_TYPE_RTC       0
+#define FILE_TYPE_DIR       1
+#define FILE_TYPE_REGULAR   2
+
+typedef struct dentry
+{
+    uint8_t  file_name[MAX_FILENAME_LEN];
+    uint32_t file_type;
+    uint32_t inode;
+    uint32_t name_hash;
+    uint32_t reserved[5];
+} dentry_t;
+
+typedef struct boot_block
+{
+    uint32_t num_dir_entries;
+    uint32_t num_inodes;
+    uint32_t num_data_blocks;
+    uint32_t mkfs_magic;
+    uint32_t mkfs_flags;
+    uint32_t free_bitmap[MKFS_BITMAP_WORDS];
+    dentry_t dir_entries[MAX_FILES_NUMBER];
+} boot_block_t;
+
+/* a file going into the image */
+typedef struct input_file
+{
+    char     name[MAX_FILENAME_LEN + 1];
+    uint32_t type;
+    uint8_t* data;
+    uint32_t length;
+    uint32_t inode;                                     // 0 for "." and "rtc"
+    uint32_t subdir;                                    // 1 for a directory below the top one
+    uint32_t first_child;                               // entries of a subdirectory in files[]
+    uint32_t num_children;
+} input_file_t;
+
+static input_file_t files[MAX_NODES];                   // each directory is a sorted range, the root first
+static uint32_t num_files = 0;
+
+/**
+ * dentry_at
+ *  DESCRIPTION : find a dentry in the boot block or in a directory block
+ *  INPUTS : image -- the image
+ *           index -- the dentry index
+ *  OUTPUTS : none
+ *  RETURN VALUE : the dentry, NULL if the directory has no block for it
+ *  SIDE EFFECTS : none
+ */
+static dentry_t* dentry_at(uint8_t* image, uint32_t index)
+{
+    boot_block_t* boot = (boot_block_t*)image;
+    uint32_t* dir_inode = (uint32_t*)(image + (1 + DIR_INODE) * BLOCK_SIZE);
+    uint8_t* data = image + (1 + boot->num_inodes) * BLOCK_SIZE;
+    if (index < MAX_FILES_NUMBER) return &boot->dir_entries[index];
+    index -= MAX_FILES_NUMBER;
+    if (index / DENTRIES_PER_BLOCK >= dir_inode[0] / BLOCK_SIZE) return NULL;
+    if (dir_inode[1 + index / DENTRIES_PER_BLOCK] >= boot->num_data_blocks) return NULL;
+    return (dentry_t*)(data + dir_inode[1 + index / DENTRIES_PER_BLOCK] * BLOCK_SIZE) + index % DENTRIES_PER_BLOCK;
+}
+
+/**
+ * block_entry
+ *  DESCRIPTION : find the word holding the data block number of a file block
+ *  INPUTS : data -- the first data block of the image
+ *           inode -- the inode words
+ *           file_block -- the block index within the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : the word, NULL if an indirect block on the way is a hole
+ *  SIDE EFFECTS : none
+ */
+static uint32_t* block_entry(uint8_t* data, uint32_t* inode, uint32_t file_block)
+{
+    uint32_t ind;
+    if (file_block < NUM_DIRECT_BLOCKS) return &inode[1 + file_block];
+    file_block -= NUM_DIRECT_BLOCKS;
+    if (file_block < PTRS_PER_BLOCK) {
+        ind = inode[SINGLE_INDIRECT];
+    } else {
+        file_block -= PTRS_PER_BLOCK;
+        if (inode[DOUBLE_INDIRECT] == BLOCK_HOLE) return NULL;
+        ind = ((uint32_t*)(data + inode[DOUBLE_INDIRECT] * BLOCK_SIZE))[file_block / PTRS_PER_BLOCK];
+        file_block %= PTRS_PER_BLOCK;
+    }
+    if (ind == BLOCK_HOLE) return NULL;
+    return (uint32_t*)(data + ind * BLOCK_SIZE) + file_block;
+}
+
+/**
+ * indirect_blocks
+ *  DESCRIPTION : number of indirect blocks a file of nblocks blocks needs
+ *  INPUTS : nblocks -- the number of blocks of the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of indirect blocks
+ *  SIDE EFFECTS : none
+ */
+static uint32_t indirect_blocks(uint32_t nblocks)
+{
+    if (nblocks <= NUM_DIRECT_BLOCKS) return 0;
+    if (nblocks <= NUM_DIRECT_BLOCKS + PTRS_PER_BLOCK) return 1;
+    return 2 + (nblocks - NUM_DIRECT_BLOCKS - PTRS_PER_BLOCK + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+}
+
+/**
+ * is_zero
+ *  DESCRIPTION : check whether a block of a file holds only zeros, and can be a hole
+ *  INPUTS : buf -- the bytes
+ *           len -- the number of bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : 1 if every byte is 0
+ *  SIDE EFFECTS : none
+ */
+static int is_zero(const uint8_t* buf, uint32_t len)
+{
+    uint32_t i;
+    for (i = 0; i < len; i++) if (buf[i] != 0) return 0;
+    return 1;
+}
+
+/**
+ * lz_put_length
+ *  DESCRIPTION : write the extra bytes of a length field that holds 15
+ *  INPUTS : dst -- the output
+ *           op -- the write position
+ *           len -- the length minus 15
+ *  OUTPUTS : none
+ *  RETURN VALUE : the new write position
+ *  SIDE EFFECTS : none
+ */
+static uint32_t lz_put_length(uint8_t* dst, uint32_t op, uint32_t len)
+{
+    for (; len >= 255; len -= 255) dst[op++] = 255;
+    dst[op++] = len;
+    return op;
+}
+
+/**
+ * lz_sequence
+ *  DESCRIPTION : write one LZ4 sequence, literals and an optional match
+ *  INPUTS : dst -- the output
+ *           op -- the write position
+ *           lit -- the literals
+ *           lit_len -- the number of literals
+ *           offset -- the distance back to the match
+ *           match_len -- the match length, 0 for the last sequence
+ *  OUTPUTS : none
+ *  RETURN VALUE : the new write position
+ *  SIDE EFFECTS : none
+ */
+static uint32_t lz_sequence(uint8_t* dst, uint32_t op, const uint8_t* lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint32_t token = op++;
+    uint32_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+    dst[token] = ((lit_len < 15) ? lit_len : 15) << 4 | ((m < 15) ? m : 15);
+    if (lit_len >= 15) op = lz_put_length(dst, op, lit_len - 15);
+    memcpy(dst + op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0) return op;
+    dst[op++] = offset & 0xFF;
+    dst[op++] = offset >> 8;
+    if (m >= 15) op = lz_put_length(dst, op, m - 15);
+    return op;
+}
+
+/**
+ * lz_compress
+ *  DESCRIPTION : compress a buffer into an LZ4 block, greedy matching with
+ *                a hash table of the last position of each 4-byte sequence
+ *  INPUTS : src -- the input
+ *           len -- the input length
+ *           dst -- the output, LZ_BOUND(len) bytes
+ *  OUTPUTS : none
+ *  RETURN VALUE : the length of the stream
+ *  SIDE EFFECTS : none
+ */
+static uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst)
+{
+    static int32_t table[1 << LZ_HASH_LOG];
+    uint32_t ip = 0, anchor = 0, op = 0, seq, h, match_len;
+    int32_t ref;
+    memset(table, 0xFF, sizeof(table));
+    while (ip + LZ_MIN_MATCH <= len) {
+        memcpy(&seq, src + ip, 4);
+        h = (seq * 2654435761U) >> (32 - LZ_HASH_LOG);
+        ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + ip, LZ_MIN_MATCH)) {
+            ip++;
+            continue;
+        }
+        for (match_len = LZ_MIN_MATCH; ip + match_len < len && src[ref + match_len] == src[ip + match_len]; match_len++);
+        op = lz_sequence(dst, op, src + anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+    return lz_sequence(dst, op, src + anchor, len - anchor, 0, 0);
+}
+
+/**
+ * lz_decompress
+ *  DESCRIPTION : decode an LZ4 block, the same as lz_decompress in lz.c
+ *  INPUTS : src -- the stream
+ *           src_len -- the stream length
+ *           dst -- the output
+ *           dst_cap -- the size of the output
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes produced, -1 on a bad stream
+ *  SIDE EFFECTS : none
+ */
+static int32_t lz_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+{
+    uint32_t ip = 0, op = 0, token, len, offset;
+    uint8_t b;
+    while (ip < src_len) {
+        token = src[ip++];
+        len = token >> 4;
+        if (len == 15) do {
+            if (ip >= src_len) return -1;
+            b = src[ip++];
+            len += b;
+        } while (b == 255);
+        if (len > src_len - ip || len > dst_cap - op) return -1;
+        memcpy(dst + op, src + ip, len);
+        op += len;
+        ip += len;
+        if (ip == src_len) break;
+        if (src_len - ip < 2) return -1;
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+        len = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) do {
+            if (ip >= src_len) return -1;
+            b = src[ip++];
+            len += b;
+        } while (b == 255);
+        if (len > dst_cap - op) return -1;
+        for (; len > 0; len--, op++) dst[op] = dst[op - offset];
+    }
+    return op;
+}
+
+/**
+ * pack_cluster
+ *  DESCRIPTION : compress one cluster of a file
+ *  INPUTS : file -- the file
+ *           cluster -- the cluster index
+ *           stream -- the buffer for the length and the stream
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of blocks the stream takes, 0 if it saves no block
+ *  SIDE EFFECTS : fill stream
+ */
+static uint32_t pack_cluster(const input_file_t* file, uint32_t cluster, uint8_t* stream)
+{
+    uint32_t first = cluster * COMPRESS_CLUSTER;
+    uint32_t nblocks = (file->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t nb = (nblocks - first < COMPRESS_CLUSTER) ? nblocks - first : COMPRESS_CLUSTER;
+    uint32_t start = first * BLOCK_SIZE;
+    uint32_t len = (file->length - start < CLUSTER_SIZE) ? file->length - start : CLUSTER_SIZE;
+    uint32_t stream_len, k;
+
+    if (is_zero(file->data + start, len)) return 0;     // holes take no block at all
+    stream_len = lz_compress(file->data + start, len, stream + 4);
+    memcpy(stream, &stream_len, 4);
+    k = (4 + stream_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return (k < nb) ? k : 0;
+}
+
+/**
+ * store_cluster
+ *  DESCRIPTION : lay out one cluster of a file. Blocks of zeros become
+ *                holes, and with compression a cluster whose stream takes
+ *                fewer blocks is stored packed.
+ *  INPUTS : file -- the file
+ *           cluster -- the cluster index
+ *           compress -- 1 to try compressing the cluster
+ *           data -- the first data block of the image, NULL to only count the blocks
+ *           inode -- the inode words
+ *           next_block -- the next free data block, moved past the cluster
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of data blocks the cluster takes
+ *  SIDE EFFECTS : none
+ */
+static uint32_t store_cluster(const input_file_t* file, uint32_t cluster, int compress, uint8_t* data, uint32_t* inode, uint32_t* next_block)
+{
+    static uint8_t stream[4 + LZ_BOUND(CLUSTER_SIZE)];
+    uint32_t first = cluster * COMPRESS_CLUSTER;
+    uint32_t nblocks = (file->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t nb = (nblocks - first < COMPRESS_CLUSTER) ? nblocks - first : COMPRESS_CLUSTER;
+    uint32_t start = first * BLOCK_SIZE;
+    uint32_t len = (file->length - start < CLUSTER_SIZE) ? file->length - start : CLUSTER_SIZE;
+    uint32_t j, k, used = 0;
+
+    if (compress && (k = pack_cluster(file, cluster, stream)) != 0) {
+        if (data == NULL) return k;
+        memcpy(data + *next_block * BLOCK_SIZE, stream, 4 + *(uint32_t*)stream);
+        for (j = 0; j < nb; j++) *block_entry(data, inode, first + j) = (j < k) ? *next_block + j : BLOCK_PACKED;
+        *next_block += k;
+        return k;
+    }
+    for (j = 0; j < nb; j++) {                           // blocks of zeros become holes
+        uint32_t chunk = (len - j * BLOCK_SIZE < BLOCK_SIZE) ? len - j * BLOCK_SIZE : BLOCK_SIZE;
+        if (is_zero(file->data + start + j * BLOCK_SIZE, chunk)) continue;
+        used++;
+        if (data == NULL) continue;
+        *block_entry(data, inode, first + j) = *next_block;
+        memcpy(data + (*next_block)++ * BLOCK_SIZE, file->data + start + j * BLOCK_SIZE, chunk);
+    }
+    return used;
+}
+
+/**
+ * inline_length
+ *  DESCRIPTION : check whether the last block of a file fits in its inode.
+ *                A packed cluster is found by its last entry, so the tail
+ *                stays a block when the blocks before it in its cluster
+ *                would be compressed.
+ *  INPUTS : file -- the file
+ *           compress -- 1 if the clusters are compressed
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of bytes in the last block, 0 if they do not fit
+ *  SIDE EFFECTS : none
+ */
+static uint32_t inline_length(const input_file_t* file, int compress)
+{
+    static uint8_t stream[4 + LZ_BOUND(CLUSTER_SIZE)];
+    input_file_t body = *file;
+    uint32_t fb, tail;
+    if (file->length == 0) return 0;
+    fb = (file->length - 1) / BLOCK_SIZE;
+    tail = file->length - fb * BLOCK_SIZE;
+    if (fb >= NUM_DIRECT_BLOCKS - 1 || tail > INLINE_CAPACITY(fb)) return 0;
+    body.length = fb * BLOCK_SIZE;
+    if (compress && fb % COMPRESS_CLUSTER != 0 && pack_cluster(&body, fb / COMPRESS_CLUSTER, stream)) return 0;
+    return tail;
+}
+
+/**
+ * read_cluster
+ *  DESCRIPTION : get the bytes of one cluster of a file out of an image
+ *  INPUTS : data -- the first data block of the image
+ *           num_data_blocks -- the number of data blocks of the image
+ *           inode -- the inode words
+ *           cluster -- the cluster index
+ *           out -- CLUSTER_SIZE bytes, zeros past the end of the file
+ *  OUTPUTS : none
+ *  RETURN VALUE : 0 on success, -1 on a corrupted cluster
+ *  SIDE EFFECTS : none
+ */
+static int read_cluster(uint8_t* data, uint32_t num_data_blocks, uint32_t* inode, uint32_t cluster, uint8_t* out)
+{
+    static uint8_t stream[CLUSTER_SIZE];
+    uint32_t first = cluster * COMPRESS_CLUSTER;
+    uint32_t nblocks = inode[0] / BLOCK_SIZE + (inode[0] % BLOCK_SIZE != 0);
+    uint32_t nb = (nblocks - first < COMPRESS_CLUSTER) ? nblocks - first : COMPRESS_CLUSTER;
+    uint32_t j, k, stream_len;
+    uint32_t* entry;
+
+    memset(out, 0, CLUSTER_SIZE);
+    entry = block_entry(data, inode, first + nb - 1);
+    if (entry == NULL || *entry != BLOCK_PACKED) {       // plain blocks and holes
+        for (j = 0; j < nb; j++) {
+            entry = block_entry(data, inode, first + j);
+            if (entry == NULL || *entry == BLOCK_HOLE) continue;
+            if (*entry == BLOCK_INLINE && first + j < NUM_DIRECT_BLOCKS - 1) {
+                memcpy(out + j * BLOCK_SIZE, entry + 1, INLINE_CAPACITY(first + j));
+                continue;
+            }
+            if (*entry >= num_data_blocks) return -1;
+            memcpy(out + j * BLOCK_SIZE, data + *entry * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        return 0;
+    }
+    for (k = 0; k < nb; k++) {
+        entry = block_entry(data, inode, first + k);
+        if (*entry == BLOCK_PACKED) break;
+        if (*entry >= num_data_blocks) return -1;
+        memcpy(stream + k * BLOCK_SIZE, data + *entry * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    memcpy(&stream_len, stream, 4);
+    if (k == 0 || stream_len > k * BLOCK_SIZE - 4) return -1;
+    return (lz_decompress(stream + 4, stream_len, out, CLUSTER_SIZE) == -1) ? -1 : 0;
+}
+
+/**
+ * name_hash
+ *  DESCRIPTION : FNV-1a hash of a file name, the same as dentry_name_fnv in filesys.c
+ *  INPUTS : name -- the file name
+ *  OUTPUTS : none
+ *  RETURN VALUE : the 32-bit hash stored in the dentry, not the bucket index
+ *  SIDE EFFECTS : none
+ */
+static uint32_t name_hash(const uint8_t* name)
+{
+    uint32_t hash = 2166136261U;                        // FNV offset basis
+    uint32_t i;
+    for (i = 0; i < MAX_FILENAME_LEN && name[i] != '\0'; i++) {
+        hash ^= name[i];
+        hash *= 16777619U;                              // FNV prime
+    }
+    return hash;
+}
+
+/**
+ * compare_files
+ *  DESCRIPTION : qsort order of the dentries, the byte order the kernel's strncmp uses
+ *  INPUTS : a, b -- two input_file_t
+ *  OUTPUTS : none
+ *  RETURN VALUE : <0, 0 or >0
+ *  SIDE EFFECTS : none
+ */
+static int compare_files(const void* a, const void* b)
+{
+    return strncmp(((const input_file_t*)a)->name, ((const input_file_t*)b)->name, MAX_FILENAME_LEN);
+}
+
+/**
+ * read_file
+ *  DESCRIPTION : load a whole host file
+ *  INPUTS : path -- the host path
+ *           length -- where to store the length
+ *  OUTPUTS : none
+ *  RETURN VALUE : the file content, NULL on error
+ *  SIDE EFFECTS : allocate memory
+ */
+static uint8_t* read_file(const char* path, uint32_t* length)
+{
+    FILE* fp = fopen(path, "rb");
+    uint8_t* data;
+    long size;
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t)size) {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *length = size;
+    return data;
+}
+
+/**
+ * collect_dir
+ *  DESCRIPTION : add the regular files and the subdirectories of a host
+ *                directory to files[] as one sorted range, then the
+ *                entries of each subdirectory after it, depth first
+ *  INPUTS : dir -- the host directory
+ *           root -- 1 for the top directory, which also gets the "." and "rtc" entries
+ *           depth -- the number of directories above dir
+ *           first -- where to store the index of the first entry of dir
+ *  OUTPUTS : none
+ *  RETURN VALUE : the number of entries of dir, -1 on error
+ *  SIDE EFFECTS : fill files[], load the regular files
+ */
+static int collect_dir(const char* dir, int root, uint32_t depth, uint32_t* first)
+{
+    uint32_t start = num_files, count, i;
+    char path[4096];
+    struct dirent* entry;
+    struct stat st;
+    int n;
+    DIR* dp = opendir(dir);
+    if (dp == NULL) {
+        fprintf(stderr, "mkfs: cannot open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    if (root) {
+        strcpy(files[num_files].name, ".");
+        files[num_files++].type = FILE_TYPE_DIR;
+        strcpy(files[num_files].name, "rtc");
+        files[num_files++].type = FILE_TYPE_RTC;
+    }
+    while ((entry = readdir(dp)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) continue;
+        if (root && !strcmp(entry->d_name, "rtc")) continue;
+        if (strlen(entry->d_name) > MAX_FILENAME_LEN) {
+            fprintf(stderr, "mkfs: skipping %s, name longer than %d bytes\n", path, MAX_FILENAME_LEN);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode) && depth + 1 >= MAX_DIR_DEPTH) {
+            fprintf(stderr, "mkfs: skipping %s, more than %d directories deep\n", path, MAX_DIR_DEPTH - 1);
+            continue;
+        }
+        if (num_files - start == MAX_DIR_ENTRIES || num_files == MAX_NODES) {
+            fprintf(stderr, "mkfs: more than %d files in %s, or %d in all\n", MAX_DIR_ENTRIES, dir, MAX_NODES);
+            closedir(dp);
+            return -1;
+        }
+        strcpy(files[num_files].name, entry->d_name);
+        if (S_ISDIR(st.st_mode)) {
+            files[num_files].type = FILE_TYPE_DIR;
+            files[num_files++].subdir = 1;
+            continue;
+        }
+        files[num_files].type = FILE_TYPE_REGULAR;
+        files[num_files].data = read_file(path, &files[num_files].length);
+        if (files[num_files].data == NULL) {
+            fprintf(stderr, "mkfs: cannot read %s\n", path);
+            closedir(dp);
+            return -1;
+        }
+        num_files++;
+    }
+    closedir(dp);
+    count = num_files - start;
+    qsort(files + start, count, sizeof(input_file_t), compare_files);
+    *first = start;
+    for (i = start; i < start + count; i++) {
+        if (!files[i].subdir) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+        n = collect_dir(path, 0, depth + 1, &files[i].first_child);
+        if (n < 0) return -1;
+        files[i].num_children = n;
+    }
+    return count;
+}
+
+/**
+ * make_image
+ *  DESCRIPTION : build an image out of the regular files and the
+ *                subdirectories of a directory, plus the "." directory and
+ *                the "rtc" device entries
+ *  INPUTS : out -- the image path
+ *           dir -- the directory holding the files
+ *           num_inodes -- the number of inode blocks
+ *           spare -- free data blocks left after the files
+ *           compress -- 1 to compress the files
+ *  OUTPUTS : the image
+ *  RETURN VALUE : 0 on success, -1 on error
+ *  SIDE EFFECTS : write the image file
+ */
+static int make_image(const char* out, const char* dir, uint32_t num_inodes, uint32_t spare, int compress)
+{
+    uint32_t used_blocks = 0, plain_blocks = 0, file_blocks = 0, num_inline = 0, num_subdirs = 0, i, j;
+    uint32_t next_inode = 1, next_block = 0, root_first;
+    int num_root;
+
+    num_files = 0;
+    memset(files, 0, sizeof(files));
+    num_root = collect_dir(dir, 1, 0, &root_first);      // the root entries come first
+    if (num_root < 0) return -1;
+    for (i = 0; i < num_files; i++) {                    // inode 0 stands for the directory
+        if (files[i].type == FILE_TYPE_REGULAR || files[i].subdir) files[i].inode = next_inode++;
+    }
+    if (next_inode > num_inodes) {
+        fprintf(stderr, "mkfs: %u inodes are not enough, use -i\n", num_inodes);
+        return -1;
+    }
+    /* a subdirectory is a file of dense dentries, kept plain so lookups scan it without decompressing */
+    for (i = 0; i < num_files; i++) {
+        if (!files[i].subdir) continue;
+        num_subdirs++;
+        files[i].length = files[i].num_children * sizeof(dentry_t);
+        files[i].data = calloc(1, files[i].length ? files[i].length : 1);
+        if (files[i].data == NULL) return -1;
+        for (j = 0; j < files[i].num_children; j++) {
+            const input_file_t* child = &files[files[i].first_child + j];
+            dentry_t* dentry = (dentry_t*)files[i].data + j;
+            memcpy(dentry->file_name, child->name, strlen(child->name));
+            dentry->file_type = child->type;
+            dentry->inode = child->inode;
+            dentry->name_hash = name_hash(dentry->file_name);
+        }
+    }
+    for (i = 0; i < num_files; i++) {
+        if (files[i].inode == 0) continue;
+        int z = compress && !files[i].subdir;
+        input_file_t body = files[i];                    // the blocks before an inline tail
+        uint32_t nblocks = (body.length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        used_blocks += indirect_blocks(nblocks);
+        if (inline_length(&body, z)) {
+            body.length = (nblocks - 1) * BLOCK_SIZE;
+            num_inline++;
+        }
+        for (j = 0; j * CLUSTER_SIZE < body.length; j++) {
+            file_blocks += store_cluster(&body, j, z, NULL, NULL, NULL);
+            plain_blocks += store_cluster(&body, j, 0, NULL, NULL, NULL);
+        }
+    }
+    used_blocks += file_blocks;
+    uint32_t dir_blocks = 0;
+    if (num_root > MAX_FILES_NUMBER) dir_blocks = (num_root - MAX_FILES_NUMBER + DENTRIES_PER_BLOCK - 1) / DENTRIES_PER_BLOCK;
+    used_blocks += dir_blocks;
+
+    /* lay out the image: files take consecutive inodes and consecutive runs of blocks */
+    uint32_t num_data_blocks = used_blocks + spare;
+    if (num_data_blocks > MAX_DATA_BLOCKS) {
+        fprintf(stderr, "mkfs: %u data blocks, the kernel tracks %u\n", num_data_blocks, MAX_DATA_BLOCKS);
+        return -1;
+    }
+    size_t image_size = (size_t)(1 + num_inodes + num_data_blocks) * BLOCK_SIZE;
+    uint8_t* image = calloc(1, image_size);
+    if (image == NULL) return -1;
+    boot_block_t* boot = (boot_block_t*)image;
+    uint32_t* inodes = (uint32_t*)(image + BLOCK_SIZE);
+    uint8_t* data = image + (1 + num_inodes) * BLOCK_SIZE;
+
+    boot->num_dir_entries = num_root;
+    boot->num_inodes = num_inodes;
+    boot->num_data_blocks = num_data_blocks;
+    memset(inodes, 0xFF, num_inodes * BLOCK_SIZE);      // every block of every inode is a hole
+    for (i = 0; i < num_inodes; i++) inodes[i * (BLOCK_SIZE / 4)] = 0;
+    inodes[DIR_INODE * (BLOCK_SIZE / 4)] = dir_blocks * BLOCK_SIZE;     // the directory blocks come first
+    for (next_block = 0; next_block < dir_blocks; next_block++) inodes[DIR_INODE * (BLOCK_SIZE / 4) + 1 + next_block] = next_block;
+    for (i = 0; i < (uint32_t)num_root; i++) {
+        dentry_t* dentry = dentry_at(image, root_first + i);
+        memcpy(dentry->file_name, files[i].name, strlen(files[i].name));
+        dentry->file_type = files[i].type;
+        dentry->inode = files[i].inode;
+        dentry->name_hash = name_hash(dentry->file_name);
+    }
+    for (i = 0; i < num_files; i++) {
+        if (files[i].inode == 0) continue;
+        int z = compress && !files[i].subdir;
+        uint32_t* inode = inodes + files[i].inode * (BLOCK_SIZE / 4);
+        uint32_t nblocks = (files[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        uint32_t nind = indirect_blocks(nblocks);
+        inode[0] = files[i].length;
+        /* the indirect blocks go before the data, which stays one run */
+        memset(data + next_block * BLOCK_SIZE, 0xFF, nind * BLOCK_SIZE);
+        if (nind > 0) inode[SINGLE_INDIRECT] = next_block++;
+        if (nind > 1) inode[DOUBLE_INDIRECT] = next_block++;
+        for (j = 2; j < nind; j++) ((uint32_t*)(data + inode[DOUBLE_INDIRECT] * BLOCK_SIZE))[j - 2] = next_block++;
+        input_file_t body = files[i];
+        uint32_t tail = inline_length(&body, z);
+        if (tail) {
+            body.length = (nblocks - 1) * BLOCK_SIZE;
+            inode[1 + nblocks - 1] = BLOCK_INLINE;
+            memset(&inode[2 + nblocks - 1], 0, INLINE_CAPACITY(nblocks - 1));
+            memcpy(&inode[2 + nblocks - 1], files[i].data + body.length, tail);
+        }
+        for (j = 0; j * CLUSTER_SIZE < body.length; j++) store_cluster(&body, j, z, data, inode, &next_block);
+        free(files[i].data);
+    }
+
+    boot->mkfs_magic = MKFS_MAGIC;
+    boot->mkfs_flags = MKFS_SORTED | MKFS_HASHES;
+    if (num_data_blocks <= MKFS_BITMAP_WORDS * 32) {     // the used blocks are exactly the first next_block
+        for (i = 0; i < next_block; i++) boot->free_bitmap[i / 32] |= 1U << (i % 32);
+        boot->mkfs_flags |= MKFS_BITMAP;
+    }
+
+    FILE* fp = fopen(out, "wb");
+    if (fp == NULL || fwrite(image, 1, image_size, fp) != image_size) {
+        fprintf(stderr, "mkfs: cannot write %s\n", out);
+        if (fp != NULL) fclose(fp);
+        free(image);
+        return -1;
+    }
+    fclose(fp);
+    free(image);
+    printf("mkfs: %s: %u dentries (%u directory blocks), %u subdirectories, %u inodes, %u data blocks (%u used), %u inline tails\n", out, num_root, dir_blocks, num_subdirs, num_inodes, num_data_blocks, next_block, num_inline);
+    if (compress) printf("mkfs: file data compressed from %u to %u blocks (%.1f%%)\n", plain_blocks, file_blocks, plain_blocks ? 100.0 * file_blocks / plain_blocks : 100.0);
+    return 0;
+}
+
+/**
+ * read_subdir
+ *  DESCRIPTION : get the dentries of a subdirectory out of an image
+ *  INPUTS : image -- the image
+ *           num -- the inode number of the subdirectory
+ *           count -- where to store the number of dentries
+ *  OUTPUTS : none
+ *  RETURN VALUE : the dentries, NULL if the subdirectory is corrupted
+ *  SIDE EFFECTS : allocate memory
+ */
+static dentry_t* read_subdir(uint8_t* image, uint32_t num, uint32_t* count)
+{
+    boot_block_t* boot = (boot_block_t*)image;
+    uint32_t* inode = (uint32_t*)(image + (1 + num) * BLOCK_SIZE);
+    uint8_t* data = image + (1 + boot->num_inodes) * BLOCK_SIZE;
+    uint32_t j;
+    if (inode[0] > MAX_DIR_ENTRIES * sizeof(dentry_t)) return NULL;
+    uint8_t* out = malloc((inode[0] / CLUSTER_SIZE + 1) * CLUSTER_SIZE);
+    if (out == NULL) return NULL;
+    for (j = 0; j * CLUSTER_SIZE < inode[0]; j++) {
+        if (read_cluster(data, boot->num_data_blocks, inode, j, out + j * CLUSTER_SIZE) == -1) {
+            free(out);
+            return NULL;
+        }
+    }
+    *count = inode[0] / sizeof(dentry_t);
+    return (dentry_t*)out;
+}
+
+/**
+ * extract_dir
+ *  DESCRIPTION : write the regular files of a list of dentries into a
+ *                directory, and the subdirectories they name below it
+ *  INPUTS : image -- the image
+ *           entries -- the dentries
+ *           count -- the number of dentries
+ *           dir -- the existing output directory
+ *           depth -- the number of directories above dir
+ *  OUTPUTS : the files
+ *  RETURN VALUE : 0 on success, -1 if a file cannot be written
+ *  SIDE EFFECTS : create files and directories in dir
+ */
+static int extract_dir(uint8_t* image, const dentry_t* entries, uint32_t count, const char* dir, uint32_t depth)
+{
+    boot_block_t* boot = (boot_block_t*)image;
+    uint32_t* inodes = (uint32_t*)(image + BLOCK_SIZE);
+    uint8_t* data = image + (1 + boot->num_inodes) * BLOCK_SIZE;
+    char path[4096], name[MAX_FILENAME_LEN + 1];
+    uint32_t i, j, num;
+    dentry_t* sub;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        const dentry_t* dentry = &entries[i];
+        int subdir = (dentry->file_type == FILE_TYPE_DIR && dentry->inode != DIR_INODE);
+        if ((dentry->file_type != FILE_TYPE_REGULAR && !subdir) || dentry->inode >= boot->num_inodes) continue;
+        if (subdir && depth + 1 >= MAX_DIR_DEPTH) continue;
+        memset(name, 0, sizeof(name));
+        memcpy(name, dentry->file_name, MAX_FILENAME_LEN);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (subdir) {
+            sub = read_subdir(image, dentry->inode, &num);
+            if (sub == NULL) {
+                fprintf(stderr, "mkfs: %s is corrupted\n", path);
+                continue;
+            }
+            if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                fprintf(stderr, "mkfs: cannot create %s\n", path);
+                free(sub);
+                return -1;
+            }
+            ret = extract_dir(image, sub, num, path, depth + 1);
+            free(sub);
+            if (ret == -1) return -1;
+            continue;
+        }
+        uint32_t* inode = inodes + dentry->inode * (BLOCK_SIZE / 4);
+        uint32_t length = inode[0];
+        FILE* fp = fopen(path, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "mkfs: cannot write %s\n", path);
+            return -1;
+        }
+        for (j = 0; j * CLUSTER_SIZE < length; j++) {
+            static uint8_t cluster[CLUSTER_SIZE];
+            uint32_t chunk = (length - j * CLUSTER_SIZE < CLUSTER_SIZE) ? length - j * CLUSTER_SIZE : CLUSTER_SIZE;
+            if (read_cluster(data, boot->num_data_blocks, inode, j, cluster) == -1) {
+                fprintf(stderr, "mkfs: %s is corrupted\n", path);
+                break;
+            }
+            fwrite(cluster, 1, chunk, fp);
+        }
+        fclose(fp);
+    }
+    return 0;
+}
+
+/**
+ * extract_image
+ *  DESCRIPTION : write every regular file and subdirectory of an image into a directory
+ *  INPUTS : in -- the image path
+ *           dir -- the existing output directory
+ *  OUTPUTS : the files
+ *  RETURN VALUE : 0 on success, -1 on error
+ *  SIDE EFFECTS : create files and directories in dir
+ */
+static int extract_image(const char* in, const char* dir)
+{
+    static dentry_t root[MAX_DIR_ENTRIES];
+    uint32_t image_size, i;
+    uint8_t* image = read_file(in, &image_size);
+    int ret;
+    if (image == NULL || image_size < BLOCK_SIZE) {
+        fprintf(stderr, "mkfs: cannot read %s\n", in);
+        return -1;
+    }
+    boot_block_t* boot = (boot_block_t*)image;
+    if ((size_t)(1 + boot->num_inodes + boot->num_data_blocks) * BLOCK_SIZE > image_size || boot->num_dir_entries > MAX_DIR_ENTRIES) {
+        fprintf(stderr, "mkfs: %s is not a filesystem image\n", in);
+        free(image);
+        return -1;
+    }
+
+    for (i = 0; i < boot->num_dir_entries; i++) {
+        dentry_t* dentry = dentry_at(image, i);
+        if (dentry == NULL) break;
+        root[i] = *dentry;
+    }
+    ret = extract_dir(image, root, i, dir, 0);
+    free(image);
+    return ret;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mkfs [-z] [-i inodes] [-s spare_blocks] -o filesys_img dir\n"
+                    "       mkfs -x filesys_img dir\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t num_inodes = DEFAULT_INODES, spare = DEFAULT_SPARE;
+    const char* out = NULL;
+    const char* extract = NULL;
+    int compress = 0;
+    int i;
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+        if (!strcmp(argv[i], "-z")) {
+            compress = 1;
+            i--;                                        // no argument
+        }
+        else if (!strcmp(argv[i], "-i")) num_inodes = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-s")) spare = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-o")) out = argv[i + 1];
+        else if (!strcmp(argv[i], "-x")) extract = argv[i + 1];
+        else usage();
+    }
+    if (i != argc - 1 || (out == NULL) == (extract == NULL) || num_inodes < 2 || num_inodes > MAX_INODES) usage();
+    if (extract != NULL) return extract_image(extract, argv[i]) ? 1 : 0;
+    return make_image(out, argv[i], num_inodes, spare, compress) ? 1 : 0;
+}
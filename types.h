@@ -21,6 +21,12 @@ typedef unsigned short uint16_t;
 typedef char int8_t;
 typedef unsigned char uint8_t;
 
+/* One buffer of a readv/writev vector, just like struct iovec */
+typedef struct iovec {
+    void* iov_base;
+    uint32_t iov_len;
+} iovec_t;
+
 #endif /* ASM */
 
 #endif /* _TYPES_H */